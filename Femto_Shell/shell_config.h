@@ -0,0 +1,15 @@
+/**
+ * Femto Shell - prompt and features of the shared shell core
+ * Author: Ahmed Wagdy
+ * Date: 19/3/2025
+ */
+
+#ifndef SHELL_CONFIG_H
+#define SHELL_CONFIG_H
+
+#define SHELL_PROMPT "Femto shell prompt > "
+#define SHELL_GOODBYE "Good Bye :)"
+
+// echo and exit only, echo prints the rest of the line as typed and the shell always exits with 0
+
+#endif // SHELL_CONFIG_H
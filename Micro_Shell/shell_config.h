@@ -0,0 +1,35 @@
+/**
+ * Micro Shell - prompt and features of the shared shell core
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#ifndef SHELL_CONFIG_H
+#define SHELL_CONFIG_H
+
+#define SHELL_PROMPT "Micro Shell Prompt > "
+#define SHELL_GOODBYE "Good Bye"
+
+#define SHELL_FEATURE_WORDS 1
+#define SHELL_FEATURE_STATUS 1
+#define SHELL_FEATURE_DIRS 1
+#define SHELL_FEATURE_EXTERNAL 1
+#define SHELL_FEATURE_VARS 1
+#define SHELL_FEATURE_REDIR 1
+#define SHELL_FEATURE_LISTS 1
+#define SHELL_FEATURE_STATS 1
+#define SHELL_FEATURE_STARTUP 1
+#define SHELL_FEATURE_EVENTLOOP 1
+#define SHELL_FEATURE_LIMITS 1
+#define SHELL_FEATURE_CGROUP 1
+#define SHELL_FEATURE_GLOB 1
+#define SHELL_FEATURE_SUBST 1
+#define SHELL_FEATURE_SCRIPT 1
+#define SHELL_FEATURE_ALIAS 1
+#define SHELL_FEATURE_ARITH 1
+
+#define SHELL_STATS_ENV "MICRO_SHELL_STATS"   // 1 turns stats on at startup
+#define SHELL_RC_FILE ".microshellrc"         // read from $HOME by interactive shells
+#define SHELL_CGROUP_ENV "MICRO_SHELL_CGROUP" // delegated cgroup v2 directory for "sandbox on"
+
+#endif // SHELL_CONFIG_H
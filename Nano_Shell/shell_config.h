@@ -0,0 +1,21 @@
+/**
+ * Nano Shell - prompt and features of the shared shell core
+ * Author: Ahmed Wagdy
+ * Date: 19/3/2025
+ */
+
+#ifndef SHELL_CONFIG_H
+#define SHELL_CONFIG_H
+
+#define SHELL_PROMPT "Nano Shell Prompt > "
+#define SHELL_GOODBYE "Good Bye"
+
+#define SHELL_FEATURE_WORDS 1
+#define SHELL_FEATURE_STATUS 1
+#define SHELL_FEATURE_DIRS 1
+#define SHELL_FEATURE_EXTERNAL 1
+#define SHELL_FEATURE_VARS 1
+#define SHELL_FEATURE_SCRIPT 1
+#define SHELL_FEATURE_ALIAS 1
+
+#endif // SHELL_CONFIG_H
@@ -0,0 +1,685 @@
+// Command dispatch benchmark for the Femto, Pico, Nano and Micro shells
+//
+// Every shell binary is started with its stdin and stdout connected to pipes
+// and fed a scripted workload one line at a time. The shells print their
+// prompt after each line, so counting prompts tells when a command finished.
+// The prompt string is learned from the first output of the shell.
+//
+// Reported per shell and workload:
+//   - commands per second
+//   - per-command latency (mean, percentiles, log2 histogram with -H)
+//   - allocations per command, when malloc_counter.so can be preloaded
+//   - RSS at start, peak and end, to spot leaks over long runs
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define DEFAULT_COMMANDS 100000
+#define READ_BUF_SIZE 65536
+#define PROMPT_MAX 256
+#define PROMPT_IDLE_MS 200
+#define HISTOGRAM_BUCKETS 28       // log2 buckets in microseconds, 1us .. ~134s
+#define RSS_SAMPLES 16
+#define PIPELINE_WINDOW 64         // lines in flight with -P
+#define LONG_LINE_WORDS 190        // stays under the shells' 1024 byte line limit
+#define MALLOC_COUNTER_LIB "malloc_counter.so"
+
+// A scripted workload: setup lines run once, then lines are sent in a cycle
+typedef struct {
+    const char *name;
+    const char *description;
+    const char *setup[4];
+    const char *lines[4];
+} Workload;
+
+static char long_line[1024];
+
+static const Workload workloads[] = {
+    { "builtin",  "built-in commands only",
+      { NULL },
+      { "echo hello world", "pwd", NULL } },
+    { "spawn",    "external 'true', one fork+exec per command",
+      { NULL },
+      { "true", NULL } },
+    { "vars",     "assignments, $var expansion and export",
+      { "a=alpha", "b=beta", NULL },
+      { "echo $a $b $a", "c=gamma", "export c", NULL } },
+    { "redirect", "redirections on every line",
+      { NULL },
+      { "echo data > /dev/null", "echo more >> /dev/null 2>&1", "pwd &> /dev/null", NULL } },
+    { "longline", "lines close to the input limit",
+      { NULL },
+      { long_line, NULL } },
+};
+
+#define WORKLOAD_COUNT (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+
+
+// Streaming substring counter (KMP), prompts may be split across reads
+typedef struct {
+    char pattern[PROMPT_MAX];
+    size_t len;
+    size_t fail[PROMPT_MAX];
+    size_t state;
+    unsigned long count;
+} PromptCounter;
+
+// A running shell under test
+typedef struct {
+    pid_t pid;
+    int to_shell;
+    int from_shell;
+    PromptCounter prompts;
+} ShellProc;
+
+// Results of one shell/workload run
+typedef struct {
+    unsigned long commands;
+    double seconds;
+    unsigned long long *latency_ns;     // per command, NULL with -P
+    unsigned long histogram[HISTOGRAM_BUCKETS];
+    long rss_start_kb;
+    long rss_peak_kb;
+    long rss_end_kb;
+    double allocs_per_cmd;              // -1 when not measured
+    double bytes_per_cmd;
+} BenchResult;
+
+typedef struct {
+    unsigned long commands;
+    int pipelined;
+    int show_histogram;
+    const char *malloc_lib;
+} BenchOptions;
+
+
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+static void prompt_counter_init(PromptCounter *pc, const char *prompt, size_t len) {
+    memcpy(pc->pattern, prompt, len);
+    pc->len = len;
+    pc->state = 0;
+    pc->count = 0;
+    pc->fail[0] = 0;
+    for (size_t i = 1, k = 0; i < len; i++) {
+        while (k > 0 && prompt[i] != prompt[k]) {
+            k = pc->fail[k - 1];
+        }
+        if (prompt[i] == prompt[k]) {
+            k++;
+        }
+        pc->fail[i] = k;
+    }
+}
+
+
+
+static void prompt_counter_feed(PromptCounter *pc, const char *buf, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        while (pc->state > 0 && buf[i] != pc->pattern[pc->state]) {
+            pc->state = pc->fail[pc->state - 1];
+        }
+        if (buf[i] == pc->pattern[pc->state]) {
+            pc->state++;
+        }
+        if (pc->state == pc->len) {
+            pc->count++;
+            pc->state = pc->fail[pc->state - 1];
+        }
+    }
+}
+
+
+
+// Resident set size of a process in KB, -1 if it cannot be read
+static long read_rss_kb(pid_t pid) {
+    char path[64], line[256];
+    long rss = -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "VmRSS:", 6) == 0) {
+            rss = strtol(line + 6, NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return rss;
+}
+
+
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+
+/*
+ - Read whatever the shell printed, waiting at most timeout_ms
+ - Returns bytes read, 0 on timeout, -1 on EOF or error
+*/
+static ssize_t read_output(ShellProc *sh, char *buf, size_t size, int timeout_ms) {
+    struct pollfd pfd = { sh->from_shell, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0) {
+        return ready == 0 ? 0 : -1;
+    }
+    ssize_t n = read(sh->from_shell, buf, size);
+    if (n <= 0) {
+        return -1;
+    }
+    prompt_counter_feed(&sh->prompts, buf, n);
+    return n;
+}
+
+
+
+/*
+ - Start a shell with pipes on stdin/stdout, stderr goes to /dev/null
+ - alloc_out != NULL preloads the malloc counter, which reports to that file
+*/
+static int launch_shell(const char *path, const char *malloc_lib, const char *alloc_out, ShellProc *sh) {
+    int in_pipe[2], out_pipe[2];
+
+    if (pipe2(in_pipe, O_CLOEXEC) == -1 || pipe2(out_pipe, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        return -1;
+    }
+
+    sh->pid = fork();
+    if (sh->pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (sh->pid == 0) {
+        dup2(in_pipe[0], STDIN_FILENO);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull != -1) {
+            dup2(devnull, STDERR_FILENO);
+        }
+        if (alloc_out != NULL) {
+            char pid_text[32];
+            snprintf(pid_text, sizeof(pid_text), "%d", (int)getpid());
+            setenv("LD_PRELOAD", malloc_lib, 1);
+            setenv("MALLOC_COUNTER_OUT", alloc_out, 1);
+            setenv("MALLOC_COUNTER_PID", pid_text, 1);
+        }
+        execl(path, path, (char *)NULL);
+        perror(path);
+        _exit(127);
+    }
+
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    sh->to_shell = in_pipe[1];
+    sh->from_shell = out_pipe[0];
+    return 0;
+}
+
+
+
+// Close the shell's stdin, drain its output and reap it
+static int finish_shell(ShellProc *sh) {
+    char buf[READ_BUF_SIZE];
+    int status;
+
+    close(sh->to_shell);
+    while (read_output(sh, buf, sizeof(buf), 5000) > 0) {
+    }
+    close(sh->from_shell);
+
+    while (waitpid(sh->pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return status;
+}
+
+
+
+/*
+ - Learn the prompt: everything the shell prints before its first input,
+   until it has been quiet for PROMPT_IDLE_MS
+*/
+static int learn_prompt(ShellProc *sh) {
+    char prompt[PROMPT_MAX];
+    size_t len = 0;
+    struct pollfd pfd = { sh->from_shell, POLLIN, 0 };
+
+    while (len < sizeof(prompt)) {
+        int ready = poll(&pfd, 1, len == 0 ? 5000 : PROMPT_IDLE_MS);
+        if (ready <= 0) {
+            break;
+        }
+        ssize_t n = read(sh->from_shell, prompt + len, sizeof(prompt) - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+
+    if (len == 0) {
+        fprintf(stderr, "shell printed no prompt\n");
+        return -1;
+    }
+    prompt_counter_init(&sh->prompts, prompt, len);
+    return 0;
+}
+
+
+
+// Send one line and wait until the next prompt shows up
+static int run_line_sync(ShellProc *sh, const char *line, char *buf) {
+    unsigned long target = sh->prompts.count + 1;
+
+    if (write_all(sh->to_shell, line, strlen(line)) != 0 || write_all(sh->to_shell, "\n", 1) != 0) {
+        return -1;
+    }
+    while (sh->prompts.count < target) {
+        if (read_output(sh, buf, READ_BUF_SIZE, 10000) <= 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+
+static const char *workload_line(const Workload *w, unsigned long i) {
+    int cycle = 0;
+    while (w->lines[cycle] != NULL) {
+        cycle++;
+    }
+    return w->lines[i % cycle];
+}
+
+
+
+/*
+ - Keep up to PIPELINE_WINDOW lines in flight, measuring raw throughput
+   without waiting for each command round trip
+*/
+static int run_pipelined(ShellProc *sh, const Workload *w, unsigned long commands, char *buf, BenchResult *res) {
+    unsigned long sent = 0;
+    unsigned long base = sh->prompts.count;
+    unsigned long next_sample = commands / RSS_SAMPLES;
+
+    while (sh->prompts.count - base < commands) {
+        unsigned long done = sh->prompts.count - base;
+        while (sent < commands && sent - done < PIPELINE_WINDOW) {
+            const char *line = workload_line(w, sent);
+            if (write_all(sh->to_shell, line, strlen(line)) != 0 || write_all(sh->to_shell, "\n", 1) != 0) {
+                return -1;
+            }
+            sent++;
+        }
+        if (read_output(sh, buf, READ_BUF_SIZE, 10000) <= 0) {
+            return -1;
+        }
+        if (done >= next_sample) {
+            long rss = read_rss_kb(sh->pid);
+            if (rss > res->rss_peak_kb) {
+                res->rss_peak_kb = rss;
+            }
+            next_sample += commands / RSS_SAMPLES + 1;
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+ - Run one workload against one shell
+ - alloc_out != NULL: the run is only used to count allocations
+*/
+static int run_workload(const char *shell, const Workload *w, const BenchOptions *opt,
+                        const char *alloc_out, BenchResult *res) {
+    ShellProc sh;
+    char *buf = malloc(READ_BUF_SIZE);
+    if (buf == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    if (launch_shell(shell, opt->malloc_lib, alloc_out, &sh) != 0 || learn_prompt(&sh) != 0) {
+        free(buf);
+        return -1;
+    }
+
+    int ok = 0;
+    for (int i = 0; w->setup[i] != NULL && ok == 0; i++) {
+        ok = run_line_sync(&sh, w->setup[i], buf);
+    }
+
+    res->commands = opt->commands;
+    res->rss_start_kb = res->rss_peak_kb = read_rss_kb(sh.pid);
+
+    double start = now_seconds();
+    if (ok == 0 && opt->pipelined) {
+        ok = run_pipelined(&sh, w, opt->commands, buf, res);
+    } else {
+        unsigned long next_sample = opt->commands / RSS_SAMPLES;
+        for (unsigned long i = 0; i < opt->commands && ok == 0; i++) {
+            unsigned long long t0 = now_ns();
+            ok = run_line_sync(&sh, workload_line(w, i), buf);
+            unsigned long long ns = now_ns() - t0;
+
+            if (res->latency_ns != NULL) {
+                res->latency_ns[i] = ns;
+            }
+            int bucket = 0;
+            for (unsigned long long us = ns / 1000; us > 1 && bucket < HISTOGRAM_BUCKETS - 1; us >>= 1) {
+                bucket++;
+            }
+            res->histogram[bucket]++;
+
+            if (i >= next_sample) {
+                long rss = read_rss_kb(sh.pid);
+                if (rss > res->rss_peak_kb) {
+                    res->rss_peak_kb = rss;
+                }
+                next_sample += opt->commands / RSS_SAMPLES + 1;
+            }
+        }
+    }
+    res->seconds = now_seconds() - start;
+    res->rss_end_kb = read_rss_kb(sh.pid);
+    if (res->rss_end_kb > res->rss_peak_kb) {
+        res->rss_peak_kb = res->rss_end_kb;
+    }
+
+    finish_shell(&sh);
+    free(buf);
+    if (ok != 0) {
+        fprintf(stderr, "%s: shell stopped answering during '%s'\n", shell, w->name);
+    }
+    return ok;
+}
+
+
+
+// Total allocation calls and bytes written by malloc_counter.so
+static int read_alloc_counts(const char *path, unsigned long *calls, unsigned long long *bytes) {
+    unsigned long m, c, r, f;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    int n = fscanf(fp, "%lu %lu %lu %lu %llu", &m, &c, &r, &f, bytes);
+    fclose(fp);
+    if (n != 5) {
+        return -1;
+    }
+    *calls = m + c + r;
+    return 0;
+}
+
+
+
+/*
+ - Allocations per command: one run with the workload and one with no
+   commands at all, so startup allocations cancel out
+*/
+static void measure_allocations(const char *shell, const Workload *w, const BenchOptions *opt, BenchResult *res) {
+    char path[] = "/tmp/shell_bench_allocs_XXXXXX";
+    int fd = mkstemp(path);
+    unsigned long calls_full, calls_base;
+    unsigned long long bytes_full, bytes_base;
+    BenchResult scratch;
+    BenchOptions count_opt = *opt;
+
+    res->allocs_per_cmd = -1;
+    if (fd == -1) {
+        return;
+    }
+    close(fd);
+
+    memset(&scratch, 0, sizeof(scratch));
+    count_opt.pipelined = 1;
+    if (run_workload(shell, w, &count_opt, path, &scratch) != 0 ||
+        read_alloc_counts(path, &calls_full, &bytes_full) != 0) {
+        unlink(path);
+        return;
+    }
+
+    count_opt.commands = 0;
+    memset(&scratch, 0, sizeof(scratch));
+    if (run_workload(shell, w, &count_opt, path, &scratch) != 0 ||
+        read_alloc_counts(path, &calls_base, &bytes_base) != 0) {
+        unlink(path);
+        return;
+    }
+    unlink(path);
+
+    res->allocs_per_cmd = (double)(calls_full - calls_base) / opt->commands;
+    res->bytes_per_cmd = (double)(bytes_full - bytes_base) / opt->commands;
+}
+
+
+
+static int compare_u64(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+
+
+static void print_result(const char *shell, const Workload *w, BenchResult *res, const BenchOptions *opt) {
+    const char *name = strrchr(shell, '/') ? strrchr(shell, '/') + 1 : shell;
+
+    printf("%-14s %-9s %10.0f", name, w->name, res->commands / res->seconds);
+    if (res->latency_ns != NULL && res->commands > 0) {
+        unsigned long long sum = 0;
+        for (unsigned long i = 0; i < res->commands; i++) {
+            sum += res->latency_ns[i];
+        }
+        qsort(res->latency_ns, res->commands, sizeof(res->latency_ns[0]), compare_u64);
+        printf(" %9.1f %9.1f %9.1f %9.1f %10.1f",
+               sum / 1e3 / res->commands,
+               res->latency_ns[res->commands / 2] / 1e3,
+               res->latency_ns[res->commands * 90 / 100] / 1e3,
+               res->latency_ns[res->commands * 99 / 100] / 1e3,
+               res->latency_ns[res->commands - 1] / 1e3);
+    } else {
+        printf(" %9s %9s %9s %9s %10s", "-", "-", "-", "-", "-");
+    }
+    if (res->allocs_per_cmd >= 0) {
+        printf(" %10.2f %10.0f", res->allocs_per_cmd, res->bytes_per_cmd);
+    } else {
+        printf(" %10s %10s", "-", "-");
+    }
+    printf(" %9ld %9ld %9ld\n", res->rss_start_kb, res->rss_peak_kb, res->rss_end_kb);
+
+    if (opt->show_histogram && !opt->pipelined) {
+        unsigned long max = 1;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            if (res->histogram[b] > max) {
+                max = res->histogram[b];
+            }
+        }
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            if (res->histogram[b] == 0) {
+                continue;
+            }
+            int bar = (int)(50.0 * res->histogram[b] / max);
+            printf("    %8lu us .. %8lu us %10lu |%.*s\n", b ? 1UL << b : 0UL, 2UL << b,
+                   res->histogram[b], bar, "##################################################");
+        }
+    }
+    fflush(stdout);
+}
+
+
+
+// malloc_counter.so next to this binary, if it was built
+static const char *default_malloc_lib(void) {
+    static char path[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - sizeof(MALLOC_COUNTER_LIB) - 1);
+    if (n <= 0) {
+        return NULL;
+    }
+    path[n] = '\0';
+    char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        return NULL;
+    }
+    strcpy(slash + 1, MALLOC_COUNTER_LIB);
+    return access(path, R_OK) == 0 ? path : NULL;
+}
+
+
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n commands] [-w workload[,workload...]] [-P] [-H] [-m malloc_counter.so|-M] shell...\n", prog);
+    fprintf(stderr, "  -n  commands per workload (default %d)\n", DEFAULT_COMMANDS);
+    fprintf(stderr, "  -w  workloads to run (default: all)\n");
+    fprintf(stderr, "  -P  pipelined: keep %d lines in flight, throughput only\n", PIPELINE_WINDOW);
+    fprintf(stderr, "  -H  print a latency histogram per run\n");
+    fprintf(stderr, "  -m  allocation counter library (default: %s next to this program)\n", MALLOC_COUNTER_LIB);
+    fprintf(stderr, "  -M  do not count allocations\n");
+    fprintf(stderr, "Workloads:\n");
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        fprintf(stderr, "  %-9s %s\n", workloads[i].name, workloads[i].description);
+    }
+}
+
+
+
+int main(int argc, char *argv[]) {
+    BenchOptions opt = { DEFAULT_COMMANDS, 0, 0, NULL };
+    const char *selected = NULL;
+    int count_allocs = 1;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "n:w:PHm:M")) != -1) {
+        switch (opt_char) {
+        case 'n': opt.commands = strtoul(optarg, NULL, 10); break;
+        case 'w': selected = optarg; break;
+        case 'P': opt.pipelined = 1; break;
+        case 'H': opt.show_histogram = 1; break;
+        case 'm': opt.malloc_lib = optarg; break;
+        case 'M': count_allocs = 0; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc || opt.commands == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // A shell that exits early must not kill us with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    if (count_allocs && opt.malloc_lib == NULL) {
+        opt.malloc_lib = default_malloc_lib();
+    }
+    if (!count_allocs) {
+        opt.malloc_lib = NULL;
+    }
+
+    // "echo abcd abcd ..." just below the 1024 byte line buffer
+    strcpy(long_line, "echo");
+    for (int i = 0; i < LONG_LINE_WORDS; i++) {
+        strcat(long_line, " abcd");
+    }
+
+    printf("%-14s %-9s %10s %9s %9s %9s %9s %10s %10s %10s %9s %9s %9s\n",
+           "shell", "workload", "cmds/s", "mean_us", "p50_us", "p90_us", "p99_us", "max_us",
+           "allocs/cmd", "bytes/cmd", "rss0_kb", "rssmax_kb", "rss_kb");
+
+    int failures = 0;
+    for (int s = optind; s < argc; s++) {
+        for (int i = 0; i < WORKLOAD_COUNT; i++) {
+            const Workload *w = &workloads[i];
+            if (selected != NULL) {
+                // Match whole names inside the comma separated list
+                const char *hit = strstr(selected, w->name);
+                size_t len = strlen(w->name);
+                if (hit == NULL || (hit != selected && hit[-1] != ',') || (hit[len] != '\0' && hit[len] != ',')) {
+                    continue;
+                }
+            }
+
+            BenchResult res;
+            memset(&res, 0, sizeof(res));
+            if (!opt.pipelined) {
+                res.latency_ns = malloc(opt.commands * sizeof(res.latency_ns[0]));
+                if (res.latency_ns == NULL) {
+                    perror("malloc");
+                    return 1;
+                }
+            }
+
+            if (run_workload(argv[s], w, &opt, NULL, &res) != 0) {
+                failures++;
+                free(res.latency_ns);
+                continue;
+            }
+            res.allocs_per_cmd = -1;
+            if (opt.malloc_lib != NULL) {
+                measure_allocations(argv[s], w, &opt, &res);
+            }
+            print_result(argv[s], w, &res, &opt);
+            free(res.latency_ns);
+        }
+    }
+
+    return failures ? 1 : 0;
+}
+
+
+// Compile the code using the following commands
+// gcc -O2 shell_bench.c -o shell_bench
+// gcc -O2 -shared -fPIC malloc_counter.c -o malloc_counter.so -ldl
+// Run the code using the following command
+// ./shell_bench -n 100000 ./femto_shell ./pico_shell ./nano_shell ./micro_shell
@@ -0,0 +1,355 @@
+// Differential test of Micro Shell against a reference shell
+//
+// Random scripts are generated from a small grammar whose meaning is the same
+// in Micro Shell and in POSIX sh: plain words, $var and $? expansion, name=value
+// assignments, ";", "&&", "||" lists and file redirections. Each script is run
+// by micro_shell and by the reference shell in the same scratch directory and
+// the outputs are compared. Any difference in tokenization, expansion, list
+// evaluation or redirection order shows up as a mismatch.
+//
+// Scripts can also be given as files, one command line per line.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define DEFAULT_SCRIPTS 1000
+#define MAX_SCRIPT_LINES 8
+#define MAX_LIST_LENGTH 4
+#define MAX_WORDS 4
+#define OUTPUT_LIMIT (1 << 20)
+#define MICRO_PROMPT "Micro Shell Prompt > "
+#define MICRO_GOODBYE "\nGood Bye\n"
+
+// Every script starts like this, so no expansion is ever empty and files exist
+static const char *script_prologue =
+    "v1=alpha\n"
+    "v2=b2\n"
+    "echo init > f1\n"
+    "echo init > f2\n";
+
+static const char *words[] = {
+    "a", "bb", "c1", "hello", "$v1", "$v2", "x$v1", "$v2.txt", "$?", "-", "1",
+    "f*", "f?", "[fg]2", "nomatch*",
+};
+
+static const char *files[] = { "f1", "f2", "f3" };
+
+#define COUNT(array) (int)(sizeof(array) / sizeof(array[0]))
+
+
+
+static int pick(int n) {
+    return rand() % n;
+}
+
+
+
+// Append one random command of the common grammar
+static void gen_command(char *out, size_t size) {
+    size_t len = strlen(out);
+    char *p = out + len;
+    size = size - len;
+
+    switch (pick(9)) {
+    case 0:
+    case 1: {
+        int n = pick(MAX_WORDS + 1);
+        int used = snprintf(p, size, "echo");
+        for (int i = 0; i < n; i++) {
+            used += snprintf(p + used, size - used, " %s", words[pick(COUNT(words))]);
+        }
+        break;
+    }
+    case 2:
+        snprintf(p, size, "%s", pick(2) ? "true" : "false");
+        break;
+    case 3:
+        snprintf(p, size, "echo %s %s %s", words[pick(COUNT(words))],
+                 pick(2) ? ">" : ">>", files[pick(COUNT(files))]);
+        break;
+    case 4:
+        snprintf(p, size, "cat %s%s", pick(2) ? "< " : "", files[pick(2)]);
+        break;
+    case 5:
+        snprintf(p, size, "v%d=%s", 1 + pick(2), pick(2) ? "new" : "z9");
+        break;
+    case 6:
+        snprintf(p, size, "echo $?");
+        break;
+    case 7:
+        snprintf(p, size, "ls");
+        break;
+    case 8:
+        // Redirection order matters: stderr follows stdout only when 2>&1 comes last
+        snprintf(p, size, "cat %s nofile %s", files[pick(2)],
+                 pick(2) ? "> f3 2>&1" : "2>&1 > f3");
+        break;
+    }
+}
+
+
+
+static void gen_script(char *out, size_t size) {
+    static const char *ops[] = { " ; ", " && ", " || " };
+    int lines = 1 + pick(MAX_SCRIPT_LINES);
+
+    snprintf(out, size, "%s", script_prologue);
+    for (int l = 0; l < lines; l++) {
+        int cmds = 1 + pick(MAX_LIST_LENGTH);
+        for (int c = 0; c < cmds; c++) {
+            if (c > 0) {
+                strncat(out, ops[pick(COUNT(ops))], size - strlen(out) - 1);
+            }
+            gen_command(out, size);
+        }
+        strncat(out, "\n", size - strlen(out) - 1);
+    }
+    // Show the final state of every file
+    strncat(out, "cat f1 ; cat f2 ; cat f3\n", size - strlen(out) - 1);
+}
+
+
+
+// Remove everything the previous run left in the scratch directory
+static void clean_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    if (d == NULL) {
+        return;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) {
+            unlinkat(dirfd(d), e->d_name, 0);
+        }
+    }
+    closedir(d);
+}
+
+
+
+/*
+ - Run argv with the script file as stdin, inside dir, stderr discarded
+ - A child that cannot start the shell reports its errno through a close on
+   exec pipe, so it is told apart from a shell that exits 127 on its own
+ - Returns the number of stdout bytes captured into out, -1 on error
+*/
+static ssize_t run_capture(char *const argv[], const char *script_path, const char *dir, char *out) {
+    int pipefd[2], errfd[2];
+    if (pipe(pipefd) == -1 || pipe2(errfd, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        int in = open(script_path, O_RDONLY);
+        int devnull = open("/dev/null", O_WRONLY);
+        if (in != -1 && devnull != -1 && chdir(dir) == 0) {
+            dup2(in, STDIN_FILENO);
+            dup2(pipefd[1], STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(pipefd[0]);
+            close(pipefd[1]);
+            execv(argv[0], argv);
+        }
+        int err = errno;
+        ssize_t w = write(errfd[1], &err, sizeof(err));
+        (void)w;
+        _exit(127);
+    }
+
+    close(pipefd[1]);
+    close(errfd[1]);
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(pipefd[0], out + len, OUTPUT_LIMIT - 1 - len)) > 0) {
+        len += n;
+    }
+    close(pipefd[0]);
+    out[len] = '\0';
+
+    int err;
+    n = read(errfd[0], &err, sizeof(err));
+    close(errfd[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (n == sizeof(err)) {
+        fprintf(stderr, "cannot run %s: %s\n", argv[0], strerror(err));
+        return -1;
+    }
+    return len;
+}
+
+
+
+// Drop Micro Shell's prompts and the goodbye line, leaving command output only
+static void strip_micro_output(char *out) {
+    size_t prompt_len = strlen(MICRO_PROMPT);
+    char *w = out;
+    for (char *r = out; *r; ) {
+        if (strncmp(r, MICRO_PROMPT, prompt_len) == 0) {
+            r += prompt_len;
+        } else {
+            *w++ = *r++;
+        }
+    }
+    *w = '\0';
+
+    size_t len = strlen(out), bye = strlen(MICRO_GOODBYE);
+    if (len >= bye && strcmp(out + len - bye, MICRO_GOODBYE) == 0) {
+        out[len - bye] = '\0';
+    }
+}
+
+
+
+// Run one script in both shells, 0 when the outputs agree, 1 when they differ, -1 on error
+static int check_script(const char *script, const char *micro, const char *reference,
+                        const char *dir, char *micro_out, char *ref_out) {
+    char script_path[] = "/tmp/diff_shell_script_XXXXXX";
+    int fd = mkstemp(script_path);
+    if (fd == -1 || write(fd, script, strlen(script)) != (ssize_t)strlen(script)) {
+        perror("script file");
+        return -1;
+    }
+    close(fd);
+
+    char *micro_argv[] = { (char *)micro, NULL };
+    char *ref_argv[] = { (char *)reference, script_path, NULL };
+
+    clean_dir(dir);
+    ssize_t n1 = run_capture(micro_argv, script_path, dir, micro_out);
+    clean_dir(dir);
+    ssize_t n2 = run_capture(ref_argv, "/dev/null", dir, ref_out);
+    unlink(script_path);
+    if (n1 < 0 || n2 < 0) {
+        return -1;
+    }
+
+    strip_micro_output(micro_out);
+    if (strcmp(micro_out, ref_out) == 0) {
+        return 0;
+    }
+
+    printf("=== mismatch\n--- script\n%s--- %s\n%s--- %s\n%s", script, reference, ref_out, micro, micro_out);
+    return 1;
+}
+
+
+
+static char *read_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return NULL;
+    }
+    char *buf = calloc(1, OUTPUT_LIMIT);
+    if (buf != NULL) {
+        size_t n = fread(buf, 1, OUTPUT_LIMIT - 1, fp);
+        buf[n] = '\0';
+    }
+    fclose(fp);
+    return buf;
+}
+
+
+
+int main(int argc, char *argv[]) {
+    unsigned long scripts = DEFAULT_SCRIPTS;
+    unsigned int seed = 1;
+    const char *reference = "/bin/sh";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:r:")) != -1) {
+        switch (opt) {
+        case 'n': scripts = strtoul(optarg, NULL, 10); break;
+        case 's': seed = strtoul(optarg, NULL, 10); break;
+        case 'r': reference = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n scripts] [-s seed] [-r reference_shell] micro_shell [script files...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-n scripts] [-s seed] [-r reference_shell] micro_shell [script files...]\n", argv[0]);
+        return 2;
+    }
+
+    // The shells run inside the scratch directory, a relative path would be looked up there
+    char *micro = realpath(argv[optind], NULL);
+    if (micro == NULL) {
+        perror(argv[optind]);
+        return 2;
+    }
+    char *reference_path = realpath(reference, NULL);
+    if (reference_path == NULL) {
+        perror(reference);
+        return 2;
+    }
+    reference = reference_path;
+    char dir[] = "/tmp/diff_shell_dir_XXXXXX";
+    char *micro_out = malloc(OUTPUT_LIMIT);
+    char *ref_out = malloc(OUTPUT_LIMIT);
+    if (mkdtemp(dir) == NULL || micro_out == NULL || ref_out == NULL) {
+        perror("setup");
+        return 1;
+    }
+
+    // A harness error (a shell that cannot be run, ...) ends the run, it says nothing about the parser
+    unsigned long checked = 0, mismatches = 0;
+    int result = 0;
+    if (optind + 1 < argc) {
+        for (int i = optind + 1; i < argc && result != -1; i++) {
+            char *script = read_file(argv[i]);
+            if (script == NULL) {
+                continue;
+            }
+            result = check_script(script, micro, reference, dir, micro_out, ref_out);
+            mismatches += result == 1;
+            checked += result != -1;
+            free(script);
+        }
+    } else {
+        char script[8192];
+        srand(seed);
+        for (unsigned long i = 0; i < scripts && result != -1; i++) {
+            gen_script(script, sizeof(script));
+            result = check_script(script, micro, reference, dir, micro_out, ref_out);
+            mismatches += result == 1;
+            checked += result != -1;
+        }
+    }
+
+    clean_dir(dir);
+    rmdir(dir);
+    free(micro_out);
+    free(ref_out);
+    free(micro);
+    free(reference_path);
+
+    if (result == -1) {
+        fprintf(stderr, "aborted after %lu scripts\n", checked);
+        return 2;
+    }
+    printf("%lu scripts, %lu mismatches\n", checked, mismatches);
+    return mismatches ? 1 : 0;
+}
+
+
+// Compile the code using the following command
+// gcc -O2 fuzz/diff_shell.c -o diff_shell
+// Run the code using the following command
+// ./diff_shell -n 1000 ./micro_shell
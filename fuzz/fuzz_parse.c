@@ -0,0 +1,134 @@
+// Fuzz target for the Micro Shell parser and variable substitution
+//
+// The first line of the input is treated as a command line and run through
+// parse_command_list() (and so parse_input()), every parsed command then goes
+// through substitute_variables() or handle_assignment(). Whatever follows the
+// first line feeds heredoc bodies. Nothing is ever executed: the core is built
+// with fuzz/shell_config.h, without command substitution, arithmetic and
+// scripts, so a $(...) or `...` in the input stays text.
+//
+// Built with -DFUZZ_LIBFUZZER the file only provides LLVMFuzzerTestOneInput,
+// otherwise it has its own main() that reads files (or stdin) so it works as
+// an AFL target or for replaying crashes with a plain gcc build.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "shellcore.h"
+
+#define MAX_FUZZ_INPUT (1 << 20)
+
+
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char line[MAX_INPUT_SIZE];
+    
+    // Same limits as fgets() in the shell: one line, at most MAX_INPUT_SIZE - 1 bytes
+    size_t line_len = 0;
+    while (line_len < size && line_len < MAX_INPUT_SIZE - 1 && data[line_len] != '\n') {
+        line_len++;
+    }
+    memcpy(line, data, line_len);
+    line[line_len] = '\0';
+    
+    // The remaining bytes are what the shell would read for heredocs
+    size_t rest_off = line_len < size ? line_len + 1 : size;
+    FILE *rest = NULL;
+    if (rest_off < size) {
+        rest = fmemopen((void *)(data + rest_off), size - rest_off, "r");
+    }
+    if (rest == NULL) {
+        rest = fopen("/dev/null", "r");
+    }
+    
+    VarTable var_table;
+    init_var_table(&var_table);
+    add_var(&var_table, "x", "5");
+    add_var(&var_table, "folder", "home dir");
+    var_table.last_status = 3;
+    
+    CommandList list = { NULL, 0, 0 };
+    if (parse_command_list(line, &list) == 0) {
+        for (int i = 0; i < list.count; i++) {
+            ListCommand *cmd = &list.items[i];
+            if (rest != NULL && collect_heredocs(&cmd->redirs, rest) != 0) {
+                break;
+            }
+            if (cmd->assignment != NULL) {
+                handle_assignment(cmd->assignment, &var_table);
+            } else if (cmd->arg_count > 0) {
+                int new_count;
+                char **args = substitute_variables(cmd->args, cmd->arg_count, &var_table, &new_count);
+                if (args != NULL && args != cmd->args) {
+                    free_args(args, new_count);
+                }
+            }
+        }
+    }
+    
+    free_command_list(&list);
+    free(list.items);
+    free_var_table(&var_table);
+    if (rest != NULL) {
+        fclose(rest);
+    }
+    return 0;
+}
+
+
+
+
+#ifndef FUZZ_LIBFUZZER
+
+// Run one input read from a stream
+static int run_stream(FILE *fp) {
+    uint8_t *buf = malloc(MAX_FUZZ_INPUT);
+    if (buf == NULL) {
+        perror("malloc failed");
+        return 1;
+    }
+    size_t len = fread(buf, 1, MAX_FUZZ_INPUT, fp);
+    LLVMFuzzerTestOneInput(buf, len);
+    free(buf);
+    return 0;
+}
+
+
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+#ifdef __AFL_LOOP
+        // AFL persistent mode, many inputs per process
+        while (__AFL_LOOP(10000)) {
+            run_stream(stdin);
+        }
+        return 0;
+#else
+        return run_stream(stdin);
+#endif
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        FILE *fp = fopen(argv[i], "rb");
+        if (fp == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        run_stream(fp);
+        fclose(fp);
+    }
+    return 0;
+}
+
+#endif // FUZZ_LIBFUZZER
+
+
+// Compile the code using the following commands
+// clang -g -O1 -fsanitize=fuzzer,address,undefined -DFUZZ_LIBFUZZER -I shellcore -I fuzz fuzz/fuzz_parse.c shellcore/*.c -o fuzz_parse
+// gcc -g -O1 -fsanitize=address,undefined -I shellcore -I fuzz fuzz/fuzz_parse.c shellcore/*.c -o fuzz_parse_replay
+// Run the code using the following command
+// ./fuzz_parse fuzz/corpus            or        ./fuzz_parse_replay fuzz/corpus/*
@@ -0,0 +1,37 @@
+/**
+ * Fuzz targets - features of the shared shell core under fuzz_parse
+ *
+ * Micro Shell's features without the ones that run commands while a line is
+ * expanded: $(command) and `command` would fork whatever the mutator writes,
+ * and arithmetic and scripts depend on them
+ */
+
+#ifndef SHELL_CONFIG_H
+#define SHELL_CONFIG_H
+
+#define SHELL_PROMPT "Fuzz Prompt > "
+#define SHELL_GOODBYE "Good Bye"
+
+#define SHELL_FEATURE_WORDS 1
+#define SHELL_FEATURE_STATUS 1
+#define SHELL_FEATURE_DIRS 1
+#define SHELL_FEATURE_EXTERNAL 1
+#define SHELL_FEATURE_VARS 1
+#define SHELL_FEATURE_REDIR 1
+#define SHELL_FEATURE_LISTS 1
+#define SHELL_FEATURE_STATS 1
+#define SHELL_FEATURE_STARTUP 1
+#define SHELL_FEATURE_EVENTLOOP 1
+#define SHELL_FEATURE_LIMITS 1
+#define SHELL_FEATURE_CGROUP 1
+#define SHELL_FEATURE_GLOB 1
+#define SHELL_FEATURE_SUBST 0
+#define SHELL_FEATURE_SCRIPT 0
+#define SHELL_FEATURE_ALIAS 1
+#define SHELL_FEATURE_ARITH 0
+
+#define SHELL_STATS_ENV "FUZZ_SHELL_STATS"
+#define SHELL_RC_FILE ".fuzzshellrc"
+#define SHELL_CGROUP_ENV "FUZZ_SHELL_CGROUP"
+
+#endif // SHELL_CONFIG_H
@@ -0,0 +1,640 @@
+/**
+ * Shell Core - integer arithmetic: $((expr)), ((expr)) and let
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "shellcore.h"
+
+
+
+
+#if SHELL_FEATURE_ARITH
+#define ARITH_MAX_DEPTH 256          // nested parentheses, unary operators and assignments
+
+// Binary operators, assignments reuse them for +=, <<=, ...
+typedef enum {
+    OP_NONE,
+    OP_OR, OP_AND,
+    OP_BIT_OR, OP_BIT_XOR, OP_BIT_AND,
+    OP_EQ, OP_NE,
+    OP_LT, OP_LE, OP_GT, OP_GE,
+    OP_SHL, OP_SHR,
+    OP_ADD, OP_SUB,
+    OP_MUL, OP_DIV, OP_MOD
+} ArithOp;
+
+// Operator text and precedence, two character operators come first
+static const struct {
+    const char *text;
+    ArithOp op;
+    int precedence;
+} binary_ops[] = {
+    { "||", OP_OR, 1 },
+    { "&&", OP_AND, 2 },
+    { "==", OP_EQ, 6 },
+    { "!=", OP_NE, 6 },
+    { "<=", OP_LE, 7 },
+    { ">=", OP_GE, 7 },
+    { "<<", OP_SHL, 8 },
+    { ">>", OP_SHR, 8 },
+    { "|", OP_BIT_OR, 3 },
+    { "^", OP_BIT_XOR, 4 },
+    { "&", OP_BIT_AND, 5 },
+    { "<", OP_LT, 7 },
+    { ">", OP_GT, 7 },
+    { "+", OP_ADD, 9 },
+    { "-", OP_SUB, 9 },
+    { "*", OP_MUL, 10 },
+    { "/", OP_DIV, 10 },
+    { "%", OP_MOD, 10 },
+};
+
+// State of one evaluation
+typedef struct {
+    const char *p;
+    const char *expr;           // whole expression, for error messages
+    VarTable *var_table;
+    int skip;                   // > 0 inside the side of &&, || or ?: that is not taken
+    int depth;
+    int failed;
+} ArithParser;
+
+
+
+
+
+
+
+// Report the first error of an evaluation, the later ones follow from it
+static int64_t arith_error(ArithParser *ap, const char *message) {
+    if (!ap->failed) {
+        if (*ap->p != '\0') {
+            fprintf(stderr, "arithmetic: %s: %s near '%s'\n", ap->expr, message, ap->p);
+        } else {
+            fprintf(stderr, "arithmetic: %s: %s\n", ap->expr, message);
+        }
+        ap->failed = 1;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+static void skip_spaces(ArithParser *ap) {
+    while (*ap->p == ' ' || *ap->p == '\t' || *ap->p == '\n') {
+        ap->p++;
+    }
+}
+
+
+
+
+
+
+
+// Length of the variable name p starts with, 0 when it starts none
+static size_t name_length(const char *p) {
+    if (!isalpha((unsigned char)*p) && *p != '_') {
+        return 0;
+    }
+    size_t len = 1;
+    while (isalnum((unsigned char)p[len]) || p[len] == '_') {
+        len++;
+    }
+    return len;
+}
+
+
+
+
+
+
+
+/*
+ - Value of a variable: unset or empty is 0, anything else must be an integer
+   (decimal, 0x hex or 0 octal) with an optional sign
+ - Read straight from the VarTable, no text is expanded or copied
+*/
+static int64_t read_var(ArithParser *ap, const char *name, size_t len) {
+    char name_buf[256];
+    if (ap->skip > 0) {
+        return 0;
+    }
+    if (len >= sizeof(name_buf)) {
+        return arith_error(ap, "variable name too long");
+    }
+    memcpy(name_buf, name, len);
+    name_buf[len] = '\0';
+    
+    const char *value = get_var_value(ap->var_table, name_buf);
+    if (value == NULL) {
+        return 0;
+    }
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    if (*value == '\0') {
+        return 0;
+    }
+    
+    char *end;
+    errno = 0;
+    long long number = strtoll(value, &end, 0);
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (errno != 0 || end == value || *end != '\0') {
+        fprintf(stderr, "arithmetic: %s: value of %s is not an integer: %s\n", ap->expr, name_buf, value);
+        ap->failed = 1;
+        return 0;
+    }
+    return number;
+}
+
+
+
+
+
+
+
+// Store value in a variable, skipped branches change nothing
+static void write_var(ArithParser *ap, const char *name, size_t len, int64_t value) {
+    char name_buf[256];
+    char digits[24];
+    if (ap->skip > 0 || ap->failed) {
+        return;
+    }
+    if (len >= sizeof(name_buf)) {
+        arith_error(ap, "variable name too long");
+        return;
+    }
+    memcpy(name_buf, name, len);
+    name_buf[len] = '\0';
+    snprintf(digits, sizeof(digits), "%" PRId64, value);
+    add_var(ap->var_table, name_buf, digits);
+}
+
+
+
+
+
+
+
+/*
+ - lhs op rhs with the 64-bit wrap around of sh, done on unsigned values so
+   overflow is never undefined behaviour
+ - Division by zero is an error, except in a branch that is not taken
+*/
+static int64_t apply_op(ArithParser *ap, ArithOp op, int64_t lhs, int64_t rhs) {
+    uint64_t a = (uint64_t)lhs;
+    uint64_t b = (uint64_t)rhs;
+    
+    switch (op) {
+    case OP_OR:      return lhs != 0 || rhs != 0;
+    case OP_AND:     return lhs != 0 && rhs != 0;
+    case OP_BIT_OR:  return lhs | rhs;
+    case OP_BIT_XOR: return lhs ^ rhs;
+    case OP_BIT_AND: return lhs & rhs;
+    case OP_EQ:      return lhs == rhs;
+    case OP_NE:      return lhs != rhs;
+    case OP_LT:      return lhs < rhs;
+    case OP_LE:      return lhs <= rhs;
+    case OP_GT:      return lhs > rhs;
+    case OP_GE:      return lhs >= rhs;
+    case OP_SHL:     return (int64_t)(a << (b & 63));
+    case OP_SHR:     return lhs >> (b & 63);
+    case OP_ADD:     return (int64_t)(a + b);
+    case OP_SUB:     return (int64_t)(a - b);
+    case OP_MUL:     return (int64_t)(a * b);
+    case OP_DIV:
+    case OP_MOD:
+        if (rhs == 0) {
+            return ap->skip > 0 ? 0 : arith_error(ap, "division by zero");
+        }
+        if (rhs == -1) {
+            // INT64_MIN / -1 overflows, it wraps to itself
+            return op == OP_DIV ? (int64_t)(0 - a) : 0;
+        }
+        return op == OP_DIV ? lhs / rhs : lhs % rhs;
+    case OP_NONE:
+        break;
+    }
+    return rhs;
+}
+
+
+
+
+
+
+
+/*
+ - Binary operator at p: returns its length and fills op and precedence
+ - Returns 0 for anything else, also for the "+=" or "<<=" of an assignment
+*/
+static int match_binary(const char *p, ArithOp *op, int *precedence) {
+    for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+        int len = strlen(binary_ops[i].text);
+        if (strncmp(p, binary_ops[i].text, len) != 0) {
+            continue;
+        }
+        ArithOp found = binary_ops[i].op;
+        int compares = found == OP_EQ || found == OP_NE || (found >= OP_LT && found <= OP_GE);
+        if (p[len] == '=' && !compares) {
+            return 0;
+        }
+        *op = found;
+        *precedence = binary_ops[i].precedence;
+        return len;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Assignment operator at p: "=" (not "=="), "+=", "<<=", ...
+ - Returns its length and fills op, OP_NONE for a plain "=", 0 for no assignment
+*/
+static int match_assign(const char *p, ArithOp *op) {
+    if (p[0] == '=') {
+        *op = OP_NONE;
+        return p[1] == '=' ? 0 : 1;
+    }
+    if ((p[0] == '<' || p[0] == '>') && p[1] == p[0] && p[2] == '=') {
+        *op = p[0] == '<' ? OP_SHL : OP_SHR;
+        return 3;
+    }
+    if (p[0] != '\0' && p[1] == '=' && strchr("+-*/%&^|", p[0]) != NULL) {
+        int precedence;
+        char text[2] = { p[0], '\0' };
+        return match_binary(text, op, &precedence) > 0 ? 2 : 0;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+static int64_t parse_assign(ArithParser *ap);
+static int64_t parse_comma(ArithParser *ap);
+
+
+
+
+
+
+
+// Guard against "((((...", every level is a C stack frame
+static int enter(ArithParser *ap) {
+    if (++ap->depth > ARITH_MAX_DEPTH) {
+        arith_error(ap, "expression nested too deeply");
+        return 0;
+    }
+    return 1;
+}
+
+
+
+
+
+
+
+/*
+ - A number, a variable (with a ++ or -- after it) or a (...) group
+*/
+static int64_t parse_primary(ArithParser *ap) {
+    skip_spaces(ap);
+    const char *p = ap->p;
+    
+    if (*p == '(') {
+        ap->p++;
+        int64_t value = parse_comma(ap);
+        skip_spaces(ap);
+        if (ap->failed) {
+            return 0;
+        }
+        if (*ap->p != ')') {
+            return arith_error(ap, "missing ')'");
+        }
+        ap->p++;
+        return value;
+    }
+    
+    if (isdigit((unsigned char)*p)) {
+        char *end;
+        errno = 0;
+        long long number = strtoll(p, &end, 0);
+        if (errno != 0) {
+            return arith_error(ap, "number out of range");
+        }
+        if (isalnum((unsigned char)*end) || *end == '_') {
+            ap->p = end;
+            return arith_error(ap, "invalid number");
+        }
+        ap->p = end;
+        return number;
+    }
+    
+    size_t len = name_length(p);
+    if (len == 0) {
+        return arith_error(ap, "operand expected");
+    }
+    ap->p = p + len;
+    int64_t value = read_var(ap, p, len);
+    if ((ap->p[0] == '+' || ap->p[0] == '-') && ap->p[1] == ap->p[0]) {
+        // x++ and x-- give the old value
+        int64_t step = ap->p[0] == '+' ? 1 : -1;
+        ap->p += 2;
+        write_var(ap, p, len, apply_op(ap, OP_ADD, value, step));
+    }
+    return value;
+}
+
+
+
+
+
+
+
+/*
+ - Unary + - ! ~ and the ++x / --x of a variable
+ - "- -x" and "--1" are two minus signs, only "--name" decrements
+*/
+static int64_t parse_unary(ArithParser *ap) {
+    skip_spaces(ap);
+    char c = *ap->p;
+    
+    if ((c == '+' || c == '-') && ap->p[1] == c) {
+        const char *name = ap->p + 2;
+        while (*name == ' ' || *name == '\t') {
+            name++;
+        }
+        size_t len = name_length(name);
+        if (len > 0) {
+            ap->p = name + len;
+            int64_t value = apply_op(ap, OP_ADD, read_var(ap, name, len), c == '+' ? 1 : -1);
+            write_var(ap, name, len, value);
+            return value;
+        }
+    }
+    
+    if (c == '+' || c == '-' || c == '!' || c == '~') {
+        ap->p++;
+        if (!enter(ap)) {
+            return 0;
+        }
+        int64_t value = parse_unary(ap);
+        ap->depth--;
+        switch (c) {
+        case '-': return (int64_t)(0 - (uint64_t)value);
+        case '!': return value == 0;
+        case '~': return ~value;
+        default:  return value;
+        }
+    }
+    return parse_primary(ap);
+}
+
+
+
+
+
+
+
+/*
+ - Precedence climbing over binary_ops: an operand, then every operator
+   that binds at least as tight as min_precedence, all left associative
+ - && and || parse their right side in skip mode when the left decides
+*/
+static int64_t parse_binary(ArithParser *ap, int min_precedence) {
+    int64_t lhs = parse_unary(ap);
+    
+    while (!ap->failed) {
+        ArithOp op;
+        int precedence;
+        skip_spaces(ap);
+        int len = match_binary(ap->p, &op, &precedence);
+        if (len == 0 || precedence < min_precedence) {
+            break;
+        }
+        ap->p += len;
+    
+        int skips = (op == OP_AND && lhs == 0) || (op == OP_OR && lhs != 0);
+        ap->skip += skips;
+        int64_t rhs = parse_binary(ap, precedence + 1);
+        ap->skip -= skips;
+        lhs = apply_op(ap, op, lhs, rhs);
+    }
+    return lhs;
+}
+
+
+
+
+
+
+
+// cond ? a : b, only the branch taken is evaluated
+static int64_t parse_ternary(ArithParser *ap) {
+    int64_t cond = parse_binary(ap, 1);
+    skip_spaces(ap);
+    if (ap->failed || *ap->p != '?') {
+        return cond;
+    }
+    ap->p++;
+    
+    ap->skip += cond == 0;
+    int64_t taken = parse_assign(ap);
+    ap->skip -= cond == 0;
+    skip_spaces(ap);
+    if (ap->failed) {
+        return 0;
+    }
+    if (*ap->p != ':') {
+        return arith_error(ap, "':' expected");
+    }
+    ap->p++;
+    
+    ap->skip += cond != 0;
+    int64_t other = parse_ternary(ap);
+    ap->skip -= cond != 0;
+    return cond != 0 ? taken : other;
+}
+
+
+
+
+
+
+
+// name = value, name += value, ... are right associative
+static int64_t parse_assign(ArithParser *ap) {
+    if (!enter(ap)) {
+        return 0;
+    }
+    skip_spaces(ap);
+    
+    const char *name = ap->p;
+    size_t len = name_length(name);
+    if (len > 0) {
+        const char *q = name + len;
+        while (*q == ' ' || *q == '\t') {
+            q++;
+        }
+        ArithOp op;
+        int op_len = match_assign(q, &op);
+        if (op_len > 0) {
+            ap->p = q + op_len;
+            int64_t value = parse_assign(ap);
+            if (op != OP_NONE) {
+                value = apply_op(ap, op, read_var(ap, name, len), value);
+            }
+            write_var(ap, name, len, value);
+            ap->depth--;
+            return value;
+        }
+    }
+    
+    int64_t value = parse_ternary(ap);
+    ap->depth--;
+    return value;
+}
+
+
+
+
+
+
+
+// a, b evaluates both and gives b
+static int64_t parse_comma(ArithParser *ap) {
+    int64_t value = parse_assign(ap);
+    skip_spaces(ap);
+    while (!ap->failed && *ap->p == ',') {
+        ap->p++;
+        value = parse_assign(ap);
+        skip_spaces(ap);
+    }
+    return value;
+}
+
+
+
+
+
+
+
+/*
+ - Evaluate expr with 64-bit integers, variables are read and assigned in
+   the VarTable directly, nothing is forked
+ - Returns 0 and fills value, -1 on error (already reported)
+*/
+static int evaluate(const char *expr, VarTable *var_table, int64_t *value) {
+    ArithParser ap = { expr, expr, var_table, 0, 0, 0 };
+    
+    *value = parse_comma(&ap);
+    skip_spaces(&ap);
+    if (!ap.failed && *ap.p != '\0') {
+        arith_error(&ap, "syntax error");
+    }
+    return ap.failed ? -1 : 0;
+}
+
+
+
+
+
+
+
+/*
+ - Expand $name and $(...) in the first len bytes of text, then evaluate it
+ - Used for the "((expr))" of $((expr)) and of the ((expr)) command
+ - Returns 0 and fills value, -1 on error (already reported)
+*/
+int arith_expand(const char *text, size_t len, VarTable *var_table, int64_t *value) {
+    char *expr = expand_string(text, len, var_table);
+    if (expr == NULL) {
+        return -1;
+    }
+    int result = evaluate(expr, var_table, value);
+    free(expr);
+    return result;
+}
+
+
+
+
+
+
+
+/*
+ - ((expr)) as a command: 0 when expr is not zero, 1 when it is or fails
+ - text is the whole command, nothing may follow the closing "))"
+*/
+int arith_command(const char *text, VarTable *var_table) {
+    const char *end = skip_substitution(text);
+    if (end == NULL) {
+        fprintf(stderr, "syntax error: unterminated ((\n");
+        return 1;
+    }
+    if (*end != '\0') {
+        fprintf(stderr, "syntax error near unexpected token '%s'\n", end);
+        return 1;
+    }
+    
+    int64_t value;
+    if (arith_expand(text, end - text, var_table, &value) != 0) {
+        return 1;
+    }
+    return value != 0 ? 0 : 1;
+}
+
+
+
+
+
+
+
+/*
+ - let expr...: evaluate every argument, "let i=i+1 j*=2"
+ - The arguments were already expanded like those of any command
+ - Returns 0 when the last one is not zero, 1 when it is or on error
+*/
+int let_builtin(char **args, int arg_count, VarTable *var_table) {
+    if (arg_count < 2) {
+        fprintf(stderr, "let: expression expected\n");
+        return 1;
+    }
+    
+    int64_t value = 0;
+    for (int i = 1; i < arg_count; i++) {
+        if (evaluate(args[i], var_table, &value) != 0) {
+            return 1;
+        }
+    }
+    return value != 0 ? 0 : 1;
+}
+#endif // SHELL_FEATURE_ARITH
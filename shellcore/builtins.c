@@ -0,0 +1,361 @@
+/**
+ * Shell Core - built-in commands
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "shellcore.h"
+
+
+
+
+static int builtin_exit(char** args, int arg_count, VarTable *var_table) {
+#if SHELL_FEATURE_STATUS
+    // "exit" alone keeps the status of the last command, like sh
+    int code = arg_count > 1 ? atoi(args[1]) : var_table->last_status;
+#else
+    (void)args;
+    (void)arg_count;
+    (void)var_table;
+    int code = 0;
+#endif
+    printf("%s\n", SHELL_GOODBYE);
+    exit(code & 0xff);
+}
+
+
+
+
+
+
+
+static int builtin_echo(char** args, int arg_count, VarTable *var_table) {
+    (void)var_table;
+    for (int i = 1; i < arg_count; i++) {
+        printf("%s", args[i]);
+        if (i < arg_count - 1) {
+            printf(" ");
+        }
+    }
+    printf("\n");
+    return 0;
+}
+
+
+
+
+
+
+
+#if SHELL_FEATURE_DIRS
+static int builtin_pwd(char** args, int arg_count, VarTable *var_table) {
+    (void)args;
+    (void)arg_count;
+    (void)var_table;
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        printf("%s\n", cwd);
+    } else {
+        perror("getcwd");
+        return 1;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+static int builtin_cd(char** args, int arg_count, VarTable *var_table) {
+    (void)var_table;
+    if (arg_count == 1 || strcmp(args[1], "~") == 0) {
+        // Change to home directory
+        char* home = getenv("HOME");
+        if (home == NULL) {
+            fprintf(stderr, "cd: HOME not set\n");
+            return 1;
+        } else if (chdir(home) != 0) {
+            perror("cd");
+            return 1;
+        }
+    } else if (chdir(args[1]) != 0) {
+        perror("cd");
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+
+
+
+
+
+
+#if SHELL_FEATURE_VARS
+static int builtin_export(char** args, int arg_count, VarTable *var_table) {
+    if (arg_count < 2) {
+        fprintf(stderr, "export: missing variable name\n");
+        return 1;
+    } else {
+        if (!export_var(var_table, args[1])) {
+            fprintf(stderr, "export: variable '%s' not found\n", args[1]);
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+
+
+
+
+
+
+#if SHELL_FEATURE_EVENTLOOP
+static int builtin_wait(char** args, int arg_count, VarTable *var_table) {
+    (void)var_table;
+    // "wait" waits for every background job, "wait PID" for one
+    if (arg_count > 1 && atoi(args[1]) <= 0) {
+        fprintf(stderr, "wait: '%s': not a pid\n", args[1]);
+        return 2;
+    }
+    return event_wait_background(arg_count > 1 ? atoi(args[1]) : 0);
+}
+#endif
+
+
+
+
+
+
+
+/*
+ - Built-ins that live in other files and do not need the variable table
+ - The macro gives each one a handler with the common signature
+*/
+#define BUILTIN_WRAPPER(name, call)                                          \
+    static int name(char** args, int arg_count, VarTable *var_table) {      \
+        (void)var_table;                                                     \
+        return call(args, arg_count);                                        \
+    }
+
+#if SHELL_FEATURE_STATS
+BUILTIN_WRAPPER(builtin_stats, stats_builtin)
+#endif
+#if SHELL_FEATURE_LIMITS
+BUILTIN_WRAPPER(builtin_ulimit, ulimit_builtin)
+#endif
+#if SHELL_FEATURE_CGROUP
+BUILTIN_WRAPPER(builtin_sandbox, sandbox_builtin)
+#endif
+#if SHELL_FEATURE_ALIAS
+BUILTIN_WRAPPER(builtin_alias, alias_builtin)
+BUILTIN_WRAPPER(builtin_unalias, unalias_builtin)
+#endif
+#if SHELL_FEATURE_EXTERNAL
+BUILTIN_WRAPPER(builtin_hash, hash_builtin)
+#endif
+
+
+
+
+
+
+
+// A built-in and its handler
+typedef struct {
+    const char *name;
+    BuiltinHandler handler;
+} BuiltinEntry;
+
+static const BuiltinEntry builtins[] = {
+    { "exit", builtin_exit },
+    { "echo", builtin_echo },
+#if SHELL_FEATURE_DIRS
+    { "pwd", builtin_pwd },
+    { "cd", builtin_cd },
+#endif
+#if SHELL_FEATURE_VARS
+    { "export", builtin_export },
+#endif
+#if SHELL_FEATURE_STATS
+    { "stats", builtin_stats },
+#endif
+#if SHELL_FEATURE_EVENTLOOP
+    { "wait", builtin_wait },
+#endif
+#if SHELL_FEATURE_LIMITS
+    { "ulimit", builtin_ulimit },
+#endif
+#if SHELL_FEATURE_CGROUP
+    { "sandbox", builtin_sandbox },
+#endif
+#if SHELL_FEATURE_SCRIPT
+    { "break", script_control_builtin },
+    { "continue", script_control_builtin },
+    { "return", script_control_builtin },
+#endif
+#if SHELL_FEATURE_ALIAS
+    { "alias", builtin_alias },
+    { "unalias", builtin_unalias },
+#endif
+#if SHELL_FEATURE_EXTERNAL
+    { "hash", builtin_hash },
+#endif
+#if SHELL_FEATURE_ARITH
+    { "let", let_builtin },
+#endif
+    { NULL, NULL }
+};
+
+// Hash of the names above, filled on the first lookup
+static NameTable builtin_table;
+
+
+
+
+
+
+
+/*
+ - Handler of the built-in called name, NULL if it is not one
+ - hash is name_hash(name), shared with the alias and function lookups
+*/
+BuiltinHandler lookup_builtin(const char *name, uint32_t hash) {
+    if (builtin_table.count == 0) {
+        for (int i = 0; builtins[i].name != NULL; i++) {
+            NameEntry *entry = name_table_insert(&builtin_table, builtins[i].name, name_hash(builtins[i].name));
+            if (entry == NULL) {
+                return NULL;
+            }
+            entry->value = (void *)&builtins[i];
+        }
+    }
+    
+    NameEntry *entry = name_table_find(&builtin_table, name, hash);
+    if (entry == NULL) {
+        return NULL;
+    }
+    return ((const BuiltinEntry *)entry->value)->handler;
+}
+
+
+
+
+
+
+
+// Run a resolved function or built-in and return its exit status
+static int run_in_shell(const CommandTarget *target, char** args, int arg_count, VarTable *var_table) {
+#if SHELL_FEATURE_SCRIPT
+    if (target->kind == COMMAND_FUNCTION) {
+        return call_function(target->function, args, arg_count, var_table);
+    }
+#endif
+    return target->builtin(args, arg_count, var_table);
+}
+
+
+
+
+
+
+
+/*
+ - Run a built-in or function with its redirections applied to the shell itself
+ - Every descriptor touched by a redirection is first saved with
+   F_DUPFD_CLOEXEC (so commands started later never inherit the copy) and
+   put back with dup2() once the built-in returns. No subshell is forked.
+ - Returns the built-in's exit status, 1 if the redirections failed
+*/
+int execute_builtin_redirected(const CommandTarget *target, char** args, int arg_count,
+                               VarTable *var_table, RedirList *redirs) {
+#if !SHELL_FEATURE_REDIR
+    (void)redirs;
+    return run_in_shell(target, args, arg_count, var_table);
+#else
+    if (redirs->count == 0) {
+        return run_in_shell(target, args, arg_count, var_table);
+    }
+    
+    int *saved = malloc(redirs->count * sizeof(int));
+    if (saved == NULL) {
+        perror("malloc failed");
+        return 1;
+    }
+    
+    // Save each descriptor once, -1 marks one that was closed before
+    for (int i = 0; i < redirs->count; i++) {
+        saved[i] = -1;
+        int seen = 0;
+        for (int j = 0; j < i; j++) {
+            if (redirs->items[j].fd == redirs->items[i].fd) {
+                seen = 1;
+                break;
+            }
+        }
+        if (seen) {
+            continue;
+        }
+        saved[i] = fcntl(redirs->items[i].fd, F_DUPFD_CLOEXEC, 10);
+        if (saved[i] == -1 && errno != EBADF) {
+            perror("fcntl");
+            for (int j = 0; j < i; j++) {
+                if (saved[j] != -1) {
+                    close(saved[j]);
+                }
+            }
+            free(saved);
+            return 1;
+        }
+    }
+    
+    // Anything still buffered belongs to the old destination
+    fflush(stdout);
+    fflush(stderr);
+    
+    int result = 1;
+    if (apply_redirections(redirs) == 0) {
+        result = run_in_shell(target, args, arg_count, var_table);
+    }
+    
+    fflush(stdout);
+    fflush(stderr);
+    
+    // Restore in reverse so the first saved copy of a descriptor wins
+    for (int i = redirs->count - 1; i >= 0; i--) {
+        int seen = 0;
+        for (int j = 0; j < i; j++) {
+            if (redirs->items[j].fd == redirs->items[i].fd) {
+                seen = 1;
+                break;
+            }
+        }
+        if (seen) {
+            continue;
+        }
+        if (saved[i] == -1) {
+            close(redirs->items[i].fd);
+        } else {
+            dup2(saved[i], redirs->items[i].fd);
+            close(saved[i]);
+        }
+    }
+    
+    free(saved);
+    return result;
+#endif
+}
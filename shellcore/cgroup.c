@@ -0,0 +1,609 @@
+/**
+ * Shell Core - cgroup v2 sandbox for external commands
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "shellcore.h"
+
+
+
+
+#if SHELL_FEATURE_CGROUP
+/*
+ - Sandbox settings: while it is on, every external command gets a leaf
+   cgroup <base>/shell.<pid>/cmd.<n> with the limits below written to it
+ - An empty limit leaves the controller's default ("max")
+*/
+static struct {
+    int enabled;
+    int subtree_fd;                 // <base>/shell.<pid>, -1 while the sandbox is off
+    char path[PATH_MAX];
+    char controllers[64];           // enabled for the leaves, from cgroup.subtree_control
+    unsigned long next_id;
+    char memory_max[32];
+    char cpu_max[48];
+    char io_max[128];
+} sandbox = { .subtree_fd = -1 };
+
+
+
+
+
+
+
+// Read a small cgroup file of dirfd into buf, returns its length or -1
+static int read_cgroup_file(int dirfd, const char *name, char *buf, size_t size) {
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+
+
+
+
+
+
+// Write text to a cgroup file of dirfd, returns 0 or -1 with errno set
+static int write_cgroup_file(int dirfd, const char *name, const char *text) {
+    int fd = openat(dirfd, name, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t len = write(fd, text, strlen(text));
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return len == (ssize_t)strlen(text) ? 0 : -1;
+}
+
+
+
+
+
+
+
+// Value of "key N" in a flat keyed file such as cpu.stat, -1 if absent
+static long long cgroup_key(const char *text, const char *key) {
+    size_t key_len = strlen(key);
+    
+    for (const char *line = text; line != NULL && *line; ) {
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+            return strtoll(line + key_len + 1, NULL, 10);
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) {
+            line++;
+        }
+    }
+    return -1;
+}
+
+
+
+
+
+
+
+/*
+ - Where the shell's own cgroup lives: the cgroup2 mount point from
+   /proc/self/mountinfo followed by the "0::" path of /proc/self/cgroup
+ - Returns 0 and fills path, -1 when there is no cgroup v2 hierarchy
+*/
+static int own_cgroup_path(char *path, size_t size) {
+    char line[1024];
+    char mount[PATH_MAX] = "";
+    char own[PATH_MAX] = "";
+    
+    FILE *fp = fopen("/proc/self/mountinfo", "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        // "id parent dev root mountpoint options ... - cgroup2 source options"
+        char *sep = strstr(line, " - cgroup2 ");
+        char point[PATH_MAX];
+        if (sep != NULL && sscanf(line, "%*s %*s %*s %*s %4095s", point) == 1) {
+            snprintf(mount, sizeof(mount), "%s", point);
+            break;
+        }
+    }
+    fclose(fp);
+    
+    fp = fopen("/proc/self/cgroup", "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(own, sizeof(own), "%s", line + 3);
+            break;
+        }
+    }
+    fclose(fp);
+    
+    if (mount[0] == '\0' || own[0] == '\0') {
+        return -1;
+    }
+    int len = snprintf(path, size, "%s%s", mount, strcmp(own, "/") == 0 ? "" : own);
+    return len < (int)size ? 0 : -1;
+}
+
+
+
+
+
+
+
+// Is a controller enabled for the leaves? Only meaningful while the sandbox is on
+static int has_controller(const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = strstr(sandbox.controllers, name); p != NULL; p = strstr(p + 1, name)) {
+        if ((p == sandbox.controllers || p[-1] == ' ') && (p[len] == '\0' || p[len] == ' ')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Turn the sandbox on under base, a cgroup v2 directory delegated to us
+   (systemd-run --user -p Delegate=yes, or one made by root)
+ - The shell's subtree shell.<pid> gets every controller the base offers,
+   so its leaves can be limited while the shell stays where it is
+ - Returns 0, 1 after printing why the sandbox cannot be used
+*/
+static int sandbox_on(const char *base) {
+    char base_path[PATH_MAX];
+    
+    if (sandbox.enabled) {
+        return 0;
+    }
+    if (base == NULL) {
+        base = getenv(SHELL_CGROUP_ENV);
+    }
+    if (base == NULL) {
+        if (own_cgroup_path(base_path, sizeof(base_path)) != 0) {
+            fprintf(stderr, "sandbox: no cgroup v2 hierarchy is mounted\n");
+            return 1;
+        }
+        base = base_path;
+    }
+    
+    int base_fd = open(base, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (base_fd == -1) {
+        fprintf(stderr, "sandbox: %s: %s\n", base, strerror(errno));
+        return 1;
+    }
+    
+    // Hand the controllers down one level, refused if base holds processes itself
+    char controllers[256];
+    if (read_cgroup_file(base_fd, "cgroup.controllers", controllers, sizeof(controllers)) < 0) {
+        fprintf(stderr, "sandbox: %s is not a cgroup v2 directory\n", base);
+        close(base_fd);
+        return 1;
+    }
+    static const char *wanted[] = { "memory", "cpu", "io", NULL };
+    for (int i = 0; wanted[i] != NULL; i++) {
+        char enable[16];
+        snprintf(enable, sizeof(enable), "+%s", wanted[i]);
+        write_cgroup_file(base_fd, "cgroup.subtree_control", enable);
+    }
+    
+    char name[32];
+    snprintf(name, sizeof(name), "shell.%d", (int)getpid());
+    // Leaves are removed by path, which must fit
+    if (snprintf(sandbox.path, sizeof(sandbox.path), "%s/%s", base, name) >= (int)sizeof(sandbox.path)) {
+        fprintf(stderr, "sandbox: %s: path too long\n", base);
+        close(base_fd);
+        return 1;
+    }
+    if (mkdirat(base_fd, name, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "sandbox: cannot create %s/%s: %s\n", base, name, strerror(errno));
+        close(base_fd);
+        return 1;
+    }
+    sandbox.subtree_fd = openat(base_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    close(base_fd);
+    if (sandbox.subtree_fd == -1) {
+        perror("sandbox");
+        return 1;
+    }
+    
+    // The subtree holds no processes, so it can enable whatever it was given
+    sandbox.controllers[0] = '\0';
+    for (int i = 0; wanted[i] != NULL; i++) {
+        char enable[16];
+        snprintf(enable, sizeof(enable), "+%s", wanted[i]);
+        if (write_cgroup_file(sandbox.subtree_fd, "cgroup.subtree_control", enable) == 0) {
+            size_t used = strlen(sandbox.controllers);
+            snprintf(sandbox.controllers + used, sizeof(sandbox.controllers) - used, "%s%s",
+                     used ? " " : "", wanted[i]);
+        }
+    }
+    sandbox.enabled = 1;
+    
+    // Limits set while the sandbox was off need their controller too
+    if (sandbox.memory_max[0] && !has_controller("memory")) {
+        fprintf(stderr, "sandbox: the memory controller is not delegated, memory limit dropped\n");
+        sandbox.memory_max[0] = '\0';
+    }
+    if (sandbox.cpu_max[0] && !has_controller("cpu")) {
+        fprintf(stderr, "sandbox: the cpu controller is not delegated, cpu limit dropped\n");
+        sandbox.cpu_max[0] = '\0';
+    }
+    if (sandbox.io_max[0] && !has_controller("io")) {
+        fprintf(stderr, "sandbox: the io controller is not delegated, io limit dropped\n");
+        sandbox.io_max[0] = '\0';
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Parse a memory size such as "512M", "2G" or "max" into a memory.max value
+ - Returns 0, -1 if the text is not a size
+*/
+static int parse_memory_max(const char *text, char *out, size_t size) {
+    if (strcmp(text, "max") == 0) {
+        snprintf(out, size, "max");
+        return 0;
+    }
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || text[0] == '-') {
+        return -1;
+    }
+    switch (*end) {
+    case '\0': break;
+    case 'k': case 'K': value <<= 10; break;
+    case 'm': case 'M': value <<= 20; break;
+    case 'g': case 'G': value <<= 30; break;
+    default: return -1;
+    }
+    if (*end != '\0' && end[1] != '\0') {
+        return -1;
+    }
+    snprintf(out, size, "%llu", value);
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Parse "50%", "QUOTA PERIOD" (microseconds) or "max" into a cpu.max value
+ - Percentages use the kernel's default 100ms period, 200% is two CPUs
+ - Returns 0, -1 on a malformed value
+*/
+static int parse_cpu_max(char **args, int count, char *out, size_t size) {
+    char *end;
+    
+    if (count == 1 && strcmp(args[0], "max") == 0) {
+        snprintf(out, size, "max");
+        return 0;
+    }
+    if (count == 1) {
+        double percent = strtod(args[0], &end);
+        if (end == args[0] || strcmp(end, "%") != 0 || percent <= 0) {
+            return -1;
+        }
+        long long quota = (long long)(percent * 1000);
+        snprintf(out, size, "%lld 100000", quota < 1000 ? 1000 : quota);   // the kernel's minimum quota is 1ms
+        return 0;
+    }
+    if (count == 2) {
+        long long quota = strtoll(args[0], &end, 10);
+        if (end == args[0] || *end != '\0' || quota <= 0) {
+            return -1;
+        }
+        long long period = strtoll(args[1], &end, 10);
+        if (end == args[1] || *end != '\0' || period <= 0) {
+            return -1;
+        }
+        snprintf(out, size, "%lld %lld", quota, period);
+        return 0;
+    }
+    return -1;
+}
+
+
+
+
+
+
+
+static void show_sandbox(void) {
+    if (!sandbox.enabled) {
+        printf("sandbox: off\n");
+    } else {
+        printf("sandbox: on, %s\n", sandbox.path);
+        printf("  controllers  %s\n", sandbox.controllers[0] ? sandbox.controllers : "(none delegated)");
+    }
+    printf("  memory.max   %s\n", sandbox.memory_max[0] ? sandbox.memory_max : "max");
+    printf("  cpu.max      %s\n", sandbox.cpu_max[0] ? sandbox.cpu_max : "max");
+    printf("  io.max       %s\n", sandbox.io_max[0] ? sandbox.io_max : "(none)");
+}
+
+
+
+
+
+
+
+/*
+ - sandbox [on [DIR] | off | memory SIZE | cpu PERCENT% | cpu QUOTA PERIOD |
+   io MAJ:MIN [rbps|wbps|riops|wiops N]... | io off]
+ - io takes KEY VALUE pairs, "key=value" would read as a variable assignment
+ - Without arguments shows the settings. Limits apply to commands started
+   afterwards, each command gets a fresh cgroup and a report of its peak
+   memory and CPU time when it ends.
+ - Returns 0, 1 if the sandbox cannot be set up, 2 on a usage error
+*/
+int sandbox_builtin(char **args, int arg_count) {
+    if (arg_count == 1) {
+        show_sandbox();
+        return 0;
+    }
+    
+    if (strcmp(args[1], "on") == 0 && arg_count <= 3) {
+        return sandbox_on(arg_count == 3 ? args[2] : NULL);
+    }
+    if (strcmp(args[1], "off") == 0 && arg_count == 2) {
+        cgroup_close();
+        return 0;
+    }
+    if (strcmp(args[1], "memory") == 0 && arg_count == 3) {
+        char value[sizeof(sandbox.memory_max)];
+        if (parse_memory_max(args[2], value, sizeof(value)) != 0) {
+            fprintf(stderr, "sandbox: memory: invalid size '%s'\n", args[2]);
+            return 2;
+        }
+        if (sandbox.enabled && !has_controller("memory")) {
+            fprintf(stderr, "sandbox: the memory controller is not delegated to %s\n", sandbox.path);
+            return 1;
+        }
+        strcpy(sandbox.memory_max, value);
+        return 0;
+    }
+    if (strcmp(args[1], "cpu") == 0 && arg_count >= 3) {
+        char value[sizeof(sandbox.cpu_max)];
+        if (parse_cpu_max(args + 2, arg_count - 2, value, sizeof(value)) != 0) {
+            fprintf(stderr, "sandbox: cpu: expected PERCENT%%, QUOTA PERIOD or max\n");
+            return 2;
+        }
+        if (sandbox.enabled && !has_controller("cpu")) {
+            fprintf(stderr, "sandbox: the cpu controller is not delegated to %s\n", sandbox.path);
+            return 1;
+        }
+        strcpy(sandbox.cpu_max, value);
+        return 0;
+    }
+    if (strcmp(args[1], "io") == 0 && arg_count >= 3) {
+        if (arg_count == 3 && strcmp(args[2], "off") == 0) {
+            sandbox.io_max[0] = '\0';
+            return 0;
+        }
+        if (strchr(args[2], ':') == NULL || arg_count % 2 != 1) {
+            fprintf(stderr, "sandbox: io: expected MAJ:MIN followed by rbps, wbps, riops or wiops and a value\n");
+            return 2;
+        }
+        if (sandbox.enabled && !has_controller("io")) {
+            fprintf(stderr, "sandbox: the io controller is not delegated to %s\n", sandbox.path);
+            return 1;
+        }
+        // "8:0 rbps 1048576" becomes the io.max line "8:0 rbps=1048576", the kernel validates it
+        snprintf(sandbox.io_max, sizeof(sandbox.io_max), "%s", args[2]);
+        for (int i = 3; i + 1 < arg_count; i += 2) {
+            size_t used = strlen(sandbox.io_max);
+            snprintf(sandbox.io_max + used, sizeof(sandbox.io_max) - used, " %s=%s", args[i], args[i + 1]);
+        }
+        return 0;
+    }
+    
+    fprintf(stderr, "sandbox: usage: sandbox [on [DIR] | off | memory SIZE | cpu PERCENT%% | "
+                    "cpu QUOTA PERIOD | io MAJ:MIN KEY VALUE... | io off]\n");
+    return 2;
+}
+
+
+
+
+
+
+
+/*
+ - Create the leaf cgroup of the next command and write the limits to it
+ - cg->dirfd is -1 when the sandbox is off, the command then runs as usual
+ - Returns 0, -1 if the leaf could not be set up (already reported)
+*/
+int cgroup_create_leaf(CmdCgroup *cg) {
+    cg->dirfd = -1;
+    cg->path = NULL;
+    if (!sandbox.enabled) {
+        return 0;
+    }
+    
+    char name[32];
+    cg->id = sandbox.next_id++;
+    snprintf(name, sizeof(name), "cmd.%lu", cg->id);
+    if (mkdirat(sandbox.subtree_fd, name, 0755) == -1) {
+        fprintf(stderr, "sandbox: cannot create %s/%s: %s\n", sandbox.path, name, strerror(errno));
+        return -1;
+    }
+    cg->dirfd = openat(sandbox.subtree_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    size_t path_size = strlen(sandbox.path) + strlen(name) + 2;
+    cg->path = malloc(path_size);
+    if (cg->dirfd == -1 || cg->path == NULL) {
+        perror("sandbox");
+        if (cg->dirfd != -1) {
+            close(cg->dirfd);
+            cg->dirfd = -1;
+        }
+        free(cg->path);
+        cg->path = NULL;
+        unlinkat(sandbox.subtree_fd, name, AT_REMOVEDIR);
+        return -1;
+    }
+    snprintf(cg->path, path_size, "%s/%s", sandbox.path, name);
+    
+    const struct { const char *file; const char *value; } limits[] = {
+        { "memory.max", sandbox.memory_max },
+        { "cpu.max", sandbox.cpu_max },
+        { "io.max", sandbox.io_max },
+    };
+    for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        if (limits[i].value[0] != '\0' && write_cgroup_file(cg->dirfd, limits[i].file, limits[i].value) != 0) {
+            fprintf(stderr, "sandbox: %s '%s': %s\n", limits[i].file, limits[i].value, strerror(errno));
+            close(cg->dirfd);
+            cg->dirfd = -1;
+            free(cg->path);
+            cg->path = NULL;
+            unlinkat(sandbox.subtree_fd, name, AT_REMOVEDIR);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Move the calling process into its leaf, for children that were not
+   created inside it by clone3(CLONE_INTO_CGROUP) (Linux < 5.7)
+ - Returns 0, -1 on error (already reported)
+*/
+int cgroup_join(const CmdCgroup *cg) {
+    if (write_cgroup_file(cg->dirfd, "cgroup.procs", "0") != 0) {
+        perror("sandbox: cgroup.procs");
+        return -1;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - A sandboxed command has ended: report its peak memory and CPU time from
+   the cgroup, kill anything it left running and remove the leaf
+*/
+void cgroup_release(CmdCgroup *cg) {
+    char buf[1024];
+    
+    if (cg->dirfd == -1) {
+        return;
+    }
+    
+    long long usage = -1, user = -1, system = -1, throttled = -1;
+    if (read_cgroup_file(cg->dirfd, "cpu.stat", buf, sizeof(buf)) >= 0) {
+        usage = cgroup_key(buf, "usage_usec");
+        user = cgroup_key(buf, "user_usec");
+        system = cgroup_key(buf, "system_usec");
+        throttled = cgroup_key(buf, "throttled_usec");
+    }
+    long long peak = -1, oom_kills = -1;
+    if (read_cgroup_file(cg->dirfd, "memory.peak", buf, sizeof(buf)) >= 0) {
+        peak = strtoll(buf, NULL, 10);
+    }
+    if (read_cgroup_file(cg->dirfd, "memory.events", buf, sizeof(buf)) >= 0) {
+        oom_kills = cgroup_key(buf, "oom_kill");
+    }
+    
+    fprintf(stderr, "sandbox: cpu %.3fs (user %.3fs, sys %.3fs)", usage / 1e6, user / 1e6, system / 1e6);
+    if (peak >= 0) {
+        fprintf(stderr, ", peak memory %.1f MB", peak / (1024.0 * 1024.0));
+    } else {
+        fprintf(stderr, ", peak memory n/a");
+    }
+    if (throttled > 0) {
+        fprintf(stderr, ", throttled %.3fs", throttled / 1e6);
+    }
+    if (oom_kills > 0) {
+        fprintf(stderr, ", %lld killed by memory.max", oom_kills);
+    }
+    fprintf(stderr, "\n");
+    
+    // Daemons the command left behind go with it, a cgroup only goes once empty
+    if (read_cgroup_file(cg->dirfd, "cgroup.events", buf, sizeof(buf)) >= 0 && cgroup_key(buf, "populated") == 1) {
+        write_cgroup_file(cg->dirfd, "cgroup.kill", "1");
+    }
+    close(cg->dirfd);
+    cg->dirfd = -1;
+    
+    // By the path kept at creation, "sandbox off" may have closed the subtree in the
+    // meantime, or the sandbox may have moved to another one
+    for (int tries = 0; tries < 50; tries++) {
+        if (rmdir(cg->path) == 0 || errno != EBUSY) {
+            break;
+        }
+        usleep(2000);   // Killed processes take a moment to leave
+    }
+    // A subtree that is no longer the sandbox goes with its last leaf
+    *strrchr(cg->path, '/') = '\0';
+    if (!sandbox.enabled || strcmp(cg->path, sandbox.path) != 0) {
+        rmdir(cg->path);
+    }
+    free(cg->path);
+    cg->path = NULL;
+}
+
+
+
+
+
+
+
+// Turn the sandbox off, its subtree goes once the last sandboxed job is gone
+void cgroup_close(void) {
+    if (sandbox.subtree_fd == -1) {
+        return;
+    }
+    close(sandbox.subtree_fd);
+    sandbox.subtree_fd = -1;
+    sandbox.enabled = 0;
+    rmdir(sandbox.path);
+}
+#endif // SHELL_FEATURE_CGROUP
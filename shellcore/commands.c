@@ -0,0 +1,531 @@
+/**
+ * Shell Core - command name lookup: hash tables, aliases and the PATH cache
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "shellcore.h"
+
+
+
+
+#if SHELL_FEATURE_ALIAS
+// An alias and its value, tokenized once when it is defined
+typedef struct {
+    char *text;
+    char **args;
+    int arg_count;
+} Alias;
+
+static NameTable aliases;
+#endif
+
+#if SHELL_FEATURE_EXTERNAL
+// Where programs were found, valid for the PATH they were looked up in
+static NameTable path_cache;
+static char *path_cache_env;
+#endif
+
+
+
+
+
+
+
+// FNV-1a, computed once per command name and reused for every table
+uint32_t name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+
+
+
+
+
+/*
+ - Find name in an open addressing table, hash is name_hash(name)
+ - Returns the entry, NULL when the name is not in the table
+*/
+NameEntry* name_table_find(const NameTable *table, const char *name, uint32_t hash) {
+    if (table->count == 0) {
+        return NULL;
+    }
+
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = hash & mask; table->items[i].name != NULL; i = (i + 1) & mask) {
+        NameEntry *entry = &table->items[i];
+        if (entry->hash == hash && strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+
+
+
+
+
+// Double the table (or allocate it) and put every entry in its new slot
+static int name_table_grow(NameTable *table) {
+    int new_capacity = table->capacity ? table->capacity * 2 : 16;
+    NameEntry *new_items = calloc(new_capacity, sizeof(NameEntry));
+    if (new_items == NULL) {
+        perror("calloc failed");
+        return -1;
+    }
+
+    uint32_t mask = new_capacity - 1;
+    for (int i = 0; i < table->capacity; i++) {
+        NameEntry *entry = &table->items[i];
+        if (entry->name == NULL) {
+            continue;
+        }
+        uint32_t j = entry->hash & mask;
+        while (new_items[j].name != NULL) {
+            j = (j + 1) & mask;
+        }
+        new_items[j] = *entry;
+    }
+    free(table->items);
+    table->items = new_items;
+    table->capacity = new_capacity;
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Find name, or add it with a NULL value
+ - Returns the entry, NULL on error. The pointer is only good until the
+   next insert, which may move the entries.
+*/
+NameEntry* name_table_insert(NameTable *table, const char *name, uint32_t hash) {
+    NameEntry *entry = name_table_find(table, name, hash);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    // Keep a quarter of the slots free so probe sequences stay short
+    if ((table->count + 1) * 4 > table->capacity * 3 && name_table_grow(table) != 0) {
+        return NULL;
+    }
+
+    uint32_t mask = table->capacity - 1;
+    uint32_t i = hash & mask;
+    while (table->items[i].name != NULL) {
+        i = (i + 1) & mask;
+    }
+    entry = &table->items[i];
+    entry->name = strdup(name);
+    if (entry->name == NULL) {
+        perror("strdup failed");
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->value = NULL;
+    table->count++;
+    return entry;
+}
+
+
+
+
+
+
+
+/*
+ - Take an entry out of the table, its value is the caller's to free
+ - The entries after it in the same run move back into the gap, so a
+   lookup never needs tombstones
+*/
+void name_table_remove(NameTable *table, NameEntry *entry) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t gap = entry - table->items;
+
+    free(entry->name);
+    entry->name = NULL;
+    table->count--;
+
+    for (uint32_t i = (gap + 1) & mask; table->items[i].name != NULL; i = (i + 1) & mask) {
+        uint32_t home = table->items[i].hash & mask;
+        // Move it if its home slot is not between the gap and where it is now
+        if (((i - home) & mask) >= ((i - gap) & mask)) {
+            table->items[gap] = table->items[i];
+            table->items[i].name = NULL;
+            gap = i;
+        }
+    }
+}
+
+
+
+
+
+
+
+#if SHELL_FEATURE_ALIAS
+static void free_alias(Alias *alias) {
+    if (alias != NULL) {
+        free_args(alias->args, alias->arg_count);
+        free(alias->text);
+        free(alias);
+    }
+}
+
+
+
+
+
+
+
+static void print_alias(const NameEntry *entry) {
+    const Alias *alias = entry->value;
+    printf("alias %s=%s\n", entry->name, alias->text);
+}
+
+
+
+
+
+
+
+/*
+ - alias                  list every alias
+ - alias name             show one
+ - alias name=value ...   define one, the words after '=' are its value
+ - Returns 0, 1 if a name shown is not an alias
+*/
+int alias_builtin(char **args, int arg_count) {
+    if (arg_count == 1) {
+        for (int i = 0; i < aliases.capacity; i++) {
+            if (aliases.items[i].name != NULL) {
+                print_alias(&aliases.items[i]);
+            }
+        }
+        return 0;
+    }
+
+    char *equals = strchr(args[1], '=');
+    if (equals == NULL) {
+        int status = 0;
+        for (int i = 1; i < arg_count; i++) {
+            NameEntry *entry = name_table_find(&aliases, args[i], name_hash(args[i]));
+            if (entry != NULL) {
+                print_alias(entry);
+            } else {
+                fprintf(stderr, "alias: %s: not found\n", args[i]);
+                status = 1;
+            }
+        }
+        return status;
+    }
+
+    // No quoting, so "alias ll=ls -l" takes every word after the '='
+    *equals = '\0';
+    if (args[1][0] == '\0' || strchr(args[1], '/') != NULL) {
+        fprintf(stderr, "alias: %s: invalid alias name\n", args[1]);
+        *equals = '=';
+        return 1;
+    }
+    
+    Alias *alias = calloc(1, sizeof(Alias));
+    TextBuffer text = { NULL, 0, 0 };
+    int failed = alias == NULL || text_append(&text, equals + 1, strlen(equals + 1)) != 0;
+    for (int i = 2; i < arg_count && !failed; i++) {
+        failed = text_append(&text, " ", 1) != 0 || text_append(&text, args[i], strlen(args[i])) != 0;
+    }
+    if (!failed) {
+        failed = text_append(&text, "", 1) != 0;
+    }
+    if (failed) {
+        free(text.data);
+    } else {
+        // The value is tokenized now, expanding it later only copies words
+        alias->text = text.data;
+        char *copy = strdup(alias->text);
+        RedirList redirs;
+        init_redir_list(&redirs);
+        if (copy != NULL) {
+            alias->args = parse_input(copy, &alias->arg_count, &redirs);
+        }
+        if (redirs.count > 0) {
+            fprintf(stderr, "alias: redirections are not allowed in an alias\n");
+        }
+        failed = alias->args == NULL || redirs.count > 0;
+        free_redir_list(&redirs);
+        free(redirs.items);
+        free(copy);
+    }
+    
+    NameEntry *entry = NULL;
+    if (!failed) {
+        entry = name_table_insert(&aliases, args[1], name_hash(args[1]));
+    }
+    *equals = '=';
+    if (entry == NULL) {
+        if (alias != NULL) {
+            free_alias(alias);
+        } else {
+            perror("calloc failed");
+        }
+        return 1;
+    }
+    free_alias(entry->value);
+    entry->value = alias;
+    return 0;
+}
+
+
+
+
+
+
+
+// unalias name ... or unalias -a for all of them
+int unalias_builtin(char **args, int arg_count) {
+    if (arg_count < 2) {
+        fprintf(stderr, "unalias: usage: unalias -a | name ...\n");
+        return 2;
+    }
+    if (strcmp(args[1], "-a") == 0) {
+        for (int i = 0; i < aliases.capacity; i++) {
+            if (aliases.items[i].name != NULL) {
+                free(aliases.items[i].name);
+                free_alias(aliases.items[i].value);
+                aliases.items[i].name = NULL;
+            }
+        }
+        aliases.count = 0;
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; i < arg_count; i++) {
+        NameEntry *entry = name_table_find(&aliases, args[i], name_hash(args[i]));
+        if (entry == NULL) {
+            fprintf(stderr, "unalias: %s: not found\n", args[i]);
+            status = 1;
+            continue;
+        }
+        free_alias(entry->value);
+        name_table_remove(&aliases, entry);
+    }
+    return status;
+}
+
+
+
+
+
+
+
+/*
+ - Replace an alias in the first word of a freshly parsed command by the
+   words of its value, the way sh expands aliases while reading
+ - Only done once per command, so "alias ls=ls -F" does not loop
+ - Returns 0, -1 on error
+*/
+int expand_alias(char ***args, int *arg_count) {
+    if (aliases.count == 0 || *arg_count == 0) {
+        return 0;
+    }
+    NameEntry *entry = name_table_find(&aliases, (*args)[0], name_hash((*args)[0]));
+    if (entry == NULL) {
+        return 0;
+    }
+
+    const Alias *alias = entry->value;
+    int count = alias->arg_count + *arg_count - 1;
+    char **new_args = malloc((count + 1) * sizeof(char*));
+    if (new_args == NULL) {
+        perror("malloc failed");
+        return -1;
+    }
+    for (int i = 0; i < alias->arg_count; i++) {
+        new_args[i] = strdup(alias->args[i]);
+        if (new_args[i] == NULL) {
+            perror("strdup failed");
+            free_args(new_args, i);
+            return -1;
+        }
+    }
+
+    // The other words move over, only the alias name itself is freed
+    memcpy(new_args + alias->arg_count, *args + 1, (*arg_count - 1) * sizeof(char*));
+    new_args[count] = NULL;
+    free((*args)[0]);
+    free(*args);
+    *args = new_args;
+    *arg_count = count;
+    return 0;
+}
+#endif // SHELL_FEATURE_ALIAS
+
+
+
+
+
+
+
+#if SHELL_FEATURE_EXTERNAL
+// Drop every cached location, the next lookups search PATH again
+static void path_cache_clear(void) {
+    for (int i = 0; i < path_cache.capacity; i++) {
+        if (path_cache.items[i].name != NULL) {
+            free(path_cache.items[i].name);
+            free(path_cache.items[i].value);
+            path_cache.items[i].name = NULL;
+        }
+    }
+    path_cache.count = 0;
+}
+
+
+
+
+
+
+
+/*
+ - Full path of the program name runs, searched in PATH the first time
+   and remembered until PATH changes or "hash -r"
+ - Returns NULL for a name holding '/' or one not found, execvp() then
+   reports it the usual way
+*/
+static const char* lookup_path(const char *name, uint32_t hash) {
+    if (strchr(name, '/') != NULL) {
+        return NULL;
+    }
+
+    // A new PATH (export PATH=..., env changes) invalidates everything
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        path_env = "/usr/local/bin:/usr/bin:/bin";   // what execvp() would search
+    }
+    if (path_cache_env == NULL || strcmp(path_cache_env, path_env) != 0) {
+        path_cache_clear();
+        free(path_cache_env);
+        path_cache_env = strdup(path_env);
+        if (path_cache_env == NULL) {
+            return NULL;
+        }
+    }
+
+    NameEntry *entry = name_table_find(&path_cache, name, hash);
+    if (entry != NULL) {
+        return entry->value;
+    }
+
+    char candidate[PATH_MAX];
+    const char *dir = path_cache_env;
+    while (1) {
+        size_t len = strcspn(dir, ":");
+        // An empty element means the current directory
+        int n = len == 0 ? snprintf(candidate, sizeof(candidate), "%s", name)
+                         : snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)len, dir, name);
+        struct stat st;
+        if (n > 0 && (size_t)n < sizeof(candidate) && stat(candidate, &st) == 0 &&
+            S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            char *path = strdup(candidate);
+            entry = path != NULL ? name_table_insert(&path_cache, name, hash) : NULL;
+            if (entry == NULL) {
+                free(path);
+                return NULL;
+            }
+            entry->value = path;
+            return path;
+        }
+        if (dir[len] == '\0') {
+            return NULL;
+        }
+        dir += len + 1;
+    }
+}
+
+
+
+
+
+
+
+// hash lists the cached program locations, hash -r forgets them
+int hash_builtin(char **args, int arg_count) {
+    if (arg_count > 1 && strcmp(args[1], "-r") == 0) {
+        path_cache_clear();
+        return 0;
+    }
+    if (arg_count > 1) {
+        fprintf(stderr, "hash: usage: hash [-r]\n");
+        return 2;
+    }
+    for (int i = 0; i < path_cache.capacity; i++) {
+        if (path_cache.items[i].name != NULL) {
+            printf("%s\t%s\n", path_cache.items[i].name, (char *)path_cache.items[i].value);
+        }
+    }
+    return 0;
+}
+#endif // SHELL_FEATURE_EXTERNAL
+
+
+
+
+
+
+
+/*
+ - Resolve a command name: function, then built-in, then program (aliases
+   were already replaced when the command was parsed)
+ - The name is hashed once and every table gets a single probe sequence
+ - in_shell 0 skips functions and built-ins, "timeout cmd" always runs
+   a program
+*/
+void resolve_command(const char *name, int in_shell, CommandTarget *target) {
+    uint32_t hash = name_hash(name);
+
+    target->kind = COMMAND_EXTERNAL;
+    target->builtin = NULL;
+    target->function = NULL;
+    target->path = NULL;
+
+    if (in_shell) {
+#if SHELL_FEATURE_SCRIPT
+        target->function = lookup_function(name, hash);
+        if (target->function != NULL) {
+            target->kind = COMMAND_FUNCTION;
+            return;
+        }
+#endif
+        target->builtin = lookup_builtin(name, hash);
+        if (target->builtin != NULL) {
+            target->kind = COMMAND_BUILTIN;
+            return;
+        }
+    }
+#if SHELL_FEATURE_EXTERNAL
+    target->path = lookup_path(name, hash);
+#endif
+}
@@ -0,0 +1,777 @@
+/**
+ * Shell Core - epoll event loop, signals and job tracking
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "shellcore.h"
+
+
+
+
+#if SHELL_FEATURE_EVENTLOOP
+/*
+ - What an epoll event belongs to, kept in the upper half of data.u64
+ - Job events carry the job's slot in the lower half, slots never move
+   while a job is live so a finished pidfd finds its job in O(1)
+*/
+#define EVENT_STDIN  0
+#define EVENT_SIGNAL 1
+#define EVENT_JOB    2
+#define EVENT_TIMER  3
+#define EVENT_DATA(kind, slot) (((uint64_t)(kind) << 32) | (uint32_t)(slot))
+
+EventLoop event_loop = { .epfd = -1, .sigfd = -1 };
+
+// Jobs that are started and not yet removed, the table keeps empty slots
+static int live_jobs;
+
+
+
+
+
+
+
+/*
+ - Block SIGINT, SIGCHLD and SIGWINCH and receive them through a signalfd,
+   then watch it and stdin with one epoll instance
+ - An interactive shell also ignores the job control signals so Ctrl-Z,
+   reads from the background and tcsetpgrp() never stop the shell itself
+ - Returns 0 on success, -1 if the shell has to fall back to blocking calls
+*/
+int event_loop_init(void) {
+    EventLoop *loop = &event_loop;
+    
+    loop->shell_pgid = getpgrp();
+    loop->interactive = isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == loop->shell_pgid;
+    if (loop->interactive) {
+        signal(SIGQUIT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+    }
+    
+    sigemptyset(&loop->handled);
+    sigaddset(&loop->handled, SIGINT);
+    sigaddset(&loop->handled, SIGCHLD);
+    sigaddset(&loop->handled, SIGWINCH);
+    if (sigprocmask(SIG_BLOCK, &loop->handled, NULL) == -1) {
+        perror("sigprocmask");
+        return -1;
+    }
+    
+    loop->sigfd = signalfd(-1, &loop->handled, SFD_NONBLOCK | SFD_CLOEXEC);
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = EVENT_DATA(EVENT_SIGNAL, 0) };
+    if (loop->sigfd == -1 || loop->epfd == -1 ||
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->sigfd, &ev) == -1) {
+        perror("event loop");
+        event_loop_close();
+        return -1;
+    }
+    
+    // Armed again before every wait, so stdin cannot wake up a running job
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = EVENT_DATA(EVENT_STDIN, 0);
+    loop->stdin_pollable = epoll_ctl(loop->epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+    if (!loop->stdin_pollable && errno != EPERM) {
+        perror("epoll_ctl stdin");
+    }
+    
+    atexit(event_loop_close);
+    return 0;
+}
+
+
+
+
+
+
+
+
+#if SHELL_FEATURE_SUBST
+/*
+ - In the forked shell of a command substitution: forget the parent's jobs
+   without signalling them and set up a loop of its own, so the jobs it
+   starts are never added to the parent's epoll set
+*/
+void event_loop_subshell(void) {
+    EventLoop *loop = &event_loop;
+    
+    for (int i = 0; i < loop->jobs.count; i++) {
+        Job *job = &loop->jobs.items[i];
+        if (job->pidfd != -1) {
+            close(job->pidfd);
+        }
+        if (job->timerfd != -1) {
+            close(job->timerfd);
+        }
+#if SHELL_FEATURE_CGROUP
+        if (job->pid != 0 && job->cgroup.dirfd != -1) {
+            close(job->cgroup.dirfd);
+            free(job->cgroup.path);
+        }
+#endif
+    }
+    free(loop->jobs.items);
+    loop->jobs.items = NULL;
+    loop->jobs.count = loop->jobs.capacity = 0;
+    live_jobs = 0;
+    
+    if (loop->epfd != -1) {
+        close(loop->epfd);
+        loop->epfd = -1;
+    }
+    if (loop->sigfd != -1) {
+        close(loop->sigfd);
+        loop->sigfd = -1;
+    }
+    event_loop_init();
+}
+#endif
+
+
+
+
+
+
+
+/*
+ - Give up the event loop: stopped jobs get SIGHUP and SIGCONT so they do
+   not outlive the shell, descriptors are closed and the signals unblocked
+*/
+void event_loop_close(void) {
+    EventLoop *loop = &event_loop;
+    
+    for (int i = 0; i < loop->jobs.count; i++) {
+        Job *job = &loop->jobs.items[i];
+        if (job->pid != 0 && job->stopped) {
+            kill(-job->pgid, SIGHUP);
+            kill(-job->pgid, SIGCONT);
+        }
+        if (job->pidfd != -1) {
+            close(job->pidfd);
+        }
+        if (job->timerfd != -1) {
+            close(job->timerfd);
+        }
+#if SHELL_FEATURE_CGROUP
+        if (job->pid != 0 && job->cgroup.dirfd != -1) {
+            close(job->cgroup.dirfd);   // Jobs still running keep their leaf
+            free(job->cgroup.path);
+        }
+#endif
+    }
+#if SHELL_FEATURE_CGROUP
+    cgroup_close();
+#endif
+    free(loop->jobs.items);
+    loop->jobs.items = NULL;
+    loop->jobs.count = loop->jobs.capacity = 0;
+    live_jobs = 0;
+    
+    if (loop->epfd != -1) {
+        close(loop->epfd);
+        loop->epfd = -1;
+    }
+    if (loop->sigfd != -1) {
+        close(loop->sigfd);
+        loop->sigfd = -1;
+        sigprocmask(SIG_UNBLOCK, &loop->handled, NULL);
+    }
+}
+
+
+
+
+
+
+
+
+/*
+ - Collect the state change of one job
+ - flags are passed to wait4(), WNOHANG and WUNTRACED are the useful ones
+ - Returns 1 if the job finished or stopped, 0 if nothing changed
+*/
+static int job_update(Job *job, int flags) {
+    int status;
+    struct rusage usage;
+    pid_t r = wait4(job->pid, &status, flags, &usage);
+    
+    if (r == -1 && errno == ECHILD) {
+        // Someone else reaped it, nothing more will ever be known
+        status = 0;
+        memset(&usage, 0, sizeof(usage));
+    } else if (r <= 0) {
+        return 0;
+    }
+    
+    job->status = status;
+    if (r > 0 && WIFSTOPPED(status)) {
+        job->stopped = 1;
+        return 1;
+    }
+    
+    job->done = 1;
+    job->stopped = 0;
+    job->usage = usage;
+    if (job->pidfd != -1) {
+        close(job->pidfd);   // also drops it from the epoll set
+        job->pidfd = -1;
+    }
+    if (job->timerfd != -1) {
+        close(job->timerfd);
+        job->timerfd = -1;
+    }
+    return 1;
+}
+
+
+
+
+
+
+
+
+/*
+ - The timeout of a job expired: send its signal to the whole process
+   group, and SIGKILL once the -k grace period is over as well
+*/
+static void job_timer_expired(Job *job) {
+    uint64_t expirations;
+    
+    if (read(job->timerfd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    
+    if (job->timeout_stage == 0) {
+        kill(-job->pgid, job->timeout_signal);
+        job->timeout_stage = 1;
+        if (job->kill_after.tv_sec != 0 || job->kill_after.tv_nsec != 0) {
+            struct itimerspec its = { .it_value = job->kill_after };
+            timerfd_settime(job->timerfd, 0, &its, NULL);
+        }
+    } else {
+        kill(-job->pgid, SIGKILL);
+        job->timeout_stage = 2;
+    }
+    
+    // A stopped job would never see the signal
+    kill(-job->pgid, SIGCONT);
+}
+
+
+
+
+
+
+
+
+// SIGCHLD: a job stopped, or finished without a pidfd to tell us
+static void sweep_jobs(void) {
+    for (int i = 0; i < event_loop.jobs.count; i++) {
+        Job *job = &event_loop.jobs.items[i];
+        if (job->pid != 0 && !job->done) {
+            job_update(job, WNOHANG | WUNTRACED);
+        }
+    }
+}
+
+
+
+
+
+
+
+
+// SIGWINCH: keep COLUMNS and LINES right for the programs started next
+static void update_window_size(void) {
+    struct winsize ws;
+    char buf[16];
+    
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == -1) {
+        return;
+    }
+    snprintf(buf, sizeof(buf), "%u", ws.ws_col);
+    setenv("COLUMNS", buf, 1);
+    snprintf(buf, sizeof(buf), "%u", ws.ws_row);
+    setenv("LINES", buf, 1);
+}
+
+
+
+
+
+
+
+
+/*
+ - Read every pending signal from the signalfd
+ - SIGINT goes to the foreground job if there is one, otherwise it only
+   interrupts the line being read
+*/
+static void handle_signals(Job *foreground, int *interrupted) {
+    struct signalfd_siginfo info;
+    
+    while (read(event_loop.sigfd, &info, sizeof(info)) == sizeof(info)) {
+        switch (info.ssi_signo) {
+        case SIGINT:
+            if (foreground != NULL) {
+                // Only reaches us when stdin is not a terminal we handed to the job
+                kill(-foreground->pgid, SIGINT);
+            } else {
+                *interrupted = 1;
+            }
+            break;
+        case SIGCHLD:
+            sweep_jobs();
+            break;
+        case SIGWINCH:
+            update_window_size();
+            break;
+        }
+    }
+}
+
+
+
+
+
+
+
+
+/*
+ - Handle a batch of epoll events
+ - Sets *input_ready when stdin became readable and *interrupted on Ctrl-C
+*/
+static void dispatch_events(struct epoll_event *events, int n, Job *foreground,
+                            int *input_ready, int *interrupted) {
+    for (int i = 0; i < n; i++) {
+        uint32_t kind = events[i].data.u64 >> 32;
+        uint32_t slot = (uint32_t)events[i].data.u64;
+    
+        if (kind == EVENT_STDIN) {
+            *input_ready = 1;
+        } else if (kind == EVENT_SIGNAL) {
+            handle_signals(foreground, interrupted);
+        } else if (kind == EVENT_JOB && slot < (uint32_t)event_loop.jobs.count) {
+            // A readable pidfd means the child exited, reaping cannot block
+            Job *job = &event_loop.jobs.items[slot];
+            if (job->pid != 0 && !job->done) {
+                job_update(job, WNOHANG);
+            }
+        } else if (kind == EVENT_TIMER && slot < (uint32_t)event_loop.jobs.count) {
+            Job *job = &event_loop.jobs.items[slot];
+            if (job->pid != 0 && !job->done && job->timerfd != -1) {
+                job_timer_expired(job);
+            }
+        }
+    }
+}
+
+
+
+
+
+
+
+
+/*
+ - Wait until a line can be read from "in" (stdin) while handling signals
+   and reaping finished jobs
+ - Returns 1 when input is ready, 0 when Ctrl-C abandoned the line
+*/
+int event_wait_input(FILE *in) {
+    EventLoop *loop = &event_loop;
+    struct epoll_event events[EVENT_BATCH];
+    int input_ready = loop->epfd == -1 || !loop->stdin_pollable || (in == stdin && input_pending());
+    int interrupted = 0;
+    
+    if (input_ready) {
+        // Nothing to wait for, but children may still need reaping
+        if (loop->epfd != -1 && live_jobs > 0) {
+            int n = epoll_wait(loop->epfd, events, EVENT_BATCH, 0);
+            dispatch_events(events, n > 0 ? n : 0, NULL, &input_ready, &interrupted);
+        }
+        return 1;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.u64 = EVENT_DATA(EVENT_STDIN, 0) };
+    epoll_ctl(loop->epfd, EPOLL_CTL_MOD, STDIN_FILENO, &ev);
+    
+    while (!input_ready && !interrupted) {
+        int n = epoll_wait(loop->epfd, events, EVENT_BATCH, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return 1;
+        }
+        dispatch_events(events, n, NULL, &input_ready, &interrupted);
+    }
+    
+    if (interrupted && !loop->interactive) {
+        // A script interrupted with Ctrl-C stops, like sh
+        event_loop_close();
+        signal(SIGINT, SIG_DFL);
+        raise(SIGINT);
+    }
+    return !interrupted;
+}
+
+
+
+
+
+
+
+
+#if SHELL_FEATURE_SCRIPT
+/*
+ - Loops of built-ins never wait in epoll, so they ask here once per
+   iteration whether Ctrl-C was pressed; SIGCHLD is handled on the way
+ - Returns 1 after Ctrl-C, 0 otherwise
+*/
+int event_poll_interrupt(void) {
+    int interrupted = 0;
+    
+    if (event_loop.sigfd != -1) {
+        handle_signals(NULL, &interrupted);
+    }
+    return interrupted;
+}
+#endif
+
+
+
+
+
+
+
+
+/*
+ - Run in the child between fork() and exec(): own process group, the
+   terminal if the shell is interactive and the job runs in the foreground,
+   default signal dispositions and an empty signal mask (both survive exec)
+*/
+void event_child_setup(int background) {
+    sigset_t none;
+    
+    if (event_loop.epfd == -1) {
+        return;
+    }
+    setpgid(0, 0);
+    if (event_loop.interactive && !background) {
+        tcsetpgrp(STDIN_FILENO, getpid());
+    }
+    
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGWINCH, SIG_DFL);
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+
+
+
+
+
+
+
+/*
+ - Start tracking a child right after it was spawned, the parent side of
+   event_child_setup() (both do setpgid/tcsetpgrp, whichever runs first wins)
+ - pidfd is the descriptor clone3() returned, -1 to open one here; the job
+   owns it from now on
+ - timeout, if not NULL, starts a timerfd that signals the job's process
+   group when it expires
+ - Returns the job, or NULL when the event loop is not running
+*/
+Job* event_track_child(pid_t pid, int pidfd, char **args, int background, const CmdTimeout *timeout) {
+    EventLoop *loop = &event_loop;
+    JobTable *jobs = &loop->jobs;
+    
+    if (loop->epfd == -1) {
+        if (pidfd != -1) {
+            close(pidfd);
+        }
+        return NULL;
+    }
+    
+    // Reuse a free slot, the slot number is what the pidfd event carries
+    int slot = 0;
+    while (slot < jobs->count && jobs->items[slot].pid != 0) {
+        slot++;
+    }
+    if (slot == jobs->count) {
+        if (jobs->count >= jobs->capacity) {
+            int new_capacity = jobs->capacity ? jobs->capacity * 2 : INITIAL_JOB_CAPACITY;
+            Job *new_items = realloc(jobs->items, new_capacity * sizeof(Job));
+            if (new_items == NULL) {
+                perror("realloc failed");
+                if (pidfd != -1) {
+                    close(pidfd);
+                }
+                return NULL;
+            }
+            jobs->items = new_items;
+            jobs->capacity = new_capacity;
+        }
+        jobs->count++;
+    }
+    
+    Job *job = &jobs->items[slot];
+    memset(job, 0, sizeof(*job));
+    job->pid = pid;
+    job->pgid = pid;
+    job->pidfd = -1;
+    job->timerfd = -1;
+    job->cgroup.dirfd = -1;
+    job->background = background;
+    for (int i = 0; args[i] != NULL; i++) {
+        size_t used = strlen(job->command);
+        snprintf(job->command + used, sizeof(job->command) - used, "%s%s", i ? " " : "", args[i]);
+    }
+    live_jobs++;
+    
+    setpgid(pid, pid);
+    if (loop->interactive && !background) {
+        tcsetpgrp(STDIN_FILENO, pid);
+    }
+    
+    // Without pidfds (Linux < 5.3) SIGCHLD alone tells us when it exits
+    job->pidfd = pidfd != -1 ? pidfd : syscall(SYS_pidfd_open, pid, 0);
+    if (job->pidfd != -1) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = EVENT_DATA(EVENT_JOB, slot) };
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, job->pidfd, &ev) == -1) {
+            close(job->pidfd);
+            job->pidfd = -1;
+        }
+    }
+    
+    if (timeout != NULL) {
+        struct itimerspec its = { .it_value = timeout->duration };
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = EVENT_DATA(EVENT_TIMER, slot) };
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+            its.it_value.tv_nsec = 1;   // "timeout 0" expires at once, a zero value would disarm
+        }
+        job->kill_after = timeout->kill_after;
+        job->timeout_signal = timeout->signal;
+        job->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (job->timerfd == -1 ||
+            timerfd_settime(job->timerfd, 0, &its, NULL) == -1 ||
+            epoll_ctl(loop->epfd, EPOLL_CTL_ADD, job->timerfd, &ev) == -1) {
+            perror("timeout");
+            if (job->timerfd != -1) {
+                close(job->timerfd);
+                job->timerfd = -1;
+            }
+        }
+    }
+    return job;
+}
+
+
+
+
+
+
+
+
+/*
+ - Serve events until the job in "slot" finished or stopped
+ - A foreground job gets Ctrl-C forwarded, waiting for a background job
+   is abandoned by Ctrl-C instead
+ - Returns 0, or -1 when Ctrl-C ended the wait
+*/
+static int wait_for_slot(int slot, int foreground) {
+    EventLoop *loop = &event_loop;
+    struct epoll_event events[EVENT_BATCH];
+    int input_ready = 0, interrupted = 0;
+    
+    // The child may be gone already, its pidfd event is then still pending
+    while (!loop->jobs.items[slot].done && !loop->jobs.items[slot].stopped) {
+        int n = epoll_wait(loop->epfd, events, EVENT_BATCH, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            job_update(&loop->jobs.items[slot], WUNTRACED);   // Plain blocking wait instead
+            break;
+        }
+        dispatch_events(events, n, foreground ? &loop->jobs.items[slot] : NULL, &input_ready, &interrupted);
+        if (interrupted) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+
+// Exit status of a finished or stopped job, 128 + signal number like sh
+static int job_exit_status(const Job *job) {
+    if (job->done && job->timeout_stage > 0) {
+        return 124;   // Same as timeout(1)
+    }
+    if (job->stopped) {
+        return 128 + WSTOPSIG(job->status);
+    }
+    return WIFEXITED(job->status) ? WEXITSTATUS(job->status) : 128 + WTERMSIG(job->status);
+}
+
+
+
+
+
+
+
+
+/*
+ - Wait for a foreground job while still serving signals
+ - The terminal is taken back once the job finished or stopped
+ - Returns the exit status of the job; a finished job is left for the
+   caller to read its rusage and remove, a stopped one stays in the table
+*/
+int event_wait_job(Job *job) {
+    EventLoop *loop = &event_loop;
+    int slot = job - loop->jobs.items;
+    
+    wait_for_slot(slot, 1);
+    job = &loop->jobs.items[slot];
+    
+    if (loop->interactive) {
+        tcsetpgrp(STDIN_FILENO, loop->shell_pgid);
+    }
+    
+    if (job->stopped) {
+        job->background = 1;
+        fprintf(stderr, "\n[%d]+  Stopped    %s\n", slot + 1, job->command);
+    }
+    return job_exit_status(job);
+}
+
+
+
+
+
+
+
+
+/*
+ - The wait built-in: wait for the background job with this pid, or for
+   all of them when pid is 0; waited jobs leave the table silently
+ - Returns the status of the last job waited for, 127 for an unknown pid
+   and 130 when Ctrl-C ended the wait
+*/
+int event_wait_background(pid_t pid) {
+    EventLoop *loop = &event_loop;
+    int status = pid > 0 ? 127 : 0;
+    
+    for (int slot = 0; slot < loop->jobs.count; slot++) {
+        Job *job = &loop->jobs.items[slot];
+        if (job->pid == 0 || !job->background || (pid > 0 && job->pid != pid)) {
+            continue;
+        }
+        if (job->stopped) {
+            status = job_exit_status(job);   // sh does not wait for stopped jobs either
+            continue;
+        }
+        if (wait_for_slot(slot, 0) == -1) {
+            return 130;
+        }
+        job = &loop->jobs.items[slot];
+        status = job_exit_status(job);
+        if (job->done) {
+            event_remove_job(job);
+        }
+    }
+    return status;
+}
+
+
+
+
+
+
+
+
+/*
+ - Print "Done" lines for background jobs that finished since the last
+   prompt and drop them from the table
+*/
+void event_report_jobs(void) {
+    EventLoop *loop = &event_loop;
+    
+    for (int slot = 0; slot < loop->jobs.count; slot++) {
+        Job *job = &loop->jobs.items[slot];
+        if (job->pid == 0 || !job->background || !job->done) {
+            continue;
+        }
+        if (job->timeout_stage > 0) {
+            fprintf(stderr, "[%d]   Timed out  %s\n", slot + 1, job->command);
+        } else if (WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0) {
+            fprintf(stderr, "[%d]   Done       %s\n", slot + 1, job->command);
+        } else if (WIFEXITED(job->status)) {
+            fprintf(stderr, "[%d]   Exit %-5d %s\n", slot + 1, WEXITSTATUS(job->status), job->command);
+        } else {
+            fprintf(stderr, "[%d]   %-10s %s\n", slot + 1, strsignal(WTERMSIG(job->status)), job->command);
+        }
+        event_remove_job(job);
+    }
+}
+
+
+
+
+
+
+
+
+// Forget a finished job, its slot can be reused
+void event_remove_job(Job *job) {
+    if (job->pidfd != -1) {
+        close(job->pidfd);
+    }
+    if (job->timerfd != -1) {
+        close(job->timerfd);
+    }
+#if SHELL_FEATURE_CGROUP
+    cgroup_release(&job->cgroup);
+#endif
+    memset(job, 0, sizeof(*job));
+    job->pidfd = -1;
+    job->timerfd = -1;
+    job->cgroup.dirfd = -1;
+    live_jobs--;
+}
+#endif // SHELL_FEATURE_EVENTLOOP
@@ -0,0 +1,786 @@
+/**
+ * Shell Core - running command lists, built-ins and programs
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/sched.h>
+
+#include "shellcore.h"
+
+
+
+
+/*
+ - Run the commands of a list, skipping the ones the operators rule out
+ - A skipped command leaves $? untouched, so "false && a || b" runs b
+*/
+int run_command_list(CommandList *list, VarTable *var_table) {
+    for (int i = 0; i < list->count; i++) {
+        if (i > 0) {
+            ListOp op = list->items[i - 1].next_op;
+            if ((op == LIST_AND && var_table->last_status != 0) ||
+                (op == LIST_OR && var_table->last_status == 0)) {
+                continue;
+            }
+        }
+        var_table->last_status = run_command(&list->items[i], var_table);
+    }
+    return var_table->last_status;
+}
+
+
+
+
+
+
+
+// Run one command of a list and return its exit status
+int run_command(ListCommand *cmd, VarTable *var_table) {
+#if SHELL_FEATURE_ARITH
+    // ((expr)) runs nothing, it only evaluates
+    if (cmd->arithmetic != NULL) {
+        return arith_command(cmd->arithmetic, var_table);
+    }
+#endif
+#if SHELL_FEATURE_VARS
+    // Check if it's a variable assignment
+    if (cmd->assignment != NULL) {
+        // x=$(cmd) returns the status of cmd, a plain assignment 0
+        int substitutions = var_table->substitutions;
+        if (handle_assignment(cmd->assignment, var_table)) {
+            return var_table->substitutions != substitutions ? var_table->last_status : 0;
+        }
+        printf("Invalid command\n");
+        return 1;
+    }
+#endif
+    
+    if (cmd->arg_count == 0) {
+        return 0;
+    }
+    
+    // "cmd &": programs are not waited for, built-ins still run in the shell
+    int background = cmd->next_op == LIST_BG;
+    
+#if SHELL_FEATURE_VARS
+    // Substitute variables in arguments
+    int arg_count;
+    char** args = substitute_variables(cmd->args, cmd->arg_count, var_table, &arg_count);
+    if (args == NULL) {
+        return 1;
+    }
+    if (arg_count == 0) {
+        // The whole command expanded to nothing, "$(true)" keeps its status
+        free_args(args, arg_count);
+        return var_table->last_status;
+    }
+#else
+    int arg_count = cmd->arg_count;
+    char** args = cmd->args;
+#endif
+    
+#if SHELL_FEATURE_GLOB
+    // Pathname expansion comes after variables, so "$dir/*.c" works
+    int glob_count;
+    char** globbed = expand_globs(args, arg_count, &glob_count);
+    if (globbed == NULL) {
+        if (args != cmd->args) {
+            free_args(args, arg_count);
+        }
+        return 1;
+    }
+    if (globbed != args) {
+        if (args != cmd->args) {
+            free_args(args, arg_count);
+        }
+        args = globbed;
+        arg_count = glob_count;
+    }
+#endif
+    
+    char** cmd_args = args;
+    int cmd_count = arg_count;
+#if SHELL_FEATURE_STATS
+    // "time" prefix: report resource usage of the rest of the line
+    int timed = 0;
+    if (strcmp(args[0], "time") == 0) {
+        timed = 1;
+        cmd_args++;
+        cmd_count--;
+    }
+#endif
+    
+#if SHELL_FEATURE_LIMITS
+    // "timeout ... command" always runs the program, even one named like a built-in
+    CmdTimeout timeout_storage;
+    CmdTimeout *timeout = NULL;
+    if (cmd_count > 0 && strcmp(cmd_args[0], "timeout") == 0) {
+        int used = parse_timeout_prefix(cmd_args, cmd_count, &timeout_storage);
+        if (used < 0) {
+            if (args != cmd->args) {
+                free_args(args, arg_count);
+            }
+            return 125;   // timeout(1) uses 125 for its own errors
+        }
+        cmd_args += used;
+        cmd_count -= used;
+        timeout = &timeout_storage;
+    }
+#else
+    CmdTimeout *timeout = NULL;
+#endif
+    
+#if SHELL_FEATURE_STATS
+
+    CmdStats record;
+    CmdStats *measure = (timed || stats_ring.enabled) && !background ? &record : NULL;
+    if (measure != NULL) {
+        memset(&record, 0, sizeof(record));
+        for (int i = 0; i < cmd_count; i++) {
+            size_t used = strlen(record.command);
+            snprintf(record.command + used, sizeof(record.command) - used,
+                     "%s%s", i ? " " : "", cmd_args[i]);
+        }
+    }
+#else
+    CmdStats *measure = NULL;
+#endif
+    
+    // Functions and built-ins run inside the shell, everything else is forked
+    CommandTarget target = { COMMAND_EXTERNAL, NULL, NULL, NULL };
+    if (cmd_count > 0) {
+        resolve_command(cmd_args[0], timeout == NULL, &target);
+    }
+    int status = 0;
+#if SHELL_FEATURE_STATS
+    if (cmd_count == 0) {
+        // Bare "time" just reports zeros, like sh
+        if (measure != NULL) {
+            clock_gettime(CLOCK_REALTIME, &record.started);
+            record.builtin = 1;
+        }
+    } else if (target.kind != COMMAND_EXTERNAL) {
+        struct timespec t_start, t_end;
+        struct rusage ru_start, ru_end;
+        if (measure != NULL) {
+            clock_gettime(CLOCK_REALTIME, &record.started);
+            clock_gettime(CLOCK_MONOTONIC, &t_start);
+            getrusage(RUSAGE_SELF, &ru_start);
+        }
+        status = execute_builtin_redirected(&target, cmd_args, cmd_count, var_table, &cmd->redirs);
+        if (measure != NULL) {
+            clock_gettime(CLOCK_MONOTONIC, &t_end);
+            getrusage(RUSAGE_SELF, &ru_end);
+            record.builtin = 1;
+            record.exit_status = status;
+            record.wall_ms = (t_end.tv_sec - t_start.tv_sec) * 1e3 + (t_end.tv_nsec - t_start.tv_nsec) / 1e6;
+            record.user_ms = (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) * 1e3 +
+                             (ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec) / 1e3;
+            record.sys_ms = (ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) * 1e3 +
+                            (ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec) / 1e3;
+            record.max_rss_kb = ru_end.ru_maxrss;
+            record.voluntary_ctxsw = ru_end.ru_nvcsw - ru_start.ru_nvcsw;
+            record.involuntary_ctxsw = ru_end.ru_nivcsw - ru_start.ru_nivcsw;
+        }
+    }
+#else
+    if (target.kind != COMMAND_EXTERNAL) {
+        status = execute_builtin_redirected(&target, cmd_args, cmd_count, var_table, &cmd->redirs);
+    }
+#endif
+    else {
+#if SHELL_FEATURE_EXTERNAL
+        status = execute_external(cmd_args, target.path, var_table, &cmd->redirs, measure, background, timeout);
+#else
+        (void)measure;
+        (void)background;
+        (void)timeout;
+        printf("Invalid command\n");
+        status = 127;
+#endif
+    }
+    
+#if SHELL_FEATURE_STATS
+    if (measure != NULL) {
+        if (stats_ring.enabled && cmd_count > 0) {
+            stats_push(&record);
+        }
+        if (timed) {
+            fflush(stdout);
+            print_time_report(&record);
+        }
+    }
+#endif
+    
+    // Free substituted copies, the parsed args belong to the list
+    if (args != cmd->args) {
+        free_args(args, arg_count);
+    }
+    return status;
+}
+
+
+
+
+
+
+#if SHELL_FEATURE_EXTERNAL
+/*
+ - fork() that also hands back a pidfd for the child in *pidfd
+ - clone3(CLONE_PIDFD) gets both from one system call. Kernels older than
+   5.3 (or a seccomp filter) refuse it, then fork() and pidfd_open() are
+   used, and *pidfd stays -1 where pidfds do not exist at all.
+ - The pidfd always refers to this child: unlike a pid it cannot be reused
+ - With a cgroup_fd (-1 for none) CLONE_INTO_CGROUP starts the child in
+   that cgroup, so it never runs a single instruction outside its limits.
+   *in_cgroup tells both sides whether that happened (Linux >= 5.7).
+*/
+static pid_t spawn_process(int *pidfd, int cgroup_fd, int *in_cgroup) {
+    struct clone_args cl;
+    
+    *pidfd = -1;
+    *in_cgroup = 0;
+    memset(&cl, 0, sizeof(cl));
+    cl.flags = CLONE_PIDFD;
+    cl.pidfd = (uint64_t)(uintptr_t)pidfd;
+    cl.exit_signal = SIGCHLD;
+    if (cgroup_fd != -1) {
+        cl.flags |= CLONE_INTO_CGROUP;
+        cl.cgroup = (uint64_t)cgroup_fd;
+    }
+    
+    pid_t pid = syscall(SYS_clone3, &cl, sizeof(cl));
+    if (pid == -1 && cgroup_fd != -1 && (errno == EINVAL || errno == E2BIG)) {
+        // Kernels before 5.7 know clone3() but not CLONE_INTO_CGROUP
+        cl.flags &= ~CLONE_INTO_CGROUP;
+        cl.cgroup = 0;
+        pid = syscall(SYS_clone3, &cl, sizeof(cl));
+    } else if (pid != -1) {
+        *in_cgroup = cgroup_fd != -1;
+    }
+    if (pid != -1 || (errno != ENOSYS && errno != EPERM)) {
+        return pid;
+    }
+    
+    pid = fork();
+    if (pid > 0) {
+        *pidfd = syscall(SYS_pidfd_open, pid, 0);
+    }
+    return pid;
+}
+
+
+
+
+
+
+
+/*
+ - Wait for a child through its pidfd: waitid(P_PIDFD) can only ever reap
+   this child, and the raw system call also returns its rusage
+ - Falls back to wait4() on the pid when there is no pidfd
+ - Without SHELL_FEATURE_EVENTLOOP this is the only wait: such a shell has
+   no "&", so at most one child is ever running and there is nothing for a
+   job table to track. The pollable set of pidfds is the event loop's.
+ - Fills *status in the wait4() format, returns 0 or -1 on error
+*/
+static int wait_child(pid_t pid, int pidfd, int *status, struct rusage *usage) {
+    if (pidfd == -1) {
+        while (wait4(pid, status, 0, usage) == -1) {
+            if (errno != EINTR) {
+                perror("wait4");
+                return -1;
+            }
+        }
+        return 0;
+    }
+    
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    while (syscall(SYS_waitid, P_PIDFD, pidfd, &info, WEXITED, usage) == -1) {
+        if (errno != EINTR) {
+            perror("waitid");
+            close(pidfd);
+            return -1;
+        }
+    }
+    close(pidfd);
+    
+    // Back to the status word WIFEXITED() and friends understand
+    if (info.si_code == CLD_EXITED) {
+        *status = (info.si_status & 0xff) << 8;
+    } else {
+        *status = info.si_status & 0x7f;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Spawn a program found in PATH with its redirections applied
+ - When measure is not NULL it is filled with the child's resource usage
+ - A background program is only started, the job table keeps track of it
+ - timeout (NULL for none) limits its wall clock time
+ - path is where resolve_command() found the program, NULL leaves the
+   search to execvp()
+ - Returns the exit status of the program, 0 for a background one and
+   124 if it ran out of time
+*/
+int execute_external(char** args, const char *path, VarTable *var_table, RedirList *redirs,
+                     CmdStats *measure, int background, const CmdTimeout *timeout) {
+    int exec_pipe[2] = { -1, -1 };
+    int pidfd;
+    int in_cgroup;
+    struct timespec t_start, t_exec, t_end;
+    CmdCgroup cgroup = { -1, 0, NULL };
+    
+#if SHELL_FEATURE_CGROUP
+    // Sandboxed commands get a fresh leaf cgroup with the sandbox limits
+    if (cgroup_create_leaf(&cgroup) != 0) {
+        return 126;
+    }
+#endif
+    
+    if (measure != NULL) {
+        /*
+         - A close-on-exec pipe tells us when exec() happened: the write end
+           disappears at exec time and the parent's read() returns 0
+        */
+        if (pipe2(exec_pipe, O_CLOEXEC) == -1) {
+            perror("pipe2");
+            exec_pipe[0] = exec_pipe[1] = -1;
+        }
+        clock_gettime(CLOCK_REALTIME, &measure->started);
+        clock_gettime(CLOCK_MONOTONIC, &t_start);
+    }
+    
+    // Output of earlier built-ins must reach the file before the child writes
+    fflush(stdout);
+    fflush(stderr);
+    
+    pid_t pid = spawn_process(&pidfd, cgroup.dirfd, &in_cgroup);
+    
+    if (pid == -1) {
+        perror("fork");
+        if (exec_pipe[0] != -1) {
+            close(exec_pipe[0]);
+            close(exec_pipe[1]);
+        }
+#if SHELL_FEATURE_CGROUP
+        cgroup_release(&cgroup);
+#endif
+        return 1;   
+    } 
+    else if (pid == 0) {
+        // Child process
+        if (exec_pipe[0] != -1) {
+            close(exec_pipe[0]);
+        }
+        
+#if SHELL_FEATURE_EVENTLOOP
+        event_child_setup(background);
+#endif
+        /*
+         - The child leaves with _exit(): exit() would flush the stdio buffers
+           it shares with the shell, and rewinding the buffered part of a
+           script on stdin makes the shell read those lines twice
+        */
+#if SHELL_FEATURE_LIMITS
+        if (apply_child_limits() != 0) {
+            _exit(126);
+        }
+#endif
+#if SHELL_FEATURE_CGROUP
+        if (cgroup.dirfd != -1 && !in_cgroup && cgroup_join(&cgroup) != 0) {
+            _exit(126);
+        }
+#endif
+        
+#if SHELL_FEATURE_REDIR
+        // Handle input, output and error redirection
+        if (apply_redirections(redirs) != 0) {
+            _exit(EXIT_FAILURE);
+        }
+#else
+        (void)redirs;
+#endif
+        
+        // A cached path may have gone stale, execvp() searches PATH again then
+        if (path != NULL) {
+            execv(path, args);
+        }
+        
+        // Execute command, 127 means not found and 126 not executable, as in sh
+        if (execvp(args[0], args) == -1) {
+            int exec_errno = errno;
+            perror("Command not found");
+            _exit(exec_errno == ENOENT ? 127 : 126);
+        }
+    } 
+    else {
+        // Parent process
+        int status;
+        struct rusage usage;
+        int timed_out = 0;
+#if SHELL_FEATURE_EVENTLOOP
+        // The job owns the pidfd, its readiness is served by the epoll loop
+        Job *job = event_track_child(pid, pidfd, args, background, timeout);
+        pidfd = -1;
+        if (job != NULL) {
+            job->cgroup = cgroup;   // Reported and removed with the job
+            cgroup.dirfd = -1;
+            cgroup.path = NULL;
+        }
+        if (job == NULL && timeout != NULL) {
+            fprintf(stderr, "timeout: no event loop, running without a time limit\n");
+        }
+        if (job != NULL && background) {
+            fprintf(stderr, "[%d] %d\n", (int)(job - event_loop.jobs.items) + 1, pid);
+            var_table->last_background = pid;
+            return 0;
+        }
+#else
+        (void)var_table; // exported variables reach the child through the environment
+        (void)background;
+        (void)timeout;
+#endif
+        
+        if (exec_pipe[0] != -1) {
+            char c;
+            close(exec_pipe[1]);
+            while (read(exec_pipe[0], &c, 1) == -1 && errno == EINTR) {
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t_exec);
+            close(exec_pipe[0]);
+        }
+        
+#if SHELL_FEATURE_EVENTLOOP
+        if (job != NULL) {
+            // Signals keep being served while the job runs
+            int exit_status = event_wait_job(job);
+            if (!job->done) {
+                return exit_status;   // Stopped, it stays in the job table
+            }
+            status = job->status;
+            usage = job->usage;
+            timed_out = job->timeout_stage > 0;
+            event_remove_job(job);
+        } else
+#endif
+        if (wait_child(pid, pidfd, &status, &usage) == -1) {
+            return 1;
+        }
+#if SHELL_FEATURE_CGROUP
+        cgroup_release(&cgroup);
+#endif
+        
+        if (measure != NULL) {
+            clock_gettime(CLOCK_MONOTONIC, &t_end);
+            measure->wall_ms = (t_end.tv_sec - t_start.tv_sec) * 1e3 + (t_end.tv_nsec - t_start.tv_nsec) / 1e6;
+            if (exec_pipe[0] != -1) {
+                measure->exec_latency_ms = (t_exec.tv_sec - t_start.tv_sec) * 1e3 +
+                                           (t_exec.tv_nsec - t_start.tv_nsec) / 1e6;
+            }
+            measure->user_ms = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3;
+            measure->sys_ms = usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+            measure->max_rss_kb = usage.ru_maxrss;
+            measure->voluntary_ctxsw = usage.ru_nvcsw;
+            measure->involuntary_ctxsw = usage.ru_nivcsw;
+        }
+        
+        // Killed by a signal reports 128 + signal number, like sh
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        if (timed_out) {
+            status = 124;   // Same as timeout(1)
+        }
+        if (measure != NULL) {
+            measure->exit_status = status;
+        }
+        return status;
+    }
+    
+    return 1;
+}
+#endif // SHELL_FEATURE_EXTERNAL
+
+
+
+
+
+
+
+#if SHELL_FEATURE_SUBST
+// Commands that only print and change nothing in the shell run in-process
+static int substitution_in_process(const CommandList *list) {
+    for (int i = 0; i < list->count; i++) {
+        const ListCommand *cmd = &list->items[i];
+        if (cmd->args == NULL || cmd->next_op == LIST_BG ||
+            (strcmp(cmd->args[0], "echo") != 0 && strcmp(cmd->args[0], "pwd") != 0)) {
+            return 0;
+        }
+#if SHELL_FEATURE_SCRIPT
+        // A function may be called echo, and it could do anything
+        if (lookup_function(cmd->args[0], name_hash(cmd->args[0])) != NULL) {
+            return 0;
+        }
+#endif
+#if SHELL_FEATURE_ARITH
+        // $((x=5)) assigns while it expands, that has to stay in the subshell
+        for (int j = 1; j < cmd->arg_count; j++) {
+            if (strstr(cmd->args[j], "$((") != NULL) {
+                return 0;
+            }
+        }
+        for (int j = 0; j < cmd->redirs.count; j++) {
+            if (cmd->redirs.items[j].target != NULL && strstr(cmd->redirs.items[j].target, "$((") != NULL) {
+                return 0;
+            }
+        }
+#endif
+    }
+    return 1;
+}
+
+
+
+
+
+
+
+/*
+ - $(echo ...) and $(pwd): run the built-ins in the shell with stdout on a
+   memfd, a pipe could fill up with nobody reading it
+ - Returns their exit status
+*/
+static int substitute_in_process(CommandList *list, VarTable *var_table, TextBuffer *out) {
+    int memfd = memfd_create("shell_subst", MFD_CLOEXEC);
+    if (memfd == -1) {
+        perror("memfd_create");
+        return 1;
+    }
+    fflush(stdout);
+    int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (saved == -1 || dup2(memfd, STDOUT_FILENO) == -1) {
+        perror("dup2");
+        if (saved != -1) {
+            close(saved);
+        }
+        close(memfd);
+        return 1;
+    }
+    
+    int status = run_command_list(list, var_table);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    
+    off_t size = lseek(memfd, 0, SEEK_END);
+    if (size > 0 && text_reserve(out, size) == 0) {
+        ssize_t n = pread(memfd, out->data + out->len, size, 0);
+        if (n > 0) {
+            out->len += n;
+        }
+    }
+    close(memfd);
+    return status;
+}
+
+
+
+
+
+
+
+/*
+ - Everything else runs in a forked copy of the shell with stdout on a
+   pipe, read straight into out until every writer has closed it
+ - With SHELL_FEATURE_SCRIPT a text holding if, for, ... (list is NULL
+   then) is handed to execute_script() in the copy
+ - Returns the exit status of the forked shell
+*/
+static int substitute_forked(CommandList *list, const char *text, VarTable *var_table, TextBuffer *out) {
+    int fds[2];
+    int pidfd, in_cgroup;
+    
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        return 1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    
+    pid_t pid = spawn_process(&pidfd, -1, &in_cgroup);
+    if (pid == -1) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+    if (pid == 0) {
+        // dup2() clears close-on-exec, so the commands inherit the pipe as stdout
+        close(fds[0]);
+        if (dup2(fds[1], STDOUT_FILENO) == -1) {
+            _exit(1);
+        }
+        close(fds[1]);
+#if SHELL_FEATURE_EVENTLOOP
+        event_child_setup(0);
+        event_loop_subshell();
+#endif
+#if SHELL_FEATURE_SCRIPT
+        if (list == NULL) {
+            execute_script(text, var_table, NULL);
+            fflush(stdout);
+            fflush(stderr);
+            _exit(var_table->last_status & 0xff);
+        }
+#else
+        (void)text;
+#endif
+        run_command_list(list, var_table);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(var_table->last_status & 0xff);
+    }
+    
+    close(fds[1]);
+#if SHELL_FEATURE_EVENTLOOP
+    char *label[] = { "$(...)", NULL };
+    Job *job = event_track_child(pid, pidfd, label, 0, NULL);
+    pidfd = -1;
+#endif
+    
+    // read() straight into the buffer, which doubles whenever it is full
+    while (1) {
+        if (text_reserve(out, 4096) != 0) {
+            break;
+        }
+        ssize_t n = read(fds[0], out->data + out->len, out->capacity - out->len);
+        if (n > 0) {
+            out->len += n;
+        } else if (n == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    close(fds[0]);
+    
+    int status;
+#if SHELL_FEATURE_EVENTLOOP
+    if (job != NULL) {
+        int exit_status = event_wait_job(job);
+        if (job->done) {
+            event_remove_job(job);
+        }
+        return exit_status;
+    }
+#endif
+    struct rusage usage;
+    if (wait_child(pid, pidfd, &status, &usage) == -1) {
+        return 1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+
+
+
+
+
+
+#if SHELL_FEATURE_REDIR
+/*
+ - A heredoc body would be read from the shell's own input, by a forked
+   copy that leaves the parent's stdin position behind, so $(...) has none
+ - Returns 1 when a command of list has a heredoc (already reported)
+*/
+static int substitution_heredoc(const CommandList *list) {
+    for (int i = 0; i < list->count; i++) {
+        for (int j = 0; j < list->items[i].redirs.count; j++) {
+            if (list->items[i].redirs.items[j].type == REDIR_HEREDOC) {
+                fprintf(stderr, "syntax error: here-document inside command substitution\n");
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+#endif
+
+
+
+
+
+
+
+/*
+ - Run the commands of $(text) or `text` and append what they print to
+   out, trailing newlines removed
+ - Output-only built-ins run in the shell, anything else in a forked copy
+   of it, so assignments and cd inside stay inside. No temporary file is
+   ever written.
+ - Returns the exit status of the commands, also left in $?
+*/
+int command_substitution(const char *text, size_t len, VarTable *var_table, TextBuffer *out) {
+    CommandList list = { NULL, 0, 0 };
+    size_t start = out->len;
+    int status;
+    
+    var_table->substitutions++;
+    char *line = strndup(text, len);
+    if (line == NULL) {
+        perror("strndup failed");
+        return 1;
+    }
+    
+#if SHELL_FEATURE_SCRIPT
+    if (script_needs_parser(line)) {
+        status = substitute_forked(NULL, line, var_table, out);
+    } else
+#endif
+    if (parse_command_list(line, &list) != 0) {
+        status = 2;
+    } else if (list.count == 0) {
+        status = 0;
+#if SHELL_FEATURE_REDIR
+    } else if (substitution_heredoc(&list)) {
+        status = 2;
+#endif
+    } else if (substitution_in_process(&list)) {
+        status = substitute_in_process(&list, var_table, out);
+    } else {
+        status = substitute_forked(&list, line, var_table, out);
+    }
+    free_command_list(&list);
+    free(list.items);
+    free(line);
+    
+    // Only the length changes, the text is not copied
+    while (out->len > start && out->data[out->len - 1] == '\n') {
+        out->len--;
+    }
+    var_table->last_status = status;
+    return status;
+}
+#endif // SHELL_FEATURE_SUBST
@@ -0,0 +1,742 @@
+/**
+ * Shell Core - pathname expansion (*, ? and [...]) with cached directory scans
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "shellcore.h"
+
+
+
+
+#if SHELL_FEATURE_GLOB
+#define GLOB_MAX_OPS 256             // a component longer than NAME_MAX never matches
+#define GLOB_DIRENT_BUF (64 * 1024)  // bytes asked from each getdents64() call
+#define GLOB_RACY_SECONDS 1          // a directory changed this recently is read again
+
+// What getdents64() fills the buffer with
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// One step of a compiled pattern component
+typedef enum {
+    GLOB_LITERAL,   // text[0..len) exactly
+    GLOB_ANY,       // ?
+    GLOB_STAR,      // *
+    GLOB_CLASS      // [...] as a 256 bit set
+} GlobOpType;
+
+typedef struct {
+    GlobOpType type;
+    int len;
+    const char *text;
+    unsigned char set[32];
+} GlobOp;
+
+/*
+ - One component of a pattern ("app-*.log" of "logs/app-*.log"), compiled once and
+   matched against every name of the directory
+ - prefix/suffix are the literal runs at either end, checked with memcmp()
+   before the matcher runs, which rejects most names of a big directory
+*/
+typedef struct {
+    GlobOp ops[GLOB_MAX_OPS];
+    int count;
+    int dot_ok;                      // the pattern itself starts with '.'
+    const GlobOp *prefix;
+    const GlobOp *suffix;
+} GlobPattern;
+
+// Names of one directory, reused while its mtime stays the same
+typedef struct {
+    dev_t dev;                       // dev 0 and ino 0 mark a free slot
+    ino_t ino;
+    struct timespec mtime;
+    int racy;                        // changed too close to the scan, timestamps may hide a later change
+    char *names;                     // every name, '\0' terminated, back to back
+    size_t names_size;
+    uint32_t *offsets;               // start of each name in names
+    unsigned char *types;            // d_type of each name
+    int count;
+    int capacity;
+} DirCacheEntry;
+
+//structure to with pointer to cached directories and count and capacity
+typedef struct {
+    DirCacheEntry *items;            // open addressing on dev/ino, capacity is a power of two
+    int count;
+    int capacity;
+} DirCache;
+
+// Matches found for one word, sorted before they become arguments
+typedef struct {
+    char **items;
+    int count;
+    int capacity;
+} GlobResults;
+
+static DirCache dir_cache;
+static char dirent_buf[GLOB_DIRENT_BUF] __attribute__((aligned(8)));
+
+
+
+
+
+
+
+// Does [p, end) hold an unescaped *, ? or a [ with its closing ]?
+static int has_glob_range(const char *p, const char *end) {
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        } else if (*p == '*' || *p == '?') {
+            return 1;
+        } else if (*p == '[' && memchr(p + 1, ']', end - p - 1) != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Parse the bracket expression at p ("[a-z]", "[!0-9]", "[]x]") into op
+ - Returns the character after the closing ']', NULL if there is none
+   (then '[' is an ordinary character)
+*/
+static const char* compile_class(const char *p, const char *end, GlobOp *op) {
+    const char *q = p + 1;
+    int negate = 0;
+    
+    memset(op->set, 0, sizeof(op->set));
+    op->type = GLOB_CLASS;
+    if (q < end && (*q == '!' || *q == '^')) {
+        negate = 1;
+        q++;
+    }
+    const char *first = q;
+    while (q < end && (*q != ']' || q == first)) {
+        unsigned char lo = (unsigned char)*q;
+        unsigned char hi = lo;
+        if (q + 2 < end && q[1] == '-' && q[2] != ']') {
+            hi = (unsigned char)q[2];
+            q += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) {
+            op->set[c >> 3] |= 1 << (c & 7);
+        }
+        q++;
+    }
+    if (q >= end) {
+        return NULL;
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++) {
+            op->set[i] = ~op->set[i];
+        }
+    }
+    return q + 1;
+}
+
+
+
+
+
+
+
+/*
+ - Compile the pattern component [p, end) into pat
+ - Literal characters are merged into one op pointing into the pattern
+ - Returns 0, -1 if it needs more than GLOB_MAX_OPS steps
+*/
+static int compile_pattern(const char *p, const char *end, GlobPattern *pat) {
+    pat->count = 0;
+    pat->dot_ok = p < end && *p == '.';
+    pat->prefix = pat->suffix = NULL;
+    
+    while (p < end) {
+        if (pat->count >= GLOB_MAX_OPS) {
+            return -1;
+        }
+        GlobOp *op = &pat->ops[pat->count];
+        GlobOp *last = pat->count > 0 ? &pat->ops[pat->count - 1] : NULL;
+    
+        if (*p == '*') {
+            if (last == NULL || last->type != GLOB_STAR) {
+                op->type = GLOB_STAR;
+                pat->count++;
+            }
+            p++;
+            continue;
+        }
+        if (*p == '?') {
+            op->type = GLOB_ANY;
+            pat->count++;
+            p++;
+            continue;
+        }
+        if (*p == '[') {
+            const char *next = compile_class(p, end, op);
+            if (next != NULL) {
+                pat->count++;
+                p = next;
+                continue;
+            }
+        }
+    
+        // Literal character, a backslash takes the next one as it is
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        }
+        if (last != NULL && last->type == GLOB_LITERAL && last->text + last->len == p) {
+            last->len++;
+        } else {
+            op->type = GLOB_LITERAL;
+            op->text = p;
+            op->len = 1;
+            pat->count++;
+        }
+        p++;
+    }
+    
+    if (pat->count > 0 && pat->ops[0].type == GLOB_LITERAL) {
+        pat->prefix = &pat->ops[0];
+    }
+    if (pat->count > 1 && pat->ops[pat->count - 1].type == GLOB_LITERAL &&
+        pat->ops[pat->count - 2].type == GLOB_STAR) {
+        pat->suffix = &pat->ops[pat->count - 1];
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Match name (len bytes) against a compiled component
+ - A '*' remembers where it started; on a mismatch it takes one more
+   character and the steps after it are tried again, so no recursion and
+   at most len * steps work
+*/
+static int glob_match(const GlobPattern *pat, const char *name, size_t len) {
+    // Hidden names only match a pattern that starts with '.'
+    if (name[0] == '.' && !pat->dot_ok) {
+        return 0;
+    }
+    if (pat->prefix != NULL &&
+        (len < (size_t)pat->prefix->len || memcmp(name, pat->prefix->text, pat->prefix->len) != 0)) {
+        return 0;
+    }
+    if (pat->suffix != NULL &&
+        (len < (size_t)pat->suffix->len ||
+         memcmp(name + len - pat->suffix->len, pat->suffix->text, pat->suffix->len) != 0)) {
+        return 0;
+    }
+    
+    int op = 0;
+    size_t pos = 0;
+    int star_op = -1;
+    size_t star_pos = 0;
+    
+    while (pos < len || op < pat->count) {
+        if (op < pat->count) {
+            const GlobOp *g = &pat->ops[op];
+            unsigned char c = pos < len ? (unsigned char)name[pos] : 0;
+            switch (g->type) {
+            case GLOB_STAR:
+                star_op = op++;
+                star_pos = pos;
+                continue;
+            case GLOB_ANY:
+                if (pos < len) {
+                    op++;
+                    pos++;
+                    continue;
+                }
+                break;
+            case GLOB_CLASS:
+                if (pos < len && (g->set[c >> 3] & (1 << (c & 7)))) {
+                    op++;
+                    pos++;
+                    continue;
+                }
+                break;
+            case GLOB_LITERAL:
+                if (len - pos >= (size_t)g->len && memcmp(name + pos, g->text, g->len) == 0) {
+                    op++;
+                    pos += g->len;
+                    continue;
+                }
+                break;
+            }
+        }
+        if (star_op >= 0 && star_pos < len) {
+            pos = ++star_pos;
+            op = star_op + 1;
+            continue;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+
+
+
+
+
+
+// Slot of dev/ino in the cache: its entry, or the free slot it would take
+static DirCacheEntry* dir_cache_slot(dev_t dev, ino_t ino) {
+    uint64_t hash = ((uint64_t)dev * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)ino * 0xff51afd7ed558ccdULL);
+    int mask = dir_cache.capacity - 1;
+    
+    for (int i = (int)(hash >> 32) & mask; ; i = (i + 1) & mask) {
+        DirCacheEntry *entry = &dir_cache.items[i];
+        if ((entry->dev == dev && entry->ino == ino) || (entry->dev == 0 && entry->ino == 0)) {
+            return entry;
+        }
+    }
+}
+
+
+
+
+
+
+
+// Keep the cache at most 3/4 full so probes stay short
+static int dir_cache_grow(void) {
+    if (dir_cache.capacity != 0 && (dir_cache.count + 1) * 4 <= dir_cache.capacity * 3) {
+        return 0;
+    }
+    
+    DirCache old = dir_cache;
+    int new_capacity = old.capacity ? old.capacity * 2 : 64;
+    dir_cache.items = calloc(new_capacity, sizeof(DirCacheEntry));
+    if (dir_cache.items == NULL) {
+        perror("calloc failed");
+        dir_cache = old;
+        return -1;
+    }
+    dir_cache.capacity = new_capacity;
+    for (int i = 0; i < old.capacity; i++) {
+        if (old.items[i].dev != 0 || old.items[i].ino != 0) {
+            *dir_cache_slot(old.items[i].dev, old.items[i].ino) = old.items[i];
+        }
+    }
+    free(old.items);
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Read every name of the open directory fd into entry with getdents64(),
+   64 KiB of records per system call and no per-name allocation
+ - Returns 0, -1 on error
+*/
+static int scan_directory(int fd, DirCacheEntry *entry) {
+    size_t used = 0;
+    
+    entry->count = 0;
+    while (1) {
+        long n = syscall(SYS_getdents64, fd, dirent_buf, sizeof(dirent_buf));
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(dirent_buf + off);
+            off += d->d_reclen;
+    
+            // "." and ".." never match, not even ".*"
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+                continue;
+            }
+            size_t len = strlen(d->d_name) + 1;
+    
+            if (used + len > entry->names_size) {
+                size_t new_size = entry->names_size ? entry->names_size * 2 : 4096;
+                while (new_size < used + len) {
+                    new_size *= 2;
+                }
+                char *new_names = realloc(entry->names, new_size);
+                if (new_names == NULL) {
+                    perror("realloc failed");
+                    return -1;
+                }
+                entry->names = new_names;
+                entry->names_size = new_size;
+            }
+            if (entry->count >= entry->capacity) {
+                int new_capacity = entry->capacity ? entry->capacity * 2 : 64;
+                uint32_t *new_offsets = realloc(entry->offsets, new_capacity * sizeof(uint32_t));
+                if (new_offsets == NULL) {
+                    perror("realloc failed");
+                    return -1;
+                }
+                entry->offsets = new_offsets;
+                unsigned char *new_types = realloc(entry->types, new_capacity);
+                if (new_types == NULL) {
+                    perror("realloc failed");
+                    return -1;
+                }
+                entry->types = new_types;
+                entry->capacity = new_capacity;
+            }
+    
+            memcpy(entry->names + used, d->d_name, len);
+            entry->offsets[entry->count] = (uint32_t)used;
+            entry->types[entry->count] = d->d_type;
+            entry->count++;
+            used += len;
+        }
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Names of the directory at path, from the cache when its mtime has not
+   changed since it was read, otherwise read again with getdents64()
+ - Returns the entry, NULL if the directory cannot be read
+*/
+static DirCacheEntry* read_directory(const char *path) {
+    struct stat st;
+    
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode) || dir_cache_grow() != 0) {
+        return NULL;
+    }
+    
+    DirCacheEntry *entry = dir_cache_slot(st.st_dev, st.st_ino);
+    int known = entry->dev != 0 || entry->ino != 0;
+    if (known && !entry->racy && entry->mtime.tv_sec == st.st_mtim.tv_sec &&
+        entry->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        return entry;
+    }
+    
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    // Stat the descriptor actually read, the path may have changed meanwhile
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    dev_t path_dev = st.st_dev;
+    ino_t path_ino = st.st_ino;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        entry->racy = 1;
+        return NULL;
+    }
+    if (st.st_dev != path_dev || st.st_ino != path_ino) {
+        // Another directory was put at path, its names go to the slot of its own key
+        entry = dir_cache_slot(st.st_dev, st.st_ino);
+        known = entry->dev != 0 || entry->ino != 0;
+    }
+    if (scan_directory(fd, entry) != 0) {
+        close(fd);
+        entry->racy = 1;
+        return NULL;
+    }
+    close(fd);
+    
+    if (!known) {
+        dir_cache.count++;
+    }
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->mtime = st.st_mtim;
+    entry->racy = now.tv_sec - st.st_mtim.tv_sec <= GLOB_RACY_SECONDS;
+    return entry;
+}
+
+
+
+
+
+
+
+static int add_result(GlobResults *results, const char *path) {
+    if (results->count >= results->capacity) {
+        int new_capacity = results->capacity ? results->capacity * 2 : 16;
+        char **new_items = realloc(results->items, new_capacity * sizeof(char*));
+        if (new_items == NULL) {
+            perror("realloc failed");
+            return -1;
+        }
+        results->items = new_items;
+        results->capacity = new_capacity;
+    }
+    results->items[results->count] = strdup(path);
+    if (results->items[results->count] == NULL) {
+        perror("strdup failed");
+        return -1;
+    }
+    results->count++;
+    return 0;
+}
+
+
+
+
+
+
+
+// Is dir/name a directory? d_type answers without a stat() on most file systems
+static int is_directory(const char *path, unsigned char type) {
+    struct stat st;
+    
+    if (type == DT_DIR) {
+        return 1;
+    }
+    if (type != DT_LNK && type != DT_UNKNOWN) {
+        return 0;
+    }
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+
+
+
+
+
+
+/*
+ - Expand the components of a word from component (a pointer into the
+   word) onwards, prefix holds what is already matched, ending with '/'
+ - prefix is a PATH_MAX buffer the recursion appends to and cuts back
+ - Returns 0, -1 on error
+*/
+static int expand_component(char *prefix, size_t prefix_len, const char *component, int any_glob,
+                            GlobResults *results) {
+    const char *slash = strchr(component, '/');
+    const char *end = slash != NULL ? slash : component + strlen(component);
+    
+    if (!has_glob_range(component, end)) {
+        // Literal component, only checked once the word is complete
+        if (prefix_len + (end - component) + 2 > PATH_MAX) {
+            return 0;
+        }
+        memcpy(prefix + prefix_len, component, end - component);
+        prefix_len += end - component;
+        prefix[prefix_len] = '\0';
+        if (slash != NULL) {
+            prefix[prefix_len++] = '/';
+            prefix[prefix_len] = '\0';
+            return expand_component(prefix, prefix_len, slash + 1, any_glob, results);
+        }
+        struct stat st;
+        if (any_glob && lstat(prefix, &st) == -1) {
+            return 0;
+        }
+        return add_result(results, prefix);
+    }
+    
+    GlobPattern pat;
+    if (compile_pattern(component, end, &pat) != 0) {
+        return 0;
+    }
+    
+    DirCacheEntry *dir = read_directory(prefix_len == 0 ? "." : prefix);
+    if (dir == NULL) {
+        return 0;
+    }
+    
+    // Match everything first, the recursion may rescan and move cache entries
+    int count = dir->count;
+    char **matches = NULL;
+    unsigned char *types = NULL;
+    int matched = 0;
+    for (int i = 0; i < count; i++) {
+        const char *name = dir->names + dir->offsets[i];
+        if (!glob_match(&pat, name, strlen(name))) {
+            continue;
+        }
+        if (slash == NULL) {
+            if (prefix_len + strlen(name) + 1 > PATH_MAX) {
+                continue;
+            }
+            memcpy(prefix + prefix_len, name, strlen(name) + 1);
+            if (add_result(results, prefix) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (matches == NULL) {
+            matches = malloc(count * sizeof(char*));
+            types = malloc(count);
+            if (matches == NULL || types == NULL) {
+                perror("malloc failed");
+                free(matches);
+                free(types);
+                return -1;
+            }
+        }
+        matches[matched] = strdup(name);
+        types[matched] = dir->types[i];
+        if (matches[matched] == NULL) {
+            perror("strdup failed");
+            break;
+        }
+        matched++;
+    }
+    
+    // Directories only when more components follow ("*/src/*.c")
+    int result = 0;
+    for (int i = 0; i < matched; i++) {
+        size_t len = strlen(matches[i]);
+        if (result == 0 && prefix_len + len + 2 <= PATH_MAX) {
+            memcpy(prefix + prefix_len, matches[i], len + 1);
+            if (is_directory(prefix, types[i])) {
+                prefix[prefix_len + len] = '/';
+                prefix[prefix_len + len + 1] = '\0';
+                result = expand_component(prefix, prefix_len + len + 1, slash + 1, 1, results);
+            }
+        }
+        free(matches[i]);
+    }
+    free(matches);
+    free(types);
+    prefix[prefix_len] = '\0';
+    return result;
+}
+
+
+
+
+
+
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+
+
+
+
+
+/*
+ - Match a whole word against a pattern, for case: unlike file names a
+   leading '.' needs no '.' in the pattern
+ - Returns 1 on a match
+*/
+int glob_match_word(const char *pattern, const char *word) {
+    GlobPattern pat;
+    
+    if (compile_pattern(pattern, pattern + strlen(pattern), &pat) != 0) {
+        return strcmp(pattern, word) == 0;
+    }
+    pat.dot_ok = 1;
+    return glob_match(&pat, word, strlen(word));
+}
+
+
+
+
+
+
+
+/*
+ - Pathname expansion of every word holding *, ? or [...], after variables
+   were substituted: each word is replaced by the sorted names it matches,
+   a word that matches nothing stays as it is (like sh)
+ - Directory listings are cached for the session, keyed on the directory's
+   device and inode and trusted while its mtime is unchanged
+ - Returns args itself when nothing needed expanding, otherwise a new array
+   of copies the caller frees with free_args(), NULL on error
+*/
+char** expand_globs(char** args, int arg_count, int *new_count) {
+    int first = 0;
+    while (first < arg_count && !has_glob_range(args[first], args[first] + strlen(args[first]))) {
+        first++;
+    }
+    *new_count = arg_count;
+    if (first == arg_count) {
+        return args;
+    }
+    
+    GlobResults out = { NULL, 0, 0 };
+    char prefix[PATH_MAX];
+    int failed = 0;
+    for (int i = 0; i < arg_count && !failed; i++) {
+        const char *word = args[i];
+        if (i < first || !has_glob_range(word, word + strlen(word))) {
+            failed = add_result(&out, word) != 0;
+            continue;
+        }
+        
+        // "/usr/*" starts at the root, everything else at the current directory
+        size_t prefix_len = 0;
+        const char *component = word;
+        if (*word == '/') {
+            prefix[prefix_len++] = '/';
+            while (*component == '/') {
+                component++;
+            }
+        }
+        prefix[prefix_len] = '\0';
+        
+        int before = out.count;
+        failed = expand_component(prefix, prefix_len, component, 0, &out) != 0;
+        if (!failed && out.count == before) {
+            failed = add_result(&out, word) != 0;
+        } else if (!failed) {
+            qsort(out.items + before, out.count - before, sizeof(char*), compare_paths);
+        }
+    }
+    
+    // Room for the NULL execvp() needs
+    if (failed || add_result(&out, "") != 0) {
+        free_args(out.items, out.count);
+        *new_count = 0;
+        return NULL;
+    }
+    free(out.items[--out.count]);
+    out.items[out.count] = NULL;
+    *new_count = out.count;
+    return out.items;
+}
+#endif // SHELL_FEATURE_GLOB
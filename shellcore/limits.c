@@ -0,0 +1,328 @@
+/**
+ * Shell Core - timeout prefix and ulimit built-in
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+
+#include "shellcore.h"
+
+
+
+
+#if SHELL_FEATURE_LIMITS
+// Resources the ulimit built-in knows, with the unit its numbers are in
+typedef struct {
+    char option;
+    int resource;
+    rlim_t unit;            // bytes per unit, 1 for counts and seconds
+    const char *description;
+} LimitOption;
+
+static const LimitOption limit_options[] = {
+    { 'c', RLIMIT_CORE,    1024, "core file size          (kbytes)" },
+    { 'f', RLIMIT_FSIZE,   1024, "file size               (kbytes)" },
+    { 'l', RLIMIT_MEMLOCK, 1024, "max locked memory       (kbytes)" },
+    { 'n', RLIMIT_NOFILE,  1,    "open files                      " },
+    { 's', RLIMIT_STACK,   1024, "stack size              (kbytes)" },
+    { 't', RLIMIT_CPU,     1,    "cpu time               (seconds)" },
+    { 'u', RLIMIT_NPROC,   1,    "max user processes              " },
+    { 'v', RLIMIT_AS,      1024, "virtual memory          (kbytes)" },
+    { 0, 0, 0, NULL }
+};
+
+/*
+ - Limits set with ulimit, applied in every child right before exec so
+   the shell itself never runs out of CPU time, memory or descriptors
+*/
+static struct {
+    int set[RLIM_NLIMITS];
+    struct rlimit value[RLIM_NLIMITS];
+} child_limits;
+
+
+
+
+
+
+
+/*
+ - Parse a duration like "10", "2.5s", "3m", "1h" or "1d"
+ - Returns 0 and fills *ts, -1 if the text is not a duration
+*/
+static int parse_duration(const char *text, struct timespec *ts) {
+    char *end;
+    double seconds = strtod(text, &end);
+    
+    if (end == text || seconds < 0) {
+        return -1;
+    }
+    switch (*end) {
+    case '\0':
+    case 's': break;
+    case 'm': seconds *= 60; break;
+    case 'h': seconds *= 3600; break;
+    case 'd': seconds *= 86400; break;
+    default: return -1;
+    }
+    if (*end != '\0' && end[1] != '\0') {
+        return -1;
+    }
+    
+    ts->tv_sec = (time_t)seconds;
+    ts->tv_nsec = (long)((seconds - ts->tv_sec) * 1e9);
+    return 0;
+}
+
+
+
+
+
+
+
+// Signal given as a number, "TERM" or "SIGTERM", -1 if unknown
+static int parse_signal(const char *text) {
+    static const struct { const char *name; int sig; } names[] = {
+        { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+        { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+        { NULL, 0 }
+    };
+    char *end;
+    long sig = strtol(text, &end, 10);
+    
+    if (end != text && *end == '\0') {
+        return sig > 0 && sig < NSIG ? (int)sig : -1;
+    }
+    if (strncmp(text, "SIG", 3) == 0) {
+        text += 3;
+    }
+    for (int i = 0; names[i].name != NULL; i++) {
+        if (strcmp(text, names[i].name) == 0) {
+            return names[i].sig;
+        }
+    }
+    return -1;
+}
+
+
+
+
+
+
+
+/*
+ - Parse "timeout [-s SIGNAL] [-k DURATION] DURATION" at the start of args
+ - Returns the number of words used, so args + n is the command to run,
+   or -1 after printing a usage error
+*/
+int parse_timeout_prefix(char **args, int arg_count, CmdTimeout *timeout) {
+    int i = 1;
+    
+    memset(timeout, 0, sizeof(*timeout));
+    timeout->signal = SIGTERM;
+    
+    while (i + 1 < arg_count && args[i][0] == '-') {
+        if (strcmp(args[i], "-s") == 0) {
+            timeout->signal = parse_signal(args[i + 1]);
+            if (timeout->signal == -1) {
+                fprintf(stderr, "timeout: invalid signal '%s'\n", args[i + 1]);
+                return -1;
+            }
+        } else if (strcmp(args[i], "-k") == 0) {
+            if (parse_duration(args[i + 1], &timeout->kill_after) != 0) {
+                fprintf(stderr, "timeout: invalid time interval '%s'\n", args[i + 1]);
+                return -1;
+            }
+        } else {
+            break;
+        }
+        i += 2;
+    }
+    
+    if (i + 1 >= arg_count) {
+        fprintf(stderr, "timeout: usage: timeout [-s SIGNAL] [-k DURATION] DURATION command [args...]\n");
+        return -1;
+    }
+    if (parse_duration(args[i], &timeout->duration) != 0) {
+        fprintf(stderr, "timeout: invalid time interval '%s'\n", args[i]);
+        return -1;
+    }
+    return i + 1;
+}
+
+
+
+
+
+
+
+static const LimitOption* find_limit_option(char option) {
+    for (int i = 0; limit_options[i].option != 0; i++) {
+        if (limit_options[i].option == option) {
+            return &limit_options[i];
+        }
+    }
+    return NULL;
+}
+
+
+
+
+
+
+
+// Limit commands will get: the ulimit setting, or what the shell has itself
+static void child_limit(int resource, struct rlimit *lim) {
+    if (child_limits.set[resource]) {
+        *lim = child_limits.value[resource];
+    } else {
+        getrlimit(resource, lim);
+    }
+}
+
+
+
+
+
+
+
+static void print_limit(rlim_t value, rlim_t unit) {
+    if (value == RLIM_INFINITY) {
+        printf("unlimited\n");
+    } else {
+        printf("%llu\n", (unsigned long long)(value / unit));
+    }
+}
+
+
+
+
+
+
+
+/*
+ - ulimit [-S|-H] [-a] [-c|-f|-l|-n|-s|-t|-u|-v] [N|unlimited]
+ - Limits only apply to commands started afterwards, never to the shell
+ - -S and -H pick the soft or hard limit, setting changes both by default
+ - Returns 0, 1 if the limit cannot be set, 2 on a usage error
+*/
+int ulimit_builtin(char **args, int arg_count) {
+    int soft = 1, hard = 1, all = 0;
+    const LimitOption *opt = NULL;
+    const char *value = NULL;
+    
+    for (int i = 1; i < arg_count; i++) {
+        const char *arg = args[i];
+        if (arg[0] != '-' || arg[1] == '\0') {
+            if (value != NULL) {
+                fprintf(stderr, "ulimit: too many arguments\n");
+                return 2;
+            }
+            value = arg;
+            continue;
+        }
+        for (const char *p = arg + 1; *p; p++) {
+            if (*p == 'S') {
+                soft = 1;
+                hard = 0;
+            } else if (*p == 'H') {
+                hard = 1;
+                soft = 0;
+            } else if (*p == 'a') {
+                all = 1;
+            } else if ((opt = find_limit_option(*p)) == NULL) {
+                fprintf(stderr, "ulimit: -%c: invalid option\n", *p);
+                fprintf(stderr, "ulimit: usage: ulimit [-SHa] [-cflnstuv] [N|unlimited]\n");
+                return 2;
+            }
+        }
+    }
+    if (opt == NULL) {
+        opt = find_limit_option('f');   // sh shows the file size limit by default
+    }
+    
+    struct rlimit lim;
+    if (all) {
+        for (int i = 0; limit_options[i].option != 0; i++) {
+            child_limit(limit_options[i].resource, &lim);
+            printf("%s (-%c) ", limit_options[i].description, limit_options[i].option);
+            print_limit(soft ? lim.rlim_cur : lim.rlim_max, limit_options[i].unit);
+        }
+        return 0;
+    }
+    
+    child_limit(opt->resource, &lim);
+    if (value == NULL) {
+        print_limit(soft ? lim.rlim_cur : lim.rlim_max, opt->unit);
+        return 0;
+    }
+    
+    rlim_t new_value;
+    if (strcmp(value, "unlimited") == 0) {
+        new_value = RLIM_INFINITY;
+    } else {
+        char *end;
+        unsigned long long n = strtoull(value, &end, 10);
+        if (end == value || *end != '\0' || value[0] == '-') {
+            fprintf(stderr, "ulimit: %s: invalid number\n", value);
+            return 2;
+        }
+        // A product past RLIM_INFINITY - 1 would wrap, or quietly mean unlimited
+        if (n > (RLIM_INFINITY - 1) / opt->unit) {
+            fprintf(stderr, "ulimit: %s: value too large\n", value);
+            return 2;
+        }
+        new_value = n * opt->unit;
+    }
+    
+    if (hard) {
+        lim.rlim_max = new_value;
+    }
+    if (soft) {
+        lim.rlim_cur = new_value;
+    }
+    if (lim.rlim_cur > lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+    }
+    
+    // Only root may raise a hard limit, find out now rather than in every child
+    struct rlimit own;
+    getrlimit(opt->resource, &own);
+    if (lim.rlim_max > own.rlim_max && geteuid() != 0) {
+        fprintf(stderr, "ulimit: -%c: cannot raise the hard limit\n", opt->option);
+        return 1;
+    }
+    
+    child_limits.set[opt->resource] = 1;
+    child_limits.value[opt->resource] = lim;
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Apply the ulimit settings in a freshly spawned child, before exec
+ - Returns 0, -1 if a limit could not be set (already reported)
+*/
+int apply_child_limits(void) {
+    for (int r = 0; r < RLIM_NLIMITS; r++) {
+        if (child_limits.set[r] && prlimit(0, r, &child_limits.value[r], NULL) == -1) {
+            perror("ulimit");
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif // SHELL_FEATURE_LIMITS
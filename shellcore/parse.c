@@ -0,0 +1,525 @@
+/**
+ * Shell Core - command lists and tokenizer
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "shellcore.h"
+
+
+
+
+#if SHELL_FEATURE_SUBST
+/*
+ - p points at "$(" or "`": return the character after the matching ")" or
+   "`", so the separators and spaces inside stay part of one word
+ - $( ) may nest and hold `...`, backticks do not nest
+ - The "((" of an arithmetic command is skipped the same way
+ - Returns NULL when the substitution is not closed on this line
+*/
+const char* skip_substitution(const char *p) {
+    if (*p == '`') {
+        const char *end = strchr(p + 1, '`');
+        return end != NULL ? end + 1 : NULL;
+    }
+    
+    int depth = 0;
+    for (p += *p == '$'; *p; p++) {
+        if (*p == '(') {
+            depth++;
+        } else if (*p == ')') {
+            if (--depth == 0) {
+                return p + 1;
+            }
+        } else if (*p == '`' || (p[0] == '$' && p[1] == '(')) {
+            const char *end = skip_substitution(p);
+            if (end == NULL) {
+                return NULL;
+            }
+            p = end - 1;
+        }
+    }
+    return NULL;
+}
+#endif
+
+
+
+
+
+
+
+/*
+ - Next space separated word of *cursor, '\0' terminated in place
+ - A $(...) or `...` is never split, even when it holds spaces
+ - Returns NULL when there are no words left
+*/
+static char* next_word(char **cursor) {
+    char *p = *cursor;
+    
+    while (*p == ' ') {
+        p++;
+    }
+    if (*p == '\0') {
+        *cursor = p;
+        return NULL;
+    }
+    
+    char *word = p;
+    while (*p && *p != ' ') {
+#if SHELL_FEATURE_SUBST
+        if (*p == '`' || (p[0] == '$' && p[1] == '(')) {
+            const char *end = skip_substitution(p);
+            if (end != NULL) {
+                p = (char *)end;
+                continue;
+            }
+        }
+#endif
+        p++;
+    }
+    if (*p) {
+        *p++ = '\0';
+    }
+    *cursor = p;
+    return word;
+}
+
+
+
+
+
+
+
+/*
+ - Split a line into commands separated by ";", "&&", "||" and "&" (shells
+   built without SHELL_FEATURE_LISTS get one command per line, "&" needs
+   SHELL_FEATURE_EVENTLOOP to track the job)
+ - The separators are overwritten with '\0' so every command is a string
+   inside the line buffer, then each one is tokenized with parse_input()
+ - A single '&' is left alone, it belongs to redirections such as 2>&1
+ - Returns 0 on success, -1 on a syntax error (already reported)
+*/
+int parse_command_list(char* line, CommandList *list) {
+    char *start = line;
+    char *p = line;
+    
+    list->count = 0;
+    while (1) {
+        ListOp op;
+        char *next;
+        
+        if (*p == '\0') {
+            op = LIST_END;
+            next = p;
+#if SHELL_FEATURE_SUBST
+        } else if (*p == '`' || (p[0] == '$' && p[1] == '(')) {
+            // Separators inside a command substitution belong to it
+            const char *end = skip_substitution(p);
+            if (end == NULL) {
+                fprintf(stderr, "syntax error: unterminated command substitution\n");
+                return -1;
+            }
+            p = (char *)end;
+            continue;
+#endif
+#if SHELL_FEATURE_ARITH
+        } else if (p[0] == '(' && p[1] == '(') {
+            // "(( a && b ))" is one command
+            const char *end = skip_substitution(p);
+            if (end == NULL) {
+                fprintf(stderr, "syntax error: unterminated ((\n");
+                return -1;
+            }
+            p = (char *)end;
+            continue;
+#endif
+#if SHELL_FEATURE_LISTS
+        } else if (*p == ';') {
+            op = LIST_SEQ;
+            next = p + 1;
+        } else if (p[0] == '&' && p[1] == '&') {
+            op = LIST_AND;
+            next = p + 2;
+        } else if (p[0] == '|' && p[1] == '|') {
+            op = LIST_OR;
+            next = p + 2;
+#endif
+#if SHELL_FEATURE_EVENTLOOP
+        } else if (p[0] == '&' && p[1] != '>' && (p == line || (p[-1] != '>' && p[-1] != '<'))) {
+            // Not the '&' of 2>&1, <&0 or &>file
+            op = LIST_BG;
+            next = p + 1;
+#endif
+        } else {
+            p++;
+            continue;
+        }
+        *p = '\0';
+        
+        // Trim the command text
+        while (*start == ' ' || *start == '\t') {
+            start++;
+        }
+        char *end = start + strlen(start);
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+            *--end = '\0';
+        }
+        
+        if (*start == '\0') {
+            // "a ;", "a ; ;" and "a &" are fine, but "&& a", "a &&" or "& a" is not
+            ListOp prev = list->count > 0 ? list->items[list->count - 1].next_op : LIST_SEQ;
+            int prev_chains = prev == LIST_AND || prev == LIST_OR;
+            if (op == LIST_AND || op == LIST_OR || op == LIST_BG || prev_chains) {
+                fprintf(stderr, "syntax error near unexpected token '%s'\n",
+                        op == LIST_AND ? "&&" : op == LIST_OR ? "||" : op == LIST_SEQ ? ";" :
+                        op == LIST_BG ? "&" : "newline");
+                return -1;
+            }
+        } else {
+            if (list->count >= list->capacity) {
+                int new_capacity = list->capacity ? list->capacity * 2 : 4;
+                ListCommand *new_items = realloc(list->items, new_capacity * sizeof(ListCommand));
+                if (new_items == NULL) {
+                    perror("realloc failed");
+                    return -1;
+                }
+                list->items = new_items;
+                list->capacity = new_capacity;
+            }
+            
+            ListCommand *cmd = &list->items[list->count];
+            cmd->next_op = op;
+            list->count++;
+            if (parse_simple_command(start, cmd) != 0) {
+                return -1;
+            }
+        }
+        
+        if (op == LIST_END) {
+            break;
+        }
+        p = start = next;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Fill cmd from the trimmed text of one command: an assignment or ((expr))
+   keeps pointing into text, anything else is tokenized with parse_input()
+ - next_op is left to the caller
+ - Returns 0, -1 on error
+*/
+int parse_simple_command(char *text, ListCommand *cmd) {
+    cmd->assignment = NULL;
+    cmd->arithmetic = NULL;
+    cmd->args = NULL;
+    cmd->arg_count = 0;
+    init_redir_list(&cmd->redirs);
+    
+#if SHELL_FEATURE_ARITH
+    // "((i < 10))" is not a redirection and "((x=1))" not an assignment
+    if (text[0] == '(' && text[1] == '(') {
+        cmd->arithmetic = text;
+        return 0;
+    }
+#endif
+#if SHELL_FEATURE_VARS
+#if SHELL_FEATURE_SUBST
+    // Only the first word assigns, "echo $(x=1)" and "echo a=b" do not
+    int assigns = strcspn(text, "=") < strcspn(text, " $`");
+#else
+    int assigns = strchr(text, '=') != NULL;
+#endif
+#if SHELL_FEATURE_ALIAS
+    // "alias ll=ls -l" defines an alias, it assigns nothing
+    if (strncmp(text, "alias ", 6) == 0) {
+        assigns = 0;
+    }
+#endif
+    if (assigns) {
+        // Assignment, or an invalid command reported when it runs
+        cmd->assignment = text;
+        return 0;
+    }
+#endif
+    cmd->args = parse_input(text, &cmd->arg_count, &cmd->redirs);
+    if (cmd->args == NULL) {
+        return -1;
+    }
+#if SHELL_FEATURE_ALIAS
+    // Aliases are replaced now, a loop or function body pays for it once
+    if (expand_alias(&cmd->args, &cmd->arg_count) != 0) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+
+
+
+
+
+
+// Free every command of the list, the items array is kept for the next line
+void free_command_list(CommandList *list) {
+    for (int i = 0; i < list->count; i++) {
+        if (list->items[i].args != NULL) {
+            free_args(list->items[i].args, list->items[i].arg_count);
+        }
+        free_redir_list(&list->items[i].redirs);
+        free(list->items[i].redirs.items);
+    }
+    list->count = 0;
+}
+
+
+
+
+
+
+
+/*
+ - Recognise a redirection operator at the start of a token
+ - Accepted forms: [N]< [N]> [N]>> &> &>> [N]>&M [N]<&M [N]>&- [N]<<< [N]<<
+ - On success returns the number of characters used by the operator and fills
+   type, fd and src_fd. Whatever follows the operator is the (attached) target.
+ - Returns 0 when the token is an ordinary word.
+*/
+#if SHELL_FEATURE_REDIR
+static int match_redirection(const char *token, RedirType *type, int *fd, int *src_fd) {
+    const char *p = token;
+    int explicit_fd = -1;
+    
+    if (*p == '&' && p[1] == '>') {
+        // &> and &>> redirect stdout and stderr together
+        p += 2;
+        *type = REDIR_OUTPUT;
+        if (*p == '>') {
+            *type = REDIR_APPEND;
+            p++;
+        }
+        *fd = -2;   // marker for "both", expanded by parse_input()
+        *src_fd = -1;
+        return p - token;
+    }
+    
+    if (isdigit((unsigned char)*p)) {
+        explicit_fd = 0;
+        while (isdigit((unsigned char)*p)) {
+            explicit_fd = explicit_fd * 10 + (*p - '0');
+            if (explicit_fd > 1024) {
+                return 0;
+            }
+            p++;
+        }
+        if (*p != '<' && *p != '>') {
+            return 0;   // Plain number like "2" or "10abc"
+        }
+    }
+    
+    *src_fd = -1;
+    if (p[0] == '<' && p[1] == '<' && p[2] == '<') {
+        *type = REDIR_HERESTRING;
+        *fd = explicit_fd >= 0 ? explicit_fd : STDIN_FILENO;
+        p += 3;
+    } else if (p[0] == '<' && p[1] == '<') {
+        *type = REDIR_HEREDOC;
+        *fd = explicit_fd >= 0 ? explicit_fd : STDIN_FILENO;
+        p += 2;
+    } else if (p[0] == '>' && p[1] == '>') {
+        *type = REDIR_APPEND;
+        *fd = explicit_fd >= 0 ? explicit_fd : STDOUT_FILENO;
+        p += 2;
+    } else if ((p[0] == '>' || p[0] == '<') && p[1] == '&') {
+        *fd = explicit_fd >= 0 ? explicit_fd : (p[0] == '>' ? STDOUT_FILENO : STDIN_FILENO);
+        p += 2;
+        *type = REDIR_DUP;
+        if (*p == '-' && p[1] == '\0') {
+            *src_fd = -1;   // N>&- closes the descriptor
+            return p + 1 - token;
+        }
+        if (!isdigit((unsigned char)*p)) {
+            return 0;
+        }
+        *src_fd = 0;
+        while (isdigit((unsigned char)*p)) {
+            *src_fd = *src_fd * 10 + (*p - '0');
+            if (*src_fd > 1024) {
+                return 0;
+            }
+            p++;
+        }
+        if (*p != '\0') {
+            return 0;
+        }
+    } else if (p[0] == '>') {
+        *type = REDIR_OUTPUT;
+        *fd = explicit_fd >= 0 ? explicit_fd : STDOUT_FILENO;
+        p += 1;
+    } else if (p[0] == '<') {
+        *type = REDIR_INPUT;
+        *fd = explicit_fd >= 0 ? explicit_fd : STDIN_FILENO;
+        p += 1;
+    } else {
+        return 0;
+    }
+    
+    return p - token;
+}
+
+
+
+
+
+
+
+/*
+ - Record the redirection "token" starts with, the target is either attached
+   (">file") or the next word of *cursor ("> file")
+ - Returns 1 if the token was a redirection, 0 for an ordinary word, -1 on error
+*/
+static int take_redirection(char *token, char **cursor, RedirList *redirs) {
+    RedirType type;
+    int fd, src_fd;
+    int op_len = match_redirection(token, &type, &fd, &src_fd);
+    
+    if (op_len == 0) {
+        return 0;
+    }
+    
+    char *target = NULL;
+    if (type != REDIR_DUP) {
+        target = token + op_len;
+        if (*target == '\0') {
+            target = next_word(cursor);
+            if (target == NULL) {
+                fprintf(stderr, "Error: No target specified for '%s'\n", token);
+                return -1;
+            }
+        }
+    }
+    
+    if (fd == -2) {
+        // &> file is > file 2>&1
+        if (add_redirection(redirs, type, STDOUT_FILENO, -1, target) != 0 ||
+            add_redirection(redirs, REDIR_DUP, STDERR_FILENO, STDOUT_FILENO, NULL) != 0) {
+            return -1;
+        }
+    } else if (add_redirection(redirs, type, fd, src_fd, target) != 0) {
+        return -1;
+    }
+    return 1;
+}
+#endif // SHELL_FEATURE_REDIR
+
+
+
+
+
+
+
+char** parse_input(char* input, int* arg_count, RedirList *redirs) {
+    char* token;
+    char** args = NULL;
+    int count = 0;
+    int capacity = 10; // Initial capacity
+    
+    // Allocate initial memory for arguments
+    args = malloc(capacity * sizeof(char*));
+    if (args == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+    
+    // Tokenize input
+    char *cursor = input;
+    token = next_word(&cursor);
+    while (token != NULL) {
+#if SHELL_FEATURE_REDIR
+        int taken = take_redirection(token, &cursor, redirs);
+        if (taken < 0) {
+            free_args(args, count);
+            return NULL;
+        }
+        if (taken > 0) {
+            token = next_word(&cursor);
+            continue;
+        }
+#else
+        (void)redirs;
+#endif
+        
+        // Resize array if needed
+        if (count >= capacity) {
+            capacity *= 2;
+            char** new_args = realloc(args, capacity * sizeof(char*));
+            if (new_args == NULL) {
+                perror("realloc failed");
+                free_args(args, count);
+                return NULL;
+            }
+            args = new_args;
+        }
+        
+        // Allocate memory for the token and copy it
+        args[count] = strdup(token);
+        if (args[count] == NULL) {
+            perror("strdup failed");
+            free_args(args, count);
+            return NULL;
+        }
+        
+        count++;
+        
+        token = next_word(&cursor);
+    }
+    
+    // Add NULL terminator for execvp
+    if (count >= capacity) {
+        capacity++;
+        char** new_args = realloc(args, capacity * sizeof(char*));
+        if (new_args == NULL) {
+            perror("realloc failed");
+            free_args(args, count);
+            return NULL;
+        }
+        args = new_args;
+    }
+    args[count] = NULL;
+    
+    *arg_count = count;
+    return args;
+}
+
+
+
+
+
+
+
+// Free allocated memory for arguments
+void free_args(char** args, int arg_count) {
+    if (args == NULL) return; // Check if args is NULL before freeing
+    for (int i = 0; i < arg_count; i++) {
+        free(args[i]);
+    }
+    free(args);
+}
+
+
@@ -0,0 +1,268 @@
+/**
+ * Shell Core - redirections and heredocs
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "shellcore.h"
+
+
+
+
+// Initialize redirection list
+void init_redir_list(RedirList *redirs) {
+    redirs->items = NULL;
+    redirs->count = 0;
+    redirs->capacity = 0;
+}
+
+
+
+
+
+
+
+// Free redirection targets, the list itself is kept for the next command
+void free_redir_list(RedirList *redirs) {
+    for (int i = 0; i < redirs->count; i++) {
+        free(redirs->items[i].target);
+    }
+    redirs->count = 0;
+}
+
+
+
+
+
+
+
+#if SHELL_FEATURE_REDIR
+// Append a redirection, keeping command line order
+int add_redirection(RedirList *redirs, RedirType type, int fd, int src_fd, const char *target) {
+    if (redirs->count >= redirs->capacity) {
+        int new_capacity = redirs->capacity ? redirs->capacity * 2 : INITIAL_REDIR_CAPACITY;
+        Redirection *new_items = realloc(redirs->items, new_capacity * sizeof(Redirection));
+        if (new_items == NULL) {
+            perror("realloc failed");
+            return -1;
+        }
+        redirs->items = new_items;
+        redirs->capacity = new_capacity;
+    }
+    
+    Redirection *r = &redirs->items[redirs->count];
+    r->type = type;
+    r->fd = fd;
+    r->src_fd = src_fd;
+    r->target = NULL;
+    if (target != NULL) {
+        r->target = strdup(target);
+        if (r->target == NULL) {
+            perror("strdup failed");
+            return -1;
+        }
+    }
+    redirs->count++;
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Read the bodies of all << redirections from "in" (stdin or the rc file)
+ - Lines are read up to a line equal to the delimiter, the delimiter stored in
+   target is then replaced by the collected body
+*/
+int collect_heredocs(RedirList *redirs, FILE *in) {
+    for (int i = 0; i < redirs->count; i++) {
+        Redirection *r = &redirs->items[i];
+        if (r->type != REDIR_HEREDOC) {
+            continue;
+        }
+        
+        size_t len = 0, capacity = MAX_INPUT_SIZE;
+        char *body = malloc(capacity);
+        char line[MAX_INPUT_SIZE];
+        if (body == NULL) {
+            perror("malloc failed");
+            return -1;
+        }
+        body[0] = '\0';
+        
+        while (1) {
+            if (in == stdin && isatty(STDIN_FILENO)) {
+                printf("%s", HEREDOC_PROMPT);
+                fflush(stdout);
+            }
+            if (read_input_line(line, sizeof(line), in) == NULL) {
+                fprintf(stderr, "warning: here-document delimited by end-of-file (wanted '%s')\n", r->target);
+                break;
+            }
+            
+            size_t line_len = strcspn(line, "\n");
+            if (line_len == strlen(r->target) && strncmp(line, r->target, line_len) == 0) {
+                break;
+            }
+            
+            size_t chunk = strlen(line);
+            if (len + chunk + 1 > capacity) {
+                while (len + chunk + 1 > capacity) {
+                    capacity *= 2;
+                }
+                char *new_body = realloc(body, capacity);
+                if (new_body == NULL) {
+                    perror("realloc failed");
+                    free(body);
+                    return -1;
+                }
+                body = new_body;
+            }
+            memcpy(body + len, line, chunk + 1);
+            len += chunk;
+        }
+        
+        free(r->target);
+        r->target = body;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Put a here-string or heredoc body into an anonymous in-memory file
+ - memfd_create keeps the data off the disk and gives the command a real,
+   seekable descriptor positioned at the start of the body
+*/
+static int open_memory_document(const char *body, int add_newline) {
+    int fd = memfd_create("shell_heredoc", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
+        return -1;
+    }
+    
+    size_t len = strlen(body);
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, body + written, len - written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write heredoc");
+            close(fd);
+            return -1;
+        }
+        written += n;
+    }
+    if (add_newline && write(fd, "\n", 1) != 1) {
+        perror("write heredoc");
+        close(fd);
+        return -1;
+    }
+    
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+        perror("lseek heredoc");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+
+
+
+
+
+/*
+ - Apply the redirections in command line order to the current process
+ - Order matters: "> log 2>&1" sends both streams to log while
+   "2>&1 > log" keeps stderr on the old stdout, exactly like sh
+ - Returns 0 on success, -1 (after reporting the error) otherwise
+*/
+int apply_redirections(RedirList *redirs) {
+    for (int i = 0; i < redirs->count; i++) {
+        Redirection *r = &redirs->items[i];
+        int new_fd = -1;
+        
+        switch (r->type) {
+        case REDIR_INPUT:
+            new_fd = open(r->target, O_RDONLY);
+            if (new_fd == -1) {
+                perror("open input file");
+                return -1;
+            }
+            break;
+        case REDIR_OUTPUT:
+            new_fd = open(r->target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (new_fd == -1) {
+                perror("open output file");
+                return -1;
+            }
+            break;
+        case REDIR_APPEND:
+            // O_APPEND makes every write land at the end, even with several writers
+            new_fd = open(r->target, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (new_fd == -1) {
+                perror("open output file");
+                return -1;
+            }
+            break;
+        case REDIR_DUP:
+            if (r->src_fd == -1) {
+                close(r->fd);
+                continue;
+            }
+            if (r->src_fd != r->fd && dup2(r->src_fd, r->fd) == -1) {
+                perror("dup2");
+                return -1;
+            }
+            continue;
+        case REDIR_HERESTRING:
+            new_fd = open_memory_document(r->target, 1);
+            if (new_fd == -1) {
+                return -1;
+            }
+            break;
+        case REDIR_HEREDOC:
+            new_fd = open_memory_document(r->target, 0);
+            if (new_fd == -1) {
+                return -1;
+            }
+            break;
+        }
+        
+        if (new_fd != r->fd) {
+            if (dup2(new_fd, r->fd) == -1) {
+                perror("dup2");
+                close(new_fd);
+                return -1;
+            }
+            close(new_fd);
+        } else {
+            // Opened straight onto the wanted slot, keep it across exec
+            fcntl(new_fd, F_SETFD, 0);
+        }
+    }
+    return 0;
+}
+#endif // SHELL_FEATURE_REDIR
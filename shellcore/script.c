@@ -0,0 +1,1532 @@
+/**
+ * Shell Core - if, while, until, for, case, { } and functions
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "shellcore.h"
+
+
+
+
+#if SHELL_FEATURE_SCRIPT
+#define SCRIPT_MAX_DEPTH 1000        // nested function calls before "f() { f; }" is stopped
+
+// Kinds of node a compound command is parsed into
+typedef enum {
+    NODE_COMMAND,   // one command or assignment, parsed like a line of its own
+    NODE_IF,        // if cond; then body; [elif ...|else else_part;] fi
+    NODE_WHILE,     // while cond; do body; done
+    NODE_UNTIL,     // until cond; do body; done
+    NODE_FOR,       // for name [in words]; do body; done
+    NODE_CASE,      // case words[0] in pattern|pattern) body;; ... esac
+    NODE_GROUP,     // { body; }
+    NODE_FUNCTION   // name() body
+} NodeType;
+
+typedef struct ScriptNode ScriptNode;
+
+// One "pattern|pattern) body ;;" arm of a case
+typedef struct {
+    char **patterns;
+    int pattern_count;
+    ScriptNode *body;
+} CaseArm;
+
+/*
+ - Node of the tree a compound command is parsed into. The tree is built
+   once: loops and functions run the same nodes again, every run only
+   expands the words of the commands (variables, $(...), globs) afresh
+ - The nodes of a list are chained through next, next_op joins them
+*/
+struct ScriptNode {
+    NodeType type;
+    ListOp next_op;
+    ScriptNode *next;
+    char *text;                 // NODE_COMMAND and NODE_FOR: own copy of the text, command points into it
+    ListCommand command;        // NODE_COMMAND
+    ScriptNode *cond;           // NODE_IF, NODE_WHILE, NODE_UNTIL
+    ScriptNode *body;
+    ScriptNode *else_part;      // NODE_IF: the else list, or the elif as another NODE_IF
+    char *name;                 // NODE_FOR variable, NODE_FUNCTION name
+    char **words;               // NODE_FOR words (NULL without "in"), NODE_CASE subject
+    int word_count;
+    CaseArm *arms;              // NODE_CASE
+    int arm_count;
+};
+
+// A parsed compound command, kept while a function defined in it exists
+typedef struct {
+    ScriptNode *root;
+    int refs;
+} Script;
+
+// A function and the script its body belongs to
+typedef struct ShellFunction {
+    Script *script;
+    ScriptNode *body;
+} ShellFunction;
+
+// Where the parser is in the text of a compound command
+typedef struct {
+    const char *p;
+    int incomplete;             // the text ended where more was expected, read another line
+    int error;                  // a syntax error was reported
+} ScriptParser;
+
+// break, continue and return unwind the nodes being run up to their target
+typedef enum {
+    CONTROL_NONE,
+    CONTROL_BREAK,
+    CONTROL_CONTINUE,
+    CONTROL_RETURN,
+    CONTROL_INTERRUPT           // Ctrl-C: leave every loop and function
+} ControlFlow;
+
+static struct {
+    ControlFlow flow;
+    int levels;                 // loops break/continue N still has to leave
+    int loop_depth;
+    int function_depth;
+} control;
+
+// $1..$9, $# and $@ of the function being run
+static struct {
+    char **args;
+    int count;
+} positional;
+
+static NameTable functions;       // name -> ShellFunction
+static Script *running_script;   // the script new functions are defined in
+static TextBuffer joined_params; // storage handed out for $@ and $*
+
+// Words that start or end a compound command where a command name could be
+static const char *reserved_words[] = {
+    "if", "then", "elif", "else", "fi", "while", "until", "for", "do", "done",
+    "case", "esac", "{", "}", NULL
+};
+
+// Reserved words a list stops at, the construct around it consumes them
+static const char *closing_words[] = {
+    "then", "elif", "else", "fi", "do", "done", "esac", "}", NULL
+};
+
+static ScriptNode* parse_list(ScriptParser *ps);
+static ScriptNode* parse_command(ScriptParser *ps);
+static int run_nodes(ScriptNode *node, VarTable *var_table);
+
+
+
+
+
+
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+
+
+
+
+
+
+// Length of the plain word at p, the way reserved words and names are read
+static size_t word_length(const char *p) {
+    return strcspn(p, " \t\n;&|()");
+}
+
+
+
+
+
+
+
+static int in_word_list(const char **list, const char *p, size_t len) {
+    for (int i = 0; list[i] != NULL; i++) {
+        if (strlen(list[i]) == len && strncmp(p, list[i], len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Length of a "name()" or "name ( )" function header at p, 0 if p does
+   not start one
+*/
+static size_t function_header(const char *p) {
+    size_t len = word_length(p);
+    
+    if (len == 0 || !(isalpha((unsigned char)p[0]) || p[0] == '_')) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        if (!isalnum((unsigned char)p[i]) && p[i] != '_') {
+            return 0;
+        }
+    }
+    const char *q = p + len;
+    while (is_blank(*q)) {
+        q++;
+    }
+    if (*q++ != '(') {
+        return 0;
+    }
+    while (is_blank(*q)) {
+        q++;
+    }
+    return *q == ')' ? (size_t)(q + 1 - p) : 0;
+}
+
+
+
+
+
+
+
+/*
+ - Does the line need the script parser? Only when a reserved word or a
+   function header is where a command name would be, every other line
+   keeps going through parse_command_list()
+*/
+int script_needs_parser(const char *line) {
+    const char *p = line;
+    int command_start = 1;
+    
+    while (*p) {
+        if (command_start) {
+            while (is_blank(*p) || *p == '\n') {
+                p++;
+            }
+            if (in_word_list(reserved_words, p, word_length(p)) || function_header(p) > 0) {
+                return 1;
+            }
+            command_start = 0;
+        }
+#if SHELL_FEATURE_SUBST
+        if (*p == '`' || (p[0] == '$' && p[1] == '(')) {
+            const char *end = skip_substitution(p);
+            if (end == NULL) {
+                return 0;   // parse_command_list() reports it
+            }
+            p = end;
+            continue;
+        }
+#endif
+        command_start = *p == ';' || *p == '&' || *p == '|' || *p == '\n';
+        p++;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+/***
+ *** Parser
+ ***/
+
+// Skip spaces, tabs and a comment, up to but not past the end of the line
+static void skip_blanks(ScriptParser *ps) {
+    while (is_blank(*ps->p)) {
+        ps->p++;
+    }
+    if (*ps->p == '#') {
+        while (*ps->p && *ps->p != '\n') {
+            ps->p++;
+        }
+    }
+}
+
+
+
+
+
+
+
+// Skip what separates the commands of a list: newlines and single ';'
+static void skip_separators(ScriptParser *ps) {
+    while (1) {
+        skip_blanks(ps);
+        if (*ps->p == '\n' || (*ps->p == ';' && ps->p[1] != ';')) {
+            ps->p++;
+        } else {
+            break;
+        }
+    }
+}
+
+
+
+
+
+
+
+static int parse_failed(const ScriptParser *ps) {
+    return ps->error || ps->incomplete;
+}
+
+
+
+
+
+
+
+// Is the next word exactly kw?
+static int at_keyword(ScriptParser *ps, const char *kw) {
+    skip_blanks(ps);
+    size_t len = word_length(ps->p);
+    return len == strlen(kw) && strncmp(ps->p, kw, len) == 0;
+}
+
+
+
+
+
+
+
+/*
+ - Complain about the token at the cursor. At the end of the text nothing
+   is wrong yet, the construct just goes on in the next line
+*/
+static void syntax_error(ScriptParser *ps) {
+    if (parse_failed(ps)) {
+        return;
+    }
+    skip_blanks(ps);
+    const char *p = ps->p;
+    if (*p == '\0') {
+        ps->incomplete = 1;
+        return;
+    }
+    
+    size_t len = word_length(p);
+    if (len == 0) {
+        len = (p[0] == p[1] && strchr(";&|", p[0]) != NULL) ? 2 : 1;
+    }
+    if (*p == '\n') {
+        fprintf(stderr, "syntax error near unexpected token 'newline'\n");
+    } else {
+        fprintf(stderr, "syntax error near unexpected token '%.*s'\n", (int)len, p);
+    }
+    ps->error = 1;
+}
+
+
+
+
+
+
+
+static int expect_keyword(ScriptParser *ps, const char *kw) {
+    if (at_keyword(ps, kw)) {
+        ps->p += strlen(kw);
+        return 0;
+    }
+    syntax_error(ps);
+    return -1;
+}
+
+
+
+
+
+
+
+// A list stops at a closing reserved word, a ";;" or the end of the text
+static int at_list_end(ScriptParser *ps) {
+    skip_blanks(ps);
+    const char *p = ps->p;
+    return *p == '\0' || (p[0] == ';' && p[1] == ';') || in_word_list(closing_words, p, word_length(p));
+}
+
+
+
+
+
+
+
+static ScriptNode* new_node(NodeType type) {
+    ScriptNode *node = calloc(1, sizeof(ScriptNode));
+    if (node == NULL) {
+        perror("calloc failed");
+        return NULL;
+    }
+    node->type = type;
+    node->next_op = LIST_END;
+    return node;
+}
+
+
+
+
+
+
+
+// Free a list of nodes and everything below them
+static void free_nodes(ScriptNode *node) {
+    while (node != NULL) {
+        ScriptNode *next = node->next;
+    
+        if (node->type == NODE_COMMAND) {
+            free_args(node->command.args, node->command.arg_count);
+            free_redir_list(&node->command.redirs);
+            free(node->command.redirs.items);
+        }
+        free_nodes(node->cond);
+        free_nodes(node->body);
+        free_nodes(node->else_part);
+        for (int i = 0; i < node->arm_count; i++) {
+            free_args(node->arms[i].patterns, node->arms[i].pattern_count);
+            free_nodes(node->arms[i].body);
+        }
+        free(node->arms);
+        free_args(node->words, node->word_count);
+        free(node->name);
+        free(node->text);
+        free(node);
+        node = next;
+    }
+}
+
+
+
+
+
+
+
+/*
+ - One command up to the next separator, copied out of the script and
+   parsed with parse_simple_command() like a command of a line
+ - A $(...) may span lines, one still open asks for the next line
+*/
+static ScriptNode* parse_simple(ScriptParser *ps) {
+    const char *start = ps->p;
+    const char *p = start;
+    
+    while (*p && *p != '\n' && *p != ';') {
+        if (p[0] == '&' && (p[1] == '&' || (p[1] != '>' && (p == start || (p[-1] != '>' && p[-1] != '<'))))) {
+            break;   // &&, or a '&' that is not part of 2>&1, <&0 or &>file
+        }
+        if (p[0] == '|' && p[1] == '|') {
+            break;
+        }
+        if (*p == '#' && (p == start || is_blank(p[-1]))) {
+            break;
+        }
+#if SHELL_FEATURE_SUBST
+        if (*p == '`' || (p[0] == '$' && p[1] == '(')) {
+            const char *end = skip_substitution(p);
+            if (end == NULL) {
+                ps->incomplete = 1;
+                return NULL;
+            }
+            p = end;
+            continue;
+        }
+#endif
+#if SHELL_FEATURE_ARITH
+        if (p[0] == '(' && p[1] == '(') {
+            const char *end = skip_substitution(p);
+            if (end == NULL) {
+                ps->incomplete = 1;
+                return NULL;
+            }
+            p = end;
+            continue;
+        }
+#endif
+        p++;
+    }
+    
+    size_t len = p - start;
+    while (len > 0 && is_blank(start[len - 1])) {
+        len--;
+    }
+    if (len == 0) {
+        syntax_error(ps);
+        return NULL;
+    }
+    
+    ScriptNode *node = new_node(NODE_COMMAND);
+    if (node == NULL) {
+        ps->error = 1;
+        return NULL;
+    }
+    node->text = strndup(start, len);
+    if (node->text == NULL || parse_simple_command(node->text, &node->command) != 0) {
+        if (node->text == NULL) {
+            perror("strndup failed");
+        }
+        ps->error = 1;
+        free_nodes(node);
+        return NULL;
+    }
+    ps->p = p;
+    return node;
+}
+
+
+
+
+
+
+
+// if and elif: the condition, its then part and what comes after it, up to fi
+static ScriptNode* parse_if(ScriptParser *ps) {
+    ScriptNode *node = new_node(NODE_IF);
+    if (node == NULL) {
+        ps->error = 1;
+        return NULL;
+    }
+    
+    node->cond = parse_list(ps);
+    if (node->cond == NULL || expect_keyword(ps, "then") != 0) {
+        syntax_error(ps);
+        free_nodes(node);
+        return NULL;
+    }
+    node->body = parse_list(ps);
+    if (node->body == NULL) {
+        syntax_error(ps);
+    } else if (at_keyword(ps, "elif")) {
+        ps->p += 4;
+        node->else_part = parse_if(ps);   // consumes the fi of the whole if
+    } else {
+        if (at_keyword(ps, "else")) {
+            ps->p += 4;
+            node->else_part = parse_list(ps);
+            if (node->else_part == NULL) {
+                syntax_error(ps);
+            }
+        }
+        if (!parse_failed(ps)) {
+            expect_keyword(ps, "fi");
+        }
+    }
+    
+    if (parse_failed(ps)) {
+        free_nodes(node);
+        return NULL;
+    }
+    return node;
+}
+
+
+
+
+
+
+
+// while and until: condition list, then the body between do and done
+static ScriptNode* parse_loop(ScriptParser *ps, NodeType type) {
+    ScriptNode *node = new_node(type);
+    if (node == NULL) {
+        ps->error = 1;
+        return NULL;
+    }
+    
+    node->cond = parse_list(ps);
+    if (node->cond == NULL || expect_keyword(ps, "do") != 0) {
+        syntax_error(ps);
+    } else {
+        node->body = parse_list(ps);
+        if (node->body == NULL || expect_keyword(ps, "done") != 0) {
+            syntax_error(ps);
+        }
+    }
+    
+    if (parse_failed(ps)) {
+        free_nodes(node);
+        return NULL;
+    }
+    return node;
+}
+
+
+
+
+
+
+
+/*
+ - for NAME [in WORDS]; do body; done
+ - The words are tokenized now and expanded each time the loop starts,
+   without "in" the loop goes over $1, $2, ...
+*/
+static ScriptNode* parse_for(ScriptParser *ps) {
+    ScriptNode *node = new_node(NODE_FOR);
+    if (node == NULL) {
+        ps->error = 1;
+        return NULL;
+    }
+    
+    skip_blanks(ps);
+    size_t len = word_length(ps->p);
+    node->name = strndup(ps->p, len);
+    if (node->name == NULL || len == 0 || !is_valid_var_name(node->name)) {
+        syntax_error(ps);
+        free_nodes(node);
+        return NULL;
+    }
+    ps->p += len;
+    
+    if (at_keyword(ps, "in")) {
+        ps->p += 2;
+        const char *start = ps->p;
+        size_t words_len = strcspn(start, "\n;#");
+        node->text = strndup(start, words_len);
+        RedirList redirs;
+        init_redir_list(&redirs);
+        if (node->text != NULL) {
+            node->words = parse_input(node->text, &node->word_count, &redirs);
+        }
+        if (node->words == NULL || redirs.count > 0) {
+            if (redirs.count > 0) {
+                fprintf(stderr, "syntax error: redirection in the word list of for\n");
+            }
+            ps->error = 1;
+        }
+        free_redir_list(&redirs);
+        free(redirs.items);
+        ps->p = start + words_len;
+    }
+    
+    if (!parse_failed(ps)) {
+        skip_separators(ps);
+        if (expect_keyword(ps, "do") == 0) {
+            node->body = parse_list(ps);
+            if (node->body == NULL || expect_keyword(ps, "done") != 0) {
+                syntax_error(ps);
+            }
+        }
+    }
+    
+    if (parse_failed(ps)) {
+        free_nodes(node);
+        return NULL;
+    }
+    return node;
+}
+
+
+
+
+
+
+
+// Append a copy of [start, start + len) to a NULL terminated word array
+static int add_word(char ***words, int *count, const char *start, size_t len) {
+    char **new_words = realloc(*words, (*count + 2) * sizeof(char*));
+    if (new_words == NULL) {
+        perror("realloc failed");
+        return -1;
+    }
+    *words = new_words;
+    new_words[*count] = strndup(start, len);
+    if (new_words[*count] == NULL) {
+        perror("strndup failed");
+        return -1;
+    }
+    new_words[++*count] = NULL;
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - case WORD in [(]PATTERN[|PATTERN]...) list ;; ... esac
+ - The ;; of the last arm may be left out
+*/
+static ScriptNode* parse_case(ScriptParser *ps) {
+    ScriptNode *node = new_node(NODE_CASE);
+    if (node == NULL) {
+        ps->error = 1;
+        return NULL;
+    }
+    
+    skip_blanks(ps);
+    size_t len = strcspn(ps->p, " \t\n;&|()");
+    if (len == 0) {
+        syntax_error(ps);
+    } else if (add_word(&node->words, &node->word_count, ps->p, len) != 0) {
+        ps->error = 1;
+    } else {
+        ps->p += len;
+        while (is_blank(*ps->p) || *ps->p == '\n') {
+            ps->p++;
+        }
+        expect_keyword(ps, "in");
+    }
+    
+    while (!parse_failed(ps)) {
+        skip_separators(ps);
+        if (at_keyword(ps, "esac")) {
+            ps->p += 4;
+            break;
+        }
+        if (*ps->p == '(') {
+            ps->p++;
+        }
+    
+        CaseArm *arms = realloc(node->arms, (node->arm_count + 1) * sizeof(CaseArm));
+        if (arms == NULL) {
+            perror("realloc failed");
+            ps->error = 1;
+            break;
+        }
+        node->arms = arms;
+        CaseArm *arm = &arms[node->arm_count++];
+        memset(arm, 0, sizeof(*arm));
+    
+        // Patterns separated by '|', up to the ')'
+        while (1) {
+            skip_blanks(ps);
+            size_t pattern_len = strcspn(ps->p, " \t\n|)");
+            if (pattern_len == 0) {
+                syntax_error(ps);
+                break;
+            }
+            if (add_word(&arm->patterns, &arm->pattern_count, ps->p, pattern_len) != 0) {
+                ps->error = 1;
+                break;
+            }
+            ps->p += pattern_len;
+            skip_blanks(ps);
+            if (*ps->p == '|') {
+                ps->p++;
+            } else if (*ps->p == ')') {
+                ps->p++;
+                break;
+            } else {
+                syntax_error(ps);
+                break;
+            }
+        }
+        if (parse_failed(ps)) {
+            break;
+        }
+    
+        arm->body = parse_list(ps);
+        if (parse_failed(ps)) {
+            break;
+        }
+        skip_blanks(ps);
+        if (ps->p[0] == ';' && ps->p[1] == ';') {
+            ps->p += 2;
+        } else if (!at_keyword(ps, "esac")) {
+            syntax_error(ps);
+        }
+    }
+    
+    if (parse_failed(ps)) {
+        free_nodes(node);
+        return NULL;
+    }
+    return node;
+}
+
+
+
+
+
+
+
+// { list; }
+static ScriptNode* parse_group(ScriptParser *ps) {
+    ScriptNode *node = new_node(NODE_GROUP);
+    if (node == NULL) {
+        ps->error = 1;
+        return NULL;
+    }
+    
+    node->body = parse_list(ps);
+    if (node->body == NULL || expect_keyword(ps, "}") != 0) {
+        syntax_error(ps);
+        free_nodes(node);
+        return NULL;
+    }
+    return node;
+}
+
+
+
+
+
+
+
+/*
+ - name() followed by a compound command, usually { ... }
+ - The body is parsed here, once; calling the function only runs it
+*/
+static ScriptNode* parse_function(ScriptParser *ps, size_t header_len) {
+    ScriptNode *node = new_node(NODE_FUNCTION);
+    if (node == NULL) {
+        ps->error = 1;
+        return NULL;
+    }
+    
+    node->name = strndup(ps->p, word_length(ps->p));
+    if (node->name == NULL) {
+        perror("strndup failed");
+        ps->error = 1;
+        free_nodes(node);
+        return NULL;
+    }
+    ps->p += header_len;
+    
+    while (is_blank(*ps->p) || *ps->p == '\n') {
+        ps->p++;
+    }
+    if (!(at_keyword(ps, "{") || at_keyword(ps, "if") || at_keyword(ps, "while") ||
+          at_keyword(ps, "until") || at_keyword(ps, "for") || at_keyword(ps, "case"))) {
+        syntax_error(ps);
+    } else {
+        node->body = parse_command(ps);
+    }
+    
+    if (parse_failed(ps)) {
+        free_nodes(node);
+        return NULL;
+    }
+    return node;
+}
+
+
+
+
+
+
+
+// One command: a compound command by its first word, a function or a simple command
+static ScriptNode* parse_command(ScriptParser *ps) {
+    skip_blanks(ps);
+    
+    if (at_keyword(ps, "if")) {
+        ps->p += 2;
+        return parse_if(ps);
+    }
+    if (at_keyword(ps, "while")) {
+        ps->p += 5;
+        return parse_loop(ps, NODE_WHILE);
+    }
+    if (at_keyword(ps, "until")) {
+        ps->p += 5;
+        return parse_loop(ps, NODE_UNTIL);
+    }
+    if (at_keyword(ps, "for")) {
+        ps->p += 3;
+        return parse_for(ps);
+    }
+    if (at_keyword(ps, "case")) {
+        ps->p += 4;
+        return parse_case(ps);
+    }
+    if (at_keyword(ps, "{")) {
+        ps->p += 1;
+        return parse_group(ps);
+    }
+    
+    size_t header_len = function_header(ps->p);
+    if (header_len > 0) {
+        return parse_function(ps, header_len);
+    }
+    if (in_word_list(reserved_words, ps->p, word_length(ps->p))) {
+        syntax_error(ps);
+        return NULL;
+    }
+    return parse_simple(ps);
+}
+
+
+
+
+
+
+
+/*
+ - Commands separated by newlines, ";", "&&", "||" and "&", up to a
+   closing reserved word, a ";;" or the end of the text
+ - After "&&" and "||" the list goes on in the next line
+ - Returns the first node, NULL for an empty list or on error
+*/
+static ScriptNode* parse_list(ScriptParser *ps) {
+    ScriptNode *head = NULL;
+    ScriptNode **tail = &head;
+    
+    while (!parse_failed(ps)) {
+        skip_separators(ps);
+        if (at_list_end(ps)) {
+            break;
+        }
+    
+        ScriptNode *node = parse_command(ps);
+        if (node == NULL) {
+            break;
+        }
+        *tail = node;
+        tail = &node->next;
+    
+        skip_blanks(ps);
+        const char *p = ps->p;
+        if (p[0] == '&' && p[1] == '&') {
+            node->next_op = LIST_AND;
+            ps->p += 2;
+        } else if (p[0] == '|' && p[1] == '|') {
+            node->next_op = LIST_OR;
+            ps->p += 2;
+#if SHELL_FEATURE_EVENTLOOP
+        } else if (p[0] == '&' && node->type == NODE_COMMAND) {
+            node->next_op = LIST_BG;
+            ps->p += 1;
+#endif
+        } else if (p[0] == '\n' || (p[0] == ';' && p[1] != ';')) {
+            node->next_op = LIST_SEQ;
+            ps->p += 1;
+        } else if (!at_list_end(ps)) {
+            // "done > file", "} &" and the like are not supported
+            syntax_error(ps);
+        }
+    
+        if (node->next_op == LIST_AND || node->next_op == LIST_OR) {
+            while (is_blank(*ps->p) || *ps->p == '\n') {
+                ps->p++;
+            }
+            if (*ps->p == '\0') {
+                ps->incomplete = 1;
+            } else if (at_list_end(ps)) {
+                syntax_error(ps);
+            }
+        }
+    }
+    
+    if (parse_failed(ps)) {
+        free_nodes(head);
+        return NULL;
+    }
+    return head;
+}
+
+
+
+
+
+
+
+/*
+ - Parse the whole text of a compound command
+ - Returns the script, NULL on a syntax error or when *incomplete says
+   the text stops in the middle of a construct
+*/
+static Script* parse_script(const char *text, int *incomplete) {
+    ScriptParser ps = { text, 0, 0 };
+    
+    ScriptNode *root = parse_list(&ps);
+    if (!parse_failed(&ps) && *ps.p != '\0') {
+        syntax_error(&ps);   // a closing word or ";;" nothing opened
+    }
+    *incomplete = ps.incomplete;
+    if (parse_failed(&ps)) {
+        free_nodes(root);
+        return NULL;
+    }
+    
+    Script *script = malloc(sizeof(Script));
+    if (script == NULL) {
+        perror("malloc failed");
+        free_nodes(root);
+        return NULL;
+    }
+    script->root = root;
+    script->refs = 1;
+    return script;
+}
+
+
+
+
+
+
+
+static void script_release(Script *script) {
+    if (script != NULL && --script->refs == 0) {
+        free_nodes(script->root);
+        free(script);
+    }
+}
+
+
+
+
+
+
+
+/***
+ *** Running the tree
+ ***/
+
+// The function called name, hash is name_hash(name); NULL if there is none
+ShellFunction* lookup_function(const char *name, uint32_t hash) {
+    NameEntry *entry = name_table_find(&functions, name, hash);
+    return entry != NULL ? entry->value : NULL;
+}
+
+
+
+
+
+
+
+/*
+ - Define (or redefine) a function, its body stays in the script it was
+   parsed in, which is kept alive for it
+ - The ShellFunction itself never moves, so a resolved command can keep
+   pointing at it
+ - Returns 0, 1 on error
+*/
+static int define_function(ScriptNode *node) {
+    NameEntry *entry = name_table_insert(&functions, node->name, name_hash(node->name));
+    if (entry == NULL) {
+        return 1;
+    }
+    
+    ShellFunction *fn = entry->value;
+    if (fn == NULL) {
+        fn = calloc(1, sizeof(ShellFunction));
+        if (fn == NULL) {
+            perror("calloc failed");
+            name_table_remove(&functions, entry);
+            return 1;
+        }
+        entry->value = fn;
+    }
+    
+    running_script->refs++;
+    script_release(fn->script);
+    fn->script = running_script;
+    fn->body = node->body;
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Run a function with args[1..] as $1, $2, ... in the shell itself
+ - Returns the status of its last command, or the one given to return
+*/
+int call_function(ShellFunction *fn, char **args, int arg_count, VarTable *var_table) {
+    if (control.function_depth >= SCRIPT_MAX_DEPTH) {
+        fprintf(stderr, "%s: maximum function nesting level exceeded (%d)\n", args[0], SCRIPT_MAX_DEPTH);
+        return 1;
+    }
+    
+    // The function may redefine itself while it runs, its nodes must stay
+    Script *script = fn->script;
+    ScriptNode *body = fn->body;
+    script->refs++;
+    
+    Script *saved_script = running_script;
+    char **saved_args = positional.args;
+    int saved_count = positional.count;
+    int saved_loops = control.loop_depth;
+    running_script = script;
+    positional.args = args + 1;
+    positional.count = arg_count - 1;
+    control.loop_depth = 0;
+    control.function_depth++;
+    
+    int status = run_nodes(body, var_table);
+    if (control.flow == CONTROL_RETURN || (control.flow == CONTROL_INTERRUPT && saved_script == NULL)) {
+        // Called from a plain command line there is nothing left to unwind
+        control.flow = CONTROL_NONE;
+    }
+    
+    control.function_depth--;
+    control.loop_depth = saved_loops;
+    positional.args = saved_args;
+    positional.count = saved_count;
+    running_script = saved_script;
+    script_release(script);
+    return status;
+}
+
+
+
+
+
+
+
+/*
+ - $1..$9, $# and $@ / $* (the arguments joined by spaces)
+ - Returns NULL for a parameter that is not set
+*/
+char* positional_param(VarTable *var_table, const char *name) {
+    if (name[0] == '#') {
+        snprintf(var_table->last_status_text, sizeof(var_table->last_status_text), "%d", positional.count);
+        return var_table->last_status_text;
+    }
+    if (name[0] == '@' || name[0] == '*') {
+        joined_params.len = 0;
+        for (int i = 0; i < positional.count; i++) {
+            if ((i > 0 && text_append(&joined_params, " ", 1) != 0) ||
+                text_append(&joined_params, positional.args[i], strlen(positional.args[i])) != 0) {
+                return NULL;
+            }
+        }
+        if (text_append(&joined_params, "", 1) != 0) {
+            return NULL;
+        }
+        return joined_params.data;
+    }
+    
+    int n = name[0] - '0';
+    return n >= 1 && n <= positional.count ? positional.args[n - 1] : NULL;
+}
+
+
+
+
+
+
+
+/*
+ - break [N], continue [N] and return [N]: set the control state that
+   makes the nodes being run unwind to the loop or function they target
+*/
+int script_control_builtin(char **args, int arg_count, VarTable *var_table) {
+    int n = 1;
+    if (arg_count > 1) {
+        char *end;
+        long value = strtol(args[1], &end, 10);
+        if (end == args[1] || *end != '\0' || (value < 1 && strcmp(args[0], "return") != 0)) {
+            fprintf(stderr, "%s: %s: numeric argument required\n", args[0], args[1]);
+            return strcmp(args[0], "return") == 0 ? 2 : 1;
+        }
+        n = (int)value;
+    }
+    
+    if (strcmp(args[0], "return") == 0) {
+        if (control.function_depth == 0) {
+            fprintf(stderr, "return: can only return from a function\n");
+            return 1;
+        }
+        control.flow = CONTROL_RETURN;
+        return arg_count > 1 ? n & 0xff : var_table->last_status;
+    }
+    
+    if (control.loop_depth == 0) {
+        fprintf(stderr, "%s: only meaningful in a for, while or until loop\n", args[0]);
+        return 0;
+    }
+    control.flow = strcmp(args[0], "break") == 0 ? CONTROL_BREAK : CONTROL_CONTINUE;
+    control.levels = n < control.loop_depth ? n : control.loop_depth;
+    return 0;
+}
+
+
+
+
+
+
+
+/*
+ - Expand words the way a command's arguments are: variables, $(...)
+   and then globs
+ - Returns a new array the caller frees with free_args(), NULL on error
+*/
+static char** expand_words(char **words, int word_count, VarTable *var_table, int *new_count) {
+    int count;
+    char **expanded = substitute_variables(words, word_count, var_table, &count);
+    if (expanded == NULL) {
+        return NULL;
+    }
+    
+#if SHELL_FEATURE_GLOB
+    int glob_count;
+    char **globbed = expand_globs(expanded, count, &glob_count);
+    if (globbed != expanded) {
+        if (expanded != words) {
+            free_args(expanded, count);
+        }
+        if (globbed == NULL) {
+            return NULL;
+        }
+        expanded = globbed;
+        count = glob_count;
+    }
+#endif
+    
+    if (expanded == words) {
+        // Nothing was expanded, copy so the caller always owns the result
+        expanded = malloc((count + 1) * sizeof(char*));
+        if (expanded == NULL) {
+            perror("malloc failed");
+            return NULL;
+        }
+        for (int i = 0; i < count; i++) {
+            expanded[i] = strdup(words[i]);
+            if (expanded[i] == NULL) {
+                perror("strdup failed");
+                free_args(expanded, i);
+                return NULL;
+            }
+        }
+        expanded[count] = NULL;
+    }
+    *new_count = count;
+    return expanded;
+}
+
+
+
+
+
+
+
+// Expand one word (the case subject or a pattern) into a single string
+static char* expand_single(char *word, VarTable *var_table) {
+    char *args[] = { word, NULL };
+    int count;
+    char **expanded = substitute_variables(args, 1, var_table, &count);
+    if (expanded == NULL) {
+        return NULL;
+    }
+    
+    TextBuffer text = { NULL, 0, 0 };
+    int failed = 0;
+    for (int i = 0; i < count && !failed; i++) {
+        failed = (i > 0 && text_append(&text, " ", 1) != 0) ||
+                 text_append(&text, expanded[i], strlen(expanded[i])) != 0;
+    }
+    if (!failed) {
+        failed = text_append(&text, "", 1) != 0;
+    }
+    if (expanded != args) {
+        free_args(expanded, count);
+    }
+    if (failed) {
+        free(text.data);
+        return NULL;
+    }
+    return text.data;
+}
+
+
+
+
+
+
+
+/*
+ - Run a while, until or for loop: its nodes were parsed once, every
+   iteration only expands their words again
+ - Ctrl-C, or a command killed by it, ends every loop being run
+ - Returns the status of the last body run, 0 if it never ran
+*/
+static int run_loop(ScriptNode *node, VarTable *var_table) {
+    char **words = NULL;
+    int word_count = 0;
+    int status = 0;
+    
+    if (node->type == NODE_FOR) {
+        if (node->words != NULL) {
+            words = expand_words(node->words, node->word_count, var_table, &word_count);
+        } else {
+            words = expand_words(positional.args, positional.count, var_table, &word_count);
+        }
+        if (words == NULL) {
+            return 1;
+        }
+    }
+    
+    control.loop_depth++;
+    for (int i = 0; ; i++) {
+#if SHELL_FEATURE_EVENTLOOP
+        if (event_poll_interrupt()) {
+            control.flow = CONTROL_INTERRUPT;
+            break;
+        }
+#endif
+        if (node->type == NODE_FOR) {
+            if (i >= word_count) {
+                break;
+            }
+            add_var(var_table, node->name, words[i]);
+        } else {
+            run_nodes(node->cond, var_table);
+            if (control.flow != CONTROL_NONE) {
+                break;
+            }
+            if ((var_table->last_status == 0) != (node->type == NODE_WHILE)) {
+                break;
+            }
+        }
+    
+        status = run_nodes(node->body, var_table);
+        if (status == 128 + SIGINT && control.flow == CONTROL_NONE) {
+            control.flow = CONTROL_INTERRUPT;
+        }
+        if (control.flow == CONTROL_BREAK || control.flow == CONTROL_CONTINUE) {
+            if (--control.levels > 0) {
+                break;   // an outer loop is the target
+            }
+            ControlFlow flow = control.flow;
+            control.flow = CONTROL_NONE;
+            if (flow == CONTROL_BREAK) {
+                break;
+            }
+        } else if (control.flow != CONTROL_NONE) {
+            break;
+        }
+    }
+    control.loop_depth--;
+    
+    free_args(words, word_count);
+    return status;
+}
+
+
+
+
+
+
+
+// Run the body of the first arm with a pattern matching the word
+static int run_case(ScriptNode *node, VarTable *var_table) {
+    char *subject = expand_single(node->words[0], var_table);
+    if (subject == NULL) {
+        return 1;
+    }
+    
+    int status = 0;
+    for (int i = 0; i < node->arm_count; i++) {
+        CaseArm *arm = &node->arms[i];
+        int matched = 0;
+        for (int j = 0; j < arm->pattern_count && !matched; j++) {
+            char *pattern = expand_single(arm->patterns[j], var_table);
+            if (pattern == NULL) {
+                free(subject);
+                return 1;
+            }
+#if SHELL_FEATURE_GLOB
+            matched = glob_match_word(pattern, subject);
+#else
+            matched = strcmp(pattern, subject) == 0;
+#endif
+            free(pattern);
+        }
+        if (matched) {
+            status = arm->body != NULL ? run_nodes(arm->body, var_table) : 0;
+            break;
+        }
+    }
+    free(subject);
+    return status;
+}
+
+
+
+
+
+
+
+static int run_node(ScriptNode *node, VarTable *var_table) {
+    switch (node->type) {
+    case NODE_COMMAND:
+        return run_command(&node->command, var_table);
+    case NODE_IF:
+        run_nodes(node->cond, var_table);
+        if (control.flow != CONTROL_NONE) {
+            return var_table->last_status;
+        }
+        if (var_table->last_status == 0) {
+            return run_nodes(node->body, var_table);
+        }
+        return node->else_part != NULL ? run_nodes(node->else_part, var_table) : 0;
+    case NODE_WHILE:
+    case NODE_UNTIL:
+    case NODE_FOR:
+        return run_loop(node, var_table);
+    case NODE_CASE:
+        return run_case(node, var_table);
+    case NODE_GROUP:
+        return run_nodes(node->body, var_table);
+    case NODE_FUNCTION:
+        return define_function(node);
+    }
+    return 1;
+}
+
+
+
+
+
+
+
+/*
+ - Run a list of nodes with the rules of run_command_list(), stopping
+   early when break, continue, return or Ctrl-C unwinds
+*/
+static int run_nodes(ScriptNode *node, VarTable *var_table) {
+    ScriptNode *prev = NULL;
+    
+    for (; node != NULL && control.flow == CONTROL_NONE; prev = node, node = node->next) {
+        if (prev != NULL) {
+            if ((prev->next_op == LIST_AND && var_table->last_status != 0) ||
+                (prev->next_op == LIST_OR && var_table->last_status == 0)) {
+                continue;
+            }
+        }
+        var_table->last_status = run_node(node, var_table);
+    }
+    return var_table->last_status;
+}
+
+
+
+
+
+
+
+#if SHELL_FEATURE_REDIR
+// Heredoc bodies follow the whole construct, in the order of the commands
+static int collect_script_heredocs(ScriptNode *node, FILE *in) {
+    for (; node != NULL; node = node->next) {
+        if (node->type == NODE_COMMAND && collect_heredocs(&node->command.redirs, in) != 0) {
+            return -1;
+        }
+        if (collect_script_heredocs(node->cond, in) != 0 ||
+            collect_script_heredocs(node->body, in) != 0 ||
+            collect_script_heredocs(node->else_part, in) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < node->arm_count; i++) {
+            if (collect_script_heredocs(node->arms[i].body, in) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+#endif
+
+
+
+
+
+
+
+/*
+ - Parse and run a line holding compound commands or function definitions
+ - A construct still open at the end of the line is continued with the
+   next lines of "in" (NULL for none), "> " is shown for each on a terminal
+ - The whole text is parsed into a tree before anything runs
+ - Returns the exit status, also stored as $?
+*/
+int execute_script(const char *line, VarTable *var_table, FILE *in) {
+    TextBuffer text = { NULL, 0, 0 };
+    Script *script = NULL;
+    int status = 0;
+    
+    if (text_append(&text, line, strlen(line)) != 0) {
+        var_table->last_status = 1;
+        return 1;
+    }
+    while (1) {
+        int incomplete;
+        if (text_append(&text, "", 1) != 0) {
+            status = 1;
+            break;
+        }
+        text.len--;
+        script = parse_script(text.data, &incomplete);
+        if (script != NULL || !incomplete) {
+            status = script != NULL ? 0 : 2;
+            break;
+        }
+    
+        // Read the next line of the construct
+        char next[MAX_INPUT_SIZE];
+        if (in == NULL) {
+            fprintf(stderr, "syntax error: unexpected end of file\n");
+            status = 2;
+            break;
+        }
+        if (in == stdin && isatty(STDIN_FILENO)) {
+            printf("%s", CONTINUATION_PROMPT);
+            fflush(stdout);
+        }
+#if SHELL_FEATURE_EVENTLOOP
+        if (in == stdin && !event_wait_input(stdin)) {
+            printf("\n");
+            status = 128 + SIGINT;
+            break;
+        }
+#endif
+        if (read_input_line(next, sizeof(next), in) == NULL) {
+            fprintf(stderr, "syntax error: unexpected end of file\n");
+            status = 2;
+            break;
+        }
+        next[strcspn(next, "\n")] = '\0';
+        if (text_append(&text, "\n", 1) != 0 || text_append(&text, next, strlen(next)) != 0) {
+            status = 1;
+            break;
+        }
+    }
+    free(text.data);
+    
+    if (script == NULL) {
+        var_table->last_status = status;
+        return status;
+    }
+    
+#if SHELL_FEATURE_REDIR
+    if (in != NULL && collect_script_heredocs(script->root, in) != 0) {
+        var_table->last_status = 1;
+    } else
+#endif
+    {
+        Script *saved_script = running_script;
+        running_script = script;
+        run_nodes(script->root, var_table);
+        running_script = saved_script;
+    
+        // Whatever unwinding is left stops here, at the prompt
+        if (control.flow == CONTROL_INTERRUPT && var_table->last_status == 0) {
+            var_table->last_status = 128 + SIGINT;
+        }
+        control.flow = CONTROL_NONE;
+    }
+    
+    script_release(script);
+    return var_table->last_status;
+}
+#endif // SHELL_FEATURE_SCRIPT
@@ -0,0 +1,372 @@
+/**
+ * Shell Core - read/execute loop, startup and rc file
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "shellcore.h"
+
+
+
+
+// stdin is read with read(2) into this buffer, so what was read ahead is known without stdio internals
+static struct {
+    char data[INPUT_BUFFER_SIZE];
+    size_t start;                   // next byte to hand out
+    size_t end;                     // bytes read into data
+    int eof;                        // like stdio, end of input stays reached
+} stdin_buffer;
+
+
+
+
+
+/*
+ - fgets() for the shell's input: stdin goes through the buffer above,
+   any other stream (rc file, script file, fuzz input) through stdio
+ - Returns line, NULL at end of input or on a read error
+*/
+char* read_input_line(char *line, int size, FILE *in) {
+    if (in != stdin) {
+        return fgets(line, size, in);
+    }
+    
+    int len = 0;
+    while (len < size - 1) {
+        if (stdin_buffer.start == stdin_buffer.end) {
+            if (stdin_buffer.eof) {
+                break;
+            }
+            ssize_t n = read(STDIN_FILENO, stdin_buffer.data, sizeof(stdin_buffer.data));
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                stdin_buffer.eof = 1;
+                break;
+            }
+            stdin_buffer.start = 0;
+            stdin_buffer.end = n;
+        }
+        char c = stdin_buffer.data[stdin_buffer.start++];
+        line[len++] = c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    line[len] = '\0';
+    return len > 0 ? line : NULL;
+}
+
+
+
+
+
+// Whether a line of stdin was already read ahead, epoll only reports what is still in the kernel
+int input_pending(void) {
+    return stdin_buffer.start < stdin_buffer.end;
+}
+
+
+
+
+#if SHELL_FEATURE_STARTUP
+// Milliseconds between two CLOCK_MONOTONIC/CLOCK_BOOTTIME readings
+static double elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+
+
+
+/*
+ - Time between execve() and main(): the kernel records the process start
+   time in /proc/self/stat (field 22, clock ticks since boot), so it is
+   compared with CLOCK_BOOTTIME. Only as precise as one clock tick.
+ - Returns -1 if /proc is not available
+*/
+static double exec_to_main_ms(const struct timespec *main_boottime) {
+    FILE *fp = fopen("/proc/self/stat", "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    
+    char buf[1024];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+    
+    // The command name may hold spaces, fields are counted after its ')'
+    char *p = strrchr(buf, ')');
+    if (p == NULL) {
+        return -1;
+    }
+    unsigned long long start_ticks = 0;
+    int field = 2;
+    for (char *tok = strtok(p + 1, " "); tok != NULL; tok = strtok(NULL, " ")) {
+        if (++field == 22) {
+            start_ticks = strtoull(tok, NULL, 10);
+            break;
+        }
+    }
+    if (field != 22) {
+        return -1;
+    }
+    
+    double start_ms = start_ticks * 1e3 / sysconf(_SC_CLK_TCK);
+    return main_boottime->tv_sec * 1e3 + main_boottime->tv_nsec / 1e6 - start_ms;
+}
+#endif // SHELL_FEATURE_STARTUP
+
+
+
+
+/*
+ - The whole shell: every front-end's main() is a call to this function
+ - Returns the exit status of the shell
+*/
+int shell_main(int argc, char *argv[]) {
+    char input[MAX_INPUT_SIZE];
+    int status = 1;
+    VarTable var_table;
+    CommandList list = { NULL, 0, 0 };
+    struct timespec t_main, t_boot, t_vars, t_env;
+#if SHELL_FEATURE_STARTUP
+    struct timespec t_loop, t_rc;
+    int profile = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], STARTUP_PROFILE_FLAG) == 0) {
+            profile = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [%s]\n", argv[0], STARTUP_PROFILE_FLAG);
+            return 2;
+        }
+    }
+#else
+    (void)argc;
+    (void)argv;
+    const int profile = 0;
+#endif
+    if (profile) {
+        clock_gettime(CLOCK_MONOTONIC, &t_main);
+        clock_gettime(CLOCK_BOOTTIME, &t_boot);
+    }
+    
+    /*
+     - Startup is kept lazy: the variable table allocates on the first
+       assignment, the environment is only consulted when a $name is not a
+       shell variable, and the command list grows on the first line
+    */
+    init_var_table(&var_table);
+    if (profile) {
+        clock_gettime(CLOCK_MONOTONIC, &t_vars);
+    }
+    
+#if SHELL_FEATURE_STATS
+    char *stats_env = getenv(SHELL_STATS_ENV);
+    stats_ring.enabled = (stats_env != NULL && strcmp(stats_env, "1") == 0);
+#endif
+    if (profile) {
+        clock_gettime(CLOCK_MONOTONIC, &t_env);
+    }
+    
+#if SHELL_FEATURE_EVENTLOOP
+    // Ctrl-C, finished children and resizes arrive through a signalfd
+    event_loop_init();
+#endif
+    
+#if SHELL_FEATURE_STARTUP
+    if (profile) {
+        clock_gettime(CLOCK_MONOTONIC, &t_loop);
+    }
+    
+    // Only interactive shells read the rc file, scripted ones start straight away
+    int rc_loaded = 0;
+    if (isatty(STDIN_FILENO)) {
+        rc_loaded = load_rc_file(&list, &var_table);
+    }
+    if (profile) {
+        clock_gettime(CLOCK_MONOTONIC, &t_rc);
+    }
+#endif
+    
+    
+    
+    
+    
+    while (status) {
+        
+#if SHELL_FEATURE_EVENTLOOP
+        event_report_jobs();
+#endif
+        printf("%s", SHELL_PROMPT);
+        fflush(stdout);
+        
+#if SHELL_FEATURE_STARTUP
+        if (profile) {
+            // Report once, right after the first prompt is out
+            struct timespec t_prompt;
+            clock_gettime(CLOCK_MONOTONIC, &t_prompt);
+            double before_main = exec_to_main_ms(&t_boot);
+            
+            fprintf(stderr, "\nstartup profile:\n");
+            if (before_main >= 0) {
+                fprintf(stderr, "  execve -> main      %9.3f ms (clock tick resolution)\n", before_main);
+            } else {
+                fprintf(stderr, "  execve -> main      unavailable (no /proc)\n");
+            }
+            fprintf(stderr, "  var table init      %9.3f ms (lazy)\n", elapsed_ms(&t_main, &t_vars));
+            fprintf(stderr, "  env import          %9.3f ms (lazy, on first lookup)\n", elapsed_ms(&t_vars, &t_env));
+            fprintf(stderr, "  signals and epoll   %9.3f ms\n", elapsed_ms(&t_env, &t_loop));
+            fprintf(stderr, "  rc file             %9.3f ms (%s)\n", elapsed_ms(&t_loop, &t_rc),
+                    rc_loaded ? "loaded" : "not loaded");
+            fprintf(stderr, "  history             %9.3f ms (no history support)\n", 0.0);
+            fprintf(stderr, "  first prompt        %9.3f ms\n", elapsed_ms(&t_rc, &t_prompt));
+            fprintf(stderr, "  main -> prompt      %9.3f ms\n", elapsed_ms(&t_main, &t_prompt));
+            if (before_main >= 0) {
+                fprintf(stderr, "  execve -> prompt    %9.3f ms\n", before_main + elapsed_ms(&t_main, &t_prompt));
+            }
+            profile = 0;
+        }
+#endif
+        
+        
+#if SHELL_FEATURE_EVENTLOOP
+        // Ctrl-C at the prompt drops the line instead of killing the shell
+        if (!event_wait_input(stdin)) {
+            printf("\n");
+            continue;
+        }
+#endif
+        
+        if (read_input_line(input, MAX_INPUT_SIZE, stdin) == NULL) { // Read input
+            printf("\n%s\n", SHELL_GOODBYE);
+            break;
+        }
+        
+        
+        input[strcspn(input, "\n")] = '\0'; // Remove trailing newline
+        
+        
+        if (strlen(input) == 0) { // Skip empty lines
+            continue;
+        }
+        
+        execute_line(input, &list, &var_table, stdin);
+    }
+    
+#if SHELL_FEATURE_STATUS
+    // End of input exits with the status of the last command, like "exit" alone
+    int exit_code = var_table.last_status & 0xff;
+#else
+    int exit_code = 0;
+#endif
+    
+    // Free variable table and the command list storage
+    free(list.items);
+    free_var_table(&var_table);
+    
+    return exit_code;
+}
+
+
+
+
+
+
+
+/*
+ - Parse and run one input line, heredoc bodies are read from "in"
+ - Returns the exit status of the line, also stored as $?
+*/
+int execute_line(char* line, CommandList *list, VarTable *var_table, FILE *in) {
+#if !SHELL_FEATURE_WORDS
+    // echo prints what follows "echo " untouched, spaces included
+    char *word = line + strspn(line, " ");
+    if (strncmp(word, "echo", 4) == 0 && (word[4] == ' ' || word[4] == '\0')) {
+        printf("%s\n", word[4] == ' ' ? word + 5 : "");
+        var_table->last_status = 0;
+        return 0;
+    }
+#endif
+#if SHELL_FEATURE_SCRIPT
+    // if, for, functions, ... are parsed into a tree and may go on for more lines
+    if (script_needs_parser(line)) {
+        return execute_script(line, var_table, in);
+    }
+#endif
+    
+    // Split the whole line into its commands in one pass
+    if (parse_command_list(line, list) != 0) {
+        var_table->last_status = 2;
+        free_command_list(list);
+        return var_table->last_status;
+    }
+    
+    // Heredoc bodies follow the command line, read them before running anything
+    int heredoc_failed = 0;
+#if SHELL_FEATURE_REDIR
+    for (int i = 0; i < list->count && !heredoc_failed; i++) {
+        heredoc_failed = collect_heredocs(&list->items[i].redirs, in) != 0;
+    }
+#else
+    (void)in;
+#endif
+    
+    if (heredoc_failed) {
+        var_table->last_status = 1;
+    } else {
+        run_command_list(list, var_table);
+    }
+    
+    free_command_list(list);
+    return var_table->last_status;
+}
+
+
+
+
+
+
+
+#if SHELL_FEATURE_STARTUP
+/*
+ - Run the rc file in $HOME line by line, as if typed at the prompt
+ - Returns 1 if the file was found and read, 0 otherwise
+*/
+int load_rc_file(CommandList *list, VarTable *var_table) {
+    char *home = getenv("HOME");
+    if (home == NULL) {
+        return 0;
+    }
+    
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", home, SHELL_RC_FILE);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    
+    char line[MAX_INPUT_SIZE];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        execute_line(line, list, var_table, fp);
+    }
+    
+    fclose(fp);
+    return 1;
+}
+#endif // SHELL_FEATURE_STARTUP
@@ -0,0 +1,454 @@
+/**
+ * Shell Core - parser, built-ins, variables and process handling shared by
+ * the Femto, Pico, Nano and Micro shells
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ *
+ * Every shell directory holds a shell_config.h that sets its prompt and the
+ * SHELL_FEATURE_* macros below. The core is compiled once per shell with that
+ * directory on the include path, so a feature that is switched off is not
+ * compiled at all and costs nothing in size or speed.
+ */
+
+#ifndef SHELLCORE_H
+#define SHELLCORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "shell_config.h"
+
+/***
+ *** Features, everything is off unless shell_config.h turns it on
+ ***/
+#ifndef SHELL_FEATURE_WORDS
+#define SHELL_FEATURE_WORDS 0      // echo prints its words, without it the rest of the line as typed
+#endif
+#ifndef SHELL_FEATURE_STATUS
+#define SHELL_FEATURE_STATUS 0     // exit and end of input return the last status, without it 0
+#endif
+#ifndef SHELL_FEATURE_DIRS
+#define SHELL_FEATURE_DIRS 0       // pwd and cd built-ins
+#endif
+#ifndef SHELL_FEATURE_EXTERNAL
+#define SHELL_FEATURE_EXTERNAL 0   // fork/exec of programs found in PATH
+#endif
+#ifndef SHELL_FEATURE_VARS
+#define SHELL_FEATURE_VARS 0       // name=value, $name, $? and export
+#endif
+#ifndef SHELL_FEATURE_REDIR
+#define SHELL_FEATURE_REDIR 0      // <, >, >>, 2>&1, <<<, << ...
+#endif
+#ifndef SHELL_FEATURE_LISTS
+#define SHELL_FEATURE_LISTS 0      // ;, && and ||
+#endif
+#ifndef SHELL_FEATURE_STATS
+#define SHELL_FEATURE_STATS 0      // time prefix and stats built-in
+#endif
+#ifndef SHELL_FEATURE_STARTUP
+#define SHELL_FEATURE_STARTUP 0    // rc file and --startup-profile
+#endif
+#ifndef SHELL_FEATURE_EVENTLOOP
+#define SHELL_FEATURE_EVENTLOOP 0  // epoll/signalfd loop, "&" jobs and wait, own process groups
+#endif
+#ifndef SHELL_FEATURE_LIMITS
+#define SHELL_FEATURE_LIMITS 0     // timeout prefix and ulimit, needs the event loop
+#endif
+#if SHELL_FEATURE_LIMITS && !SHELL_FEATURE_EVENTLOOP
+#error "SHELL_FEATURE_LIMITS needs SHELL_FEATURE_EVENTLOOP for its timers"
+#endif
+#ifndef SHELL_FEATURE_GLOB
+#define SHELL_FEATURE_GLOB 0       // *, ? and [...] pathname expansion
+#endif
+#ifndef SHELL_FEATURE_SUBST
+#define SHELL_FEATURE_SUBST 0      // $(command) and `command` substitution
+#endif
+#if SHELL_FEATURE_SUBST && !(SHELL_FEATURE_VARS && SHELL_FEATURE_EXTERNAL)
+#error "SHELL_FEATURE_SUBST needs SHELL_FEATURE_VARS and SHELL_FEATURE_EXTERNAL"
+#endif
+#ifndef SHELL_FEATURE_CGROUP
+#define SHELL_FEATURE_CGROUP 0     // sandbox built-in, a cgroup v2 leaf per command, needs the event loop
+#endif
+#if SHELL_FEATURE_CGROUP && !SHELL_FEATURE_EVENTLOOP
+#error "SHELL_FEATURE_CGROUP needs SHELL_FEATURE_EVENTLOOP, leaves are released with their job"
+#endif
+#if SHELL_FEATURE_CGROUP && !defined(SHELL_CGROUP_ENV)
+#error "shell_config.h must define SHELL_CGROUP_ENV when SHELL_FEATURE_CGROUP is on"
+#endif
+#ifndef SHELL_FEATURE_SCRIPT
+#define SHELL_FEATURE_SCRIPT 0     // if, while, until, for, case, { } and name() functions
+#endif
+#if SHELL_FEATURE_SCRIPT && !SHELL_FEATURE_VARS
+#error "SHELL_FEATURE_SCRIPT needs SHELL_FEATURE_VARS for for-loops and $1"
+#endif
+#ifndef SHELL_FEATURE_ARITH
+#define SHELL_FEATURE_ARITH 0      // $((expr)), ((expr)) and let over 64-bit integers
+#endif
+#if SHELL_FEATURE_ARITH && !SHELL_FEATURE_SUBST
+#error "SHELL_FEATURE_ARITH needs SHELL_FEATURE_SUBST, $((...)) is scanned like $(...)"
+#endif
+#ifndef SHELL_FEATURE_ALIAS
+#define SHELL_FEATURE_ALIAS 0      // alias and unalias built-ins
+#endif
+
+#ifndef SHELL_PROMPT
+#error "shell_config.h must define SHELL_PROMPT"
+#endif
+#ifndef SHELL_GOODBYE
+#define SHELL_GOODBYE "Good Bye"
+#endif
+
+#define MAX_INPUT_SIZE 1024
+#define INPUT_BUFFER_SIZE 4096     // stdin read ahead per read(2), as much as stdio read from a pipe
+#define INITIAL_VAR_CAPACITY 10
+#define INITIAL_REDIR_CAPACITY 4
+#define HEREDOC_PROMPT "> "
+#define CONTINUATION_PROMPT "> "      // shown while an if, for, ... is still open
+#define STATS_RING_SIZE 256          // must stay a power of two
+#define STATS_COMMAND_LEN 64
+#define STARTUP_PROFILE_FLAG "--startup-profile"
+#define INITIAL_JOB_CAPACITY 4
+#define EVENT_BATCH 8                // epoll events handled per wakeup
+
+struct ShellFunction;   // defined in script.c
+
+// Structure to store shell variables
+typedef struct {
+    char *name;
+    char *value;
+} ShellVar;
+
+
+
+
+//structure to with pointer to shell variables and count and capacity
+typedef struct {
+    ShellVar *vars;
+    int count;
+    int capacity;
+    int last_status;            // exit status of the last command, read as $?
+    int last_background;        // pid of the last "&" command, read as $!
+    int substitutions;          // command substitutions run so far, "x=$(false)" returns their status
+    char last_status_text[12];  // storage handed out by get_var_value("?") and ("!")
+} VarTable;
+
+
+
+//structure to with pointer to text and length and capacity
+typedef struct {
+    char *data;                 // not '\0' terminated
+    size_t len;
+    size_t capacity;
+} TextBuffer;
+
+
+
+// Kinds of redirection understood by parse_input()
+typedef enum {
+    REDIR_INPUT,       // N< file
+    REDIR_OUTPUT,      // N> file  (truncates)
+    REDIR_APPEND,      // N>> file
+    REDIR_DUP,         // N>&M, N<&M and N>&- (close)
+    REDIR_HERESTRING,  // N<<< word
+    REDIR_HEREDOC      // N<< DELIM, body read from the following lines
+} RedirType;
+
+
+
+// One redirection, applied in the order it appeared on the command line
+typedef struct {
+    RedirType type;
+    int fd;          // descriptor being redirected
+    int src_fd;      // source descriptor for REDIR_DUP, -1 means close fd
+    char *target;    // file name, here-string word or heredoc delimiter/body
+} Redirection;
+
+
+
+//structure to with pointer to redirections and count and capacity
+typedef struct {
+    Redirection *items;
+    int count;
+    int capacity;
+} RedirList;
+
+
+
+// Resource usage of one finished command, fixed size so it fits the ring
+typedef struct {
+    struct timespec started;        // wall clock time the command was launched
+    double wall_ms;
+    double user_ms;
+    double sys_ms;
+    double exec_latency_ms;         // fork() to successful exec, 0 for built-ins
+    long max_rss_kb;
+    long voluntary_ctxsw;
+    long involuntary_ctxsw;
+    int exit_status;
+    int builtin;
+    char command[STATS_COMMAND_LEN];
+} CmdStats;
+
+
+
+// How a command is chained to the one after it
+typedef enum {
+    LIST_END,   // last command of the line
+    LIST_SEQ,   // ;   always run the next command
+    LIST_AND,   // &&  run the next command only on success
+    LIST_OR,    // ||  run the next command only on failure
+    LIST_BG     // &   run this command in the background, go on at once
+} ListOp;
+
+
+
+// One command of a ";", "&&", "||", "&" list, parsed once before anything runs
+typedef struct {
+    char *assignment;   // "name=value" text inside the line, args is NULL then
+    char *arithmetic;   // "((expr))" text inside the line, args is NULL then
+    char **args;
+    int arg_count;
+    RedirList redirs;
+    ListOp next_op;
+} ListCommand;
+
+
+
+//structure to with pointer to list commands and count and capacity
+typedef struct {
+    ListCommand *items;
+    int count;
+    int capacity;
+} CommandList;
+
+
+
+// One name of a NameTable, name NULL marks a free slot
+typedef struct {
+    char *name;
+    uint32_t hash;              // name_hash(name)
+    void *value;
+} NameEntry;
+
+
+
+//structure to with pointer to name entries and count and capacity
+typedef struct {
+    NameEntry *items;           // open addressing, capacity is a power of two
+    int count;
+    int capacity;
+} NameTable;
+
+
+
+typedef int (*BuiltinHandler)(char **args, int arg_count, VarTable *var_table);
+
+// What a command name resolved to
+typedef enum {
+    COMMAND_EXTERNAL,
+    COMMAND_BUILTIN,
+    COMMAND_FUNCTION
+} CommandKind;
+
+
+
+// Result of resolve_command(), looked up once before the command runs
+typedef struct {
+    CommandKind kind;
+    BuiltinHandler builtin;             // COMMAND_BUILTIN
+    struct ShellFunction *function;     // COMMAND_FUNCTION
+    const char *path;                   // COMMAND_EXTERNAL: cached location, NULL leaves the search to execvp()
+} CommandTarget;
+
+
+
+// Ring of the most recent CmdStats, oldest records are overwritten
+typedef struct {
+    CmdStats records[STATS_RING_SIZE];
+    unsigned long total;            // records ever pushed, next slot is total % size
+    int enabled;
+} StatsRing;
+
+
+
+// Wall clock limit of one command, set by the "timeout" prefix
+typedef struct {
+    struct timespec duration;
+    struct timespec kill_after;     // SIGKILL this long after the first signal, 0 for never
+    int signal;                     // sent first, SIGTERM unless -s says otherwise
+} CmdTimeout;
+
+
+
+// cgroup v2 leaf a sandboxed command runs in
+typedef struct {
+    int dirfd;                      // -1 when the command is not sandboxed
+    unsigned long id;               // the leaf is <subtree>/cmd.<id>
+    char *path;                     // of the leaf, kept for its removal after "sandbox off"
+} CmdCgroup;
+
+
+
+// A child started by execute_external(), tracked until it has been reaped
+typedef struct {
+    pid_t pid;
+    pid_t pgid;                     // every job is the leader of its own process group
+    int pidfd;                      // readable once the child exits, -1 before Linux 5.3
+    int timerfd;                    // timeout timer, -1 without a time limit
+    int timeout_stage;              // 0 running, 1 first signal sent, 2 SIGKILL sent
+    struct timespec kill_after;
+    int timeout_signal;
+    int background;                 // started with "&" or stopped with Ctrl-Z
+    int done;
+    int stopped;
+    int status;                     // raw wait status once done or stopped
+    struct rusage usage;
+    CmdCgroup cgroup;               // released (stats reported, leaf removed) with the job
+    char command[STATS_COMMAND_LEN];
+} Job;
+
+
+
+//structure to with pointer to jobs and count and capacity
+typedef struct {
+    Job *items;
+    int count;
+    int capacity;
+} JobTable;
+
+
+
+/*
+ - State of the epoll loop: stdin, a signalfd for SIGINT/SIGCHLD/SIGWINCH
+   and the pidfd of every live job are watched by one epoll instance
+*/
+typedef struct {
+    int epfd;
+    int sigfd;
+    int stdin_pollable;             // 0 when stdin is a regular file, epoll refuses those
+    int interactive;                // stdin is our controlling terminal, jobs get the terminal
+    pid_t shell_pgid;
+    sigset_t handled;               // blocked and read from sigfd instead
+    JobTable jobs;
+} EventLoop;
+
+
+
+
+
+/***
+ *** function prototypes
+ ***/
+
+// shell.c - the read/execute loop every front-end calls from main()
+int shell_main(int argc, char *argv[]);
+int execute_line(char* line, CommandList *list, VarTable *var_table, FILE *in);
+int load_rc_file(CommandList *list, VarTable *var_table);
+char* read_input_line(char *line, int size, FILE *in);
+int input_pending(void);
+
+// parse.c
+int parse_command_list(char* line, CommandList *list);
+int parse_simple_command(char *text, ListCommand *cmd);
+const char* skip_substitution(const char *p);
+void free_command_list(CommandList *list);
+char** parse_input(char* input, int* arg_count, RedirList *redirs);
+void free_args(char** args, int arg_count);
+
+// exec.c
+int run_command_list(CommandList *list, VarTable *var_table);
+int run_command(ListCommand *cmd, VarTable *var_table);
+int execute_external(char** args, const char *path, VarTable *var_table, RedirList *redirs,
+                     CmdStats *measure, int background, const CmdTimeout *timeout);
+int command_substitution(const char *text, size_t len, VarTable *var_table, TextBuffer *out);
+
+// builtins.c
+BuiltinHandler lookup_builtin(const char *name, uint32_t hash);
+int execute_builtin_redirected(const CommandTarget *target, char** args, int arg_count,
+                               VarTable *var_table, RedirList *redirs);
+
+// commands.c
+uint32_t name_hash(const char *name);
+NameEntry* name_table_find(const NameTable *table, const char *name, uint32_t hash);
+NameEntry* name_table_insert(NameTable *table, const char *name, uint32_t hash);
+void name_table_remove(NameTable *table, NameEntry *entry);
+int alias_builtin(char **args, int arg_count);
+int unalias_builtin(char **args, int arg_count);
+int expand_alias(char ***args, int *arg_count);
+int hash_builtin(char **args, int arg_count);
+void resolve_command(const char *name, int in_shell, CommandTarget *target);
+
+// vartable.c
+void init_var_table(VarTable *var_table);
+void free_var_table(VarTable *var_table);
+int handle_assignment(char* input, VarTable *var_table);
+void add_var(VarTable *var_table, const char *name, const char *value);
+char* get_var_value(VarTable *var_table, const char *name);
+char** substitute_variables(char** args, int arg_count, VarTable *var_table, int *new_count);
+int is_valid_var_name(const char *name);
+int export_var(VarTable *var_table, const char *name);
+int text_reserve(TextBuffer *text, size_t extra);
+int text_append(TextBuffer *text, const char *data, size_t len);
+char* expand_string(const char *text, size_t len, VarTable *var_table);
+
+// redirect.c
+void init_redir_list(RedirList *redirs);
+int add_redirection(RedirList *redirs, RedirType type, int fd, int src_fd, const char *target);
+void free_redir_list(RedirList *redirs);
+int collect_heredocs(RedirList *redirs, FILE *in);
+int apply_redirections(RedirList *redirs);
+
+// stats.c
+extern StatsRing stats_ring;
+void stats_push(const CmdStats *record);
+void print_time_report(const CmdStats *record);
+int stats_builtin(char** args, int arg_count);
+
+// eventloop.c
+extern EventLoop event_loop;
+int event_loop_init(void);
+void event_loop_close(void);
+void event_loop_subshell(void);
+int event_wait_input(FILE *in);
+int event_poll_interrupt(void);
+void event_child_setup(int background);
+Job* event_track_child(pid_t pid, int pidfd, char **args, int background, const CmdTimeout *timeout);
+int event_wait_job(Job *job);
+int event_wait_background(pid_t pid);
+void event_report_jobs(void);
+void event_remove_job(Job *job);
+
+// limits.c
+int parse_timeout_prefix(char **args, int arg_count, CmdTimeout *timeout);
+int ulimit_builtin(char **args, int arg_count);
+int apply_child_limits(void);
+
+// glob.c
+char** expand_globs(char** args, int arg_count, int *new_count);
+int glob_match_word(const char *pattern, const char *word);
+
+// arith.c
+int arith_expand(const char *text, size_t len, VarTable *var_table, int64_t *value);
+int arith_command(const char *text, VarTable *var_table);
+int let_builtin(char **args, int arg_count, VarTable *var_table);
+
+// cgroup.c
+int sandbox_builtin(char **args, int arg_count);
+int cgroup_create_leaf(CmdCgroup *cg);
+int cgroup_join(const CmdCgroup *cg);
+void cgroup_release(CmdCgroup *cg);
+void cgroup_close(void);
+
+// script.c
+int script_needs_parser(const char *line);
+int execute_script(const char *line, VarTable *var_table, FILE *in);
+struct ShellFunction* lookup_function(const char *name, uint32_t hash);
+int call_function(struct ShellFunction *fn, char **args, int arg_count, VarTable *var_table);
+int script_control_builtin(char **args, int arg_count, VarTable *var_table);
+char* positional_param(VarTable *var_table, const char *name);
+
+#endif // SHELLCORE_H
@@ -0,0 +1,135 @@
+/**
+ * Shell Core - time prefix and the stats built-in
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "shellcore.h"
+
+
+
+
+#if SHELL_FEATURE_STATS
+// Per-command statistics, only filled while "stats on" or a "time" prefix is active
+StatsRing stats_ring;
+
+
+
+
+
+
+
+// Store a finished command in the ring, overwriting the oldest record when full
+void stats_push(const CmdStats *record) {
+    stats_ring.records[stats_ring.total & (STATS_RING_SIZE - 1)] = *record;
+    stats_ring.total++;
+}
+
+
+
+
+
+
+
+// Report for the "time" prefix, same layout as sh plus the extra counters
+void print_time_report(const CmdStats *record) {
+    fprintf(stderr, "\nreal\t%dm%.3fs\n", (int)(record->wall_ms / 60000), (record->wall_ms / 1000) - 60 * (int)(record->wall_ms / 60000));
+    fprintf(stderr, "user\t%dm%.3fs\n", (int)(record->user_ms / 60000), (record->user_ms / 1000) - 60 * (int)(record->user_ms / 60000));
+    fprintf(stderr, "sys\t%dm%.3fs\n", (int)(record->sys_ms / 60000), (record->sys_ms / 1000) - 60 * (int)(record->sys_ms / 60000));
+    fprintf(stderr, "maxrss\t%ldKB\n", record->max_rss_kb);
+    fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n", record->voluntary_ctxsw, record->involuntary_ctxsw);
+    if (!record->builtin) {
+        fprintf(stderr, "exec\t%.3fms after fork\n", record->exec_latency_ms);
+    }
+}
+
+
+
+
+
+
+
+// Write a string as a JSON string literal
+static void json_print_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+
+
+
+
+
+
+/*
+ - stats on|off   : start or stop recording every command
+ - stats          : one line per recorded command, oldest first
+ - stats json     : the same records as a JSON array (redirect it to a file)
+ - stats clear    : forget everything recorded so far
+*/
+int stats_builtin(char** args, int arg_count) {
+    const char *mode = arg_count > 1 ? args[1] : "show";
+    
+    if (strcmp(mode, "on") == 0) {
+        stats_ring.enabled = 1;
+        return 0;
+    }
+    if (strcmp(mode, "off") == 0) {
+        stats_ring.enabled = 0;
+        return 0;
+    }
+    if (strcmp(mode, "clear") == 0) {
+        stats_ring.total = 0;
+        return 0;
+    }
+    
+    int json = strcmp(mode, "json") == 0;
+    if (!json && strcmp(mode, "show") != 0) {
+        fprintf(stderr, "stats: usage: stats [on|off|show|json|clear]\n");
+        return 2;
+    }
+    
+    unsigned long first = stats_ring.total > STATS_RING_SIZE ? stats_ring.total - STATS_RING_SIZE : 0;
+    if (json) {
+        printf("[");
+    }
+    for (unsigned long n = first; n < stats_ring.total; n++) {
+        const CmdStats *r = &stats_ring.records[n & (STATS_RING_SIZE - 1)];
+        if (json) {
+            printf("%s\n  {\"command\": ", n == first ? "" : ",");
+            json_print_string(stdout, r->command);
+            printf(", \"started\": %ld.%06ld, \"builtin\": %s, \"exit_status\": %d, "
+                   "\"wall_ms\": %.3f, \"user_ms\": %.3f, \"sys_ms\": %.3f, "
+                   "\"exec_latency_ms\": %.3f, \"max_rss_kb\": %ld, "
+                   "\"voluntary_ctxsw\": %ld, \"involuntary_ctxsw\": %ld}",
+                   (long)r->started.tv_sec, r->started.tv_nsec / 1000, r->builtin ? "true" : "false",
+                   r->exit_status, r->wall_ms, r->user_ms, r->sys_ms, r->exec_latency_ms,
+                   r->max_rss_kb, r->voluntary_ctxsw, r->involuntary_ctxsw);
+        } else {
+            printf("%5lu  %9.3fms wall %8.3fms user %8.3fms sys %7ldKB rss  %s\n",
+                   n + 1, r->wall_ms, r->user_ms, r->sys_ms, r->max_rss_kb, r->command);
+        }
+    }
+    if (json) {
+        printf("%s]\n", stats_ring.total > first ? "\n" : "");
+    }
+    return 0;
+}
+#endif // SHELL_FEATURE_STATS
@@ -0,0 +1,550 @@
+/**
+ * Shell Core - shell variables and $name expansion
+ * Author: Ahmed Wagdy
+ * Date: 20/3/2025
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "shellcore.h"
+
+
+
+
+// Initialize variable table, storage is allocated by the first add_var()
+void init_var_table(VarTable *var_table) {
+    var_table->vars = NULL;
+    var_table->count = 0;
+    var_table->capacity = 0;
+    var_table->last_status = 0;
+    var_table->last_background = 0;
+    var_table->substitutions = 0;
+}
+
+
+
+
+
+
+
+// Free variable table
+void free_var_table(VarTable *var_table) {
+    for (int i = 0; i < var_table->count; i++) {
+        free(var_table->vars[i].name);
+        free(var_table->vars[i].value);
+    }
+    free(var_table->vars);
+}
+
+
+
+
+
+
+
+#if SHELL_FEATURE_VARS
+// Add or update a variable in the table
+void add_var(VarTable *var_table, const char *name, const char *value) {
+    // Check if variable already exists
+    for (int i = 0; i < var_table->count; i++) {
+        if (strcmp(var_table->vars[i].name, name) == 0) {
+            // Update existing variable
+            free(var_table->vars[i].value);
+            var_table->vars[i].value = strdup(value);
+            return;
+        }
+    }
+    
+
+    // Allocate on first use, resize array if needed
+    if (var_table->count >= var_table->capacity) {
+        int new_capacity = var_table->capacity ? var_table->capacity * 2 : INITIAL_VAR_CAPACITY;
+        ShellVar *new_vars = realloc(var_table->vars, new_capacity * sizeof(ShellVar));
+        if (new_vars == NULL) {
+            perror("realloc failed");
+            return;
+        }
+        var_table->vars = new_vars;
+        var_table->capacity = new_capacity;
+    }
+    
+    // Add new variable
+    var_table->vars[var_table->count].name = strdup(name);
+    var_table->vars[var_table->count].value = strdup(value);
+    var_table->count++;
+}
+
+
+
+
+
+
+// Get value of a variable
+char* get_var_value(VarTable *var_table, const char *name) {
+#if SHELL_FEATURE_SCRIPT
+    // $1..$9, $#, $@ and $* belong to the function being run
+    if (name[1] == '\0' && ((name[0] >= '1' && name[0] <= '9') || name[0] == '#' ||
+                            name[0] == '@' || name[0] == '*')) {
+        return positional_param(var_table, name);
+    }
+#endif
+    // $? is kept as a number and only formatted when it is read
+    if (name[0] == '?' && name[1] == '\0') {
+        snprintf(var_table->last_status_text, sizeof(var_table->last_status_text), "%d", var_table->last_status);
+        return var_table->last_status_text;
+    }
+    if (name[0] == '!' && name[1] == '\0') {
+        if (var_table->last_background == 0) {
+            return NULL;
+        }
+        snprintf(var_table->last_status_text, sizeof(var_table->last_status_text), "%d", var_table->last_background);
+        return var_table->last_status_text;
+    }
+    
+    for (int i = 0; i < var_table->count; i++) {
+        if (strcmp(var_table->vars[i].name, name) == 0) {
+            return var_table->vars[i].value;
+        }
+    }
+    
+    // Environment import is lazy: fall back to the inherited environment
+    return getenv(name);
+}
+
+
+
+
+
+
+
+// Check if variable name is valid (alphanumeric and underscore)
+int is_valid_var_name(const char *name) {
+    if (!isalpha(name[0]) && name[0] != '_') {
+        return 0;
+    }
+    
+    for (int i = 1; name[i] != '\0'; i++) {
+        if (!isalnum(name[i]) && name[i] != '_') {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+
+
+
+
+
+
+// Make room for extra more bytes, the buffer doubles so appends stay cheap
+int text_reserve(TextBuffer *text, size_t extra) {
+    if (text->len + extra <= text->capacity) {
+        return 0;
+    }
+    size_t new_capacity = text->capacity ? text->capacity * 2 : 64;
+    while (new_capacity < text->len + extra) {
+        new_capacity *= 2;
+    }
+    char *new_data = realloc(text->data, new_capacity);
+    if (new_data == NULL) {
+        perror("realloc failed");
+        return -1;
+    }
+    text->data = new_data;
+    text->capacity = new_capacity;
+    return 0;
+}
+
+
+
+
+
+
+
+int text_append(TextBuffer *text, const char *data, size_t len) {
+    if (text_reserve(text, len) != 0) {
+        return -1;
+    }
+    memcpy(text->data + text->len, data, len);
+    text->len += len;
+    return 0;
+}
+
+
+
+
+
+
+
+//structure to with pointer to expanded words and count and capacity
+typedef struct {
+    char **items;
+    int count;
+    int capacity;
+} WordList;
+
+
+
+
+
+
+
+// Move the word collected in text to the list, text is emptied for the next one
+static int push_word(WordList *words, TextBuffer *text) {
+    if (words->count + 1 >= words->capacity) {
+        int new_capacity = words->capacity ? words->capacity * 2 : 8;
+        char **new_items = realloc(words->items, new_capacity * sizeof(char*));
+        if (new_items == NULL) {
+            perror("realloc failed");
+            return -1;
+        }
+        words->items = new_items;
+        words->capacity = new_capacity;
+    }
+    words->items[words->count] = strndup(text->data != NULL ? text->data : "", text->len);
+    if (words->items[words->count] == NULL) {
+        perror("strndup failed");
+        return -1;
+    }
+    words->count++;
+    text->len = 0;
+    return 0;
+}
+
+
+
+
+
+
+
+// $? and $! (and $1..$9, $#, $@, $* in functions) are one character names
+static int is_special_param(char c) {
+#if SHELL_FEATURE_SCRIPT
+    if ((c >= '1' && c <= '9') || c == '#' || c == '@' || c == '*') {
+        return 1;
+    }
+#endif
+    return c == '?' || c == '!';
+}
+
+
+
+
+
+
+
+#if SHELL_FEATURE_SUBST || SHELL_FEATURE_SCRIPT
+/*
+ - Append data to text, but with words not NULL split it at spaces, tabs
+   and newlines: every finished word goes to words, text keeps the last
+ - Returns 0, -1 on error
+*/
+static int append_fields(TextBuffer *text, WordList *words, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (words != NULL && (c == ' ' || c == '\t' || c == '\n')) {
+            if (text->len > 0 && push_word(words, text) != 0) {
+                return -1;
+            }
+        } else if (text_append(text, &c, 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+
+
+
+
+
+
+/*
+ - Expand $name, $?, $! and (with SHELL_FEATURE_SUBST) $(command) and
+   `command` in word, appending the result to text, $((expr)) needs
+   SHELL_FEATURE_ARITH
+ - With words not NULL the output of a command substitution (and $@, $*)
+   is split at spaces, tabs and newlines like sh does outside quotes:
+   every finished word goes to words and text keeps the last, unfinished one
+ - A '$' that starts no name is kept as it is
+ - Returns 0, -1 on error
+*/
+static int expand_word(const char *word, VarTable *var_table, TextBuffer *text, WordList *words) {
+    const char *p = word;
+    
+#if !SHELL_FEATURE_SUBST && !SHELL_FEATURE_SCRIPT
+    (void)words;   // only command substitution output and $@ are split
+#endif
+    while (*p) {
+#if SHELL_FEATURE_SUBST
+        const char *end = NULL;
+        if (*p == '`' || (p[0] == '$' && p[1] == '(')) {
+            end = skip_substitution(p);
+        }
+#if SHELL_FEATURE_ARITH
+        if (end != NULL && p[0] == '$' && p[2] == '(') {
+            // $((expr)) is evaluated in the shell, "((expr))" is one expression
+            int64_t value;
+            char digits[24];
+            if (arith_expand(p + 1, end - p - 1, var_table, &value) != 0) {
+                return -1;
+            }
+            int len = snprintf(digits, sizeof(digits), "%" PRId64, value);
+            if (text_append(text, digits, len) != 0) {
+                return -1;
+            }
+            p = end;
+            continue;
+        }
+#endif
+        if (end != NULL) {
+            // $(cmd) is cut at both parentheses, `cmd` at both backticks
+            const char *inner = p + (*p == '`' ? 1 : 2);
+            TextBuffer output = { NULL, 0, 0 };
+            command_substitution(inner, end - 1 - inner, var_table, &output);
+            
+            int failed = append_fields(text, words, output.data, output.len) != 0;
+            free(output.data);
+            if (failed) {
+                return -1;
+            }
+            p = end;
+            continue;
+        }
+#endif
+        
+        if (*p != '$' || !(is_special_param(p[1]) || isalpha((unsigned char)p[1]) || p[1] == '_')) {
+            if (text_append(text, p, 1) != 0) {
+                return -1;
+            }
+            p++;
+            continue;
+        }
+        
+        // Extract variable name, special parameters are a single character
+        const char *name = p + 1;
+        const char *name_end = name + 1;
+        if (!is_special_param(*name)) {
+            while (isalnum((unsigned char)*name_end) || *name_end == '_') {
+                name_end++;
+            }
+        }
+        
+        char name_buf[256];
+        snprintf(name_buf, sizeof(name_buf), "%.*s", (int)(name_end - name), name);
+        char *value = get_var_value(var_table, name_buf);
+#if SHELL_FEATURE_SCRIPT
+        if (value != NULL && (*name == '@' || *name == '*')) {
+            if (append_fields(text, words, value, strlen(value)) != 0) {
+                return -1;
+            }
+            value = NULL;
+        }
+#endif
+        if (value != NULL && text_append(text, value, strlen(value)) != 0) {
+            return -1;
+        }
+        p = name_end;
+    }
+    return 0;
+}
+
+
+
+
+
+
+
+#if SHELL_FEATURE_ARITH
+/*
+ - Expand $name, $(...) and $((...)) in the first len bytes of text as one
+   word that is never split, for the expression of $((...)) and ((...))
+ - Returns a new string the caller frees, NULL on error
+*/
+char* expand_string(const char *text, size_t len, VarTable *var_table) {
+    char *word = strndup(text, len);
+    if (word == NULL) {
+        perror("strndup failed");
+        return NULL;
+    }
+    if (strpbrk(word, "$`") == NULL) {
+        return word;
+    }
+    
+    TextBuffer expanded = { NULL, 0, 0 };
+    int failed = expand_word(word, var_table, &expanded, NULL) != 0 || text_append(&expanded, "", 1) != 0;
+    free(word);
+    if (failed) {
+        free(expanded.data);
+        return NULL;
+    }
+    return expanded.data;
+}
+#endif
+
+
+
+
+
+
+
+// Handle variable assignment
+int handle_assignment(char* input, VarTable *var_table) {
+    char *equals_pos = strchr(input, '=');
+    if (equals_pos == NULL) {
+        return 0;
+    }
+    
+    // Check if there's any command after the assignment
+    char *space_pos = strchr(input, ' ');
+    if (space_pos != NULL && space_pos < equals_pos) {
+        return 0;  // Space before equals sign
+    }
+    
+#if SHELL_FEATURE_SUBST
+    // Spaces inside x=$(cmd args) are part of the value
+    const char *p = equals_pos + 1;
+    while (*p && *p != ' ') {
+        const char *end = NULL;
+        if (*p == '`' || (p[0] == '$' && p[1] == '(')) {
+            end = skip_substitution(p);
+        }
+        p = end != NULL ? end : p + 1;
+    }
+    space_pos = *p == ' ' ? (char *)p : NULL;
+#endif
+    if (space_pos != NULL) {
+        return 0;  // Command after assignment
+    }
+    
+    // Extract variable name and value
+    int name_len = equals_pos - input;
+    char *name = malloc(name_len + 1);
+    if (name == NULL) {
+        perror("malloc failed");
+        return 0;
+    }
+    
+    strncpy(name, input, name_len);
+    name[name_len] = '\0';
+    
+    // Check if variable name is valid
+    if (!is_valid_var_name(name)) {
+        free(name);
+        return 0;
+    }
+    
+    // The value is expanded once, now, and never split into words
+    TextBuffer value = { NULL, 0, 0 };
+    if (expand_word(equals_pos + 1, var_table, &value, NULL) != 0 || text_append(&value, "", 1) != 0) {
+        free(value.data);
+        free(name);
+        return 0;
+    }
+    
+    // Add variable to table
+    add_var(var_table, name, value.data);
+    free(value.data);
+    free(name);
+    
+    return 1;
+}
+
+
+
+
+
+
+
+// Export variable to environment
+int export_var(VarTable *var_table, const char *name) {
+    char *value = get_var_value(var_table, name);
+    if (value == NULL) {
+        return 0;
+    }
+    
+    // setenv() keeps its own copy, nothing to free or leak here
+    if (setenv(name, value, 1) != 0) {
+        perror("setenv failed");
+        return 0;
+    }
+    return 1;
+}
+
+
+
+
+
+
+
+/*
+ - Expand every argument with expand_word(), arguments without '$' or '`'
+   are copied as they are
+ - A command substitution may turn one argument into several or none, so
+   *new_count can differ from arg_count
+ - Returns args itself when there is nothing to expand, otherwise a new
+   NULL terminated array the caller frees with free_args(), NULL on error
+*/
+char** substitute_variables(char** args, int arg_count, VarTable *var_table, int *new_count) {
+    int has_substitution = 0;
+    
+    // Check if any argument contains a variable
+    for (int i = 0; i < arg_count; i++) {
+        if (strpbrk(args[i], SHELL_FEATURE_SUBST ? "$`" : "$") != NULL) {
+            has_substitution = 1;
+            break;
+        }
+    }
+    
+    if (!has_substitution) {
+        *new_count = arg_count;
+        return args;
+    }
+    
+    WordList words = { NULL, 0, 0 };
+    TextBuffer text = { NULL, 0, 0 };
+    int failed = 0;
+    
+    // Process each argument
+    for (int i = 0; i < arg_count && !failed; i++) {
+        text.len = 0;
+        if (expand_word(args[i], var_table, &text, &words) != 0) {
+            failed = 1;
+            break;
+        }
+        
+        // With no quoting, a word that expands to nothing is removed, like "$(true)" in sh
+        if (text.len > 0) {
+            failed = push_word(&words, &text) != 0;
+        }
+    }
+    free(text.data);
+    
+    if (failed) {
+        free_args(words.items, words.count);
+        *new_count = 0;
+        return NULL;
+    }
+    if (words.items == NULL) {
+        // Every word expanded to nothing
+        words.items = malloc(sizeof(char*));
+        if (words.items == NULL) {
+            perror("malloc failed");
+            *new_count = 0;
+            return NULL;
+        }
+    }
+    words.items[words.count] = NULL;
+    *new_count = words.count;
+    return words.items;
+}
+#endif // SHELL_FEATURE_VARS
@@ -0,0 +1,211 @@
+// --atomic: the copy is written where no reader can see it, and appears under its name only once complete
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "copy.h"
+
+
+
+#define ATOMIC_ATTEMPTS 100   // hidden names tried before giving up
+
+
+
+// Next hidden name ".<name>.<pid>.<attempt>" next to the destination
+static void hidden_name(AtomicDest *ad, int attempt)
+{
+    snprintf(ad->temp, ad->temp_size, ".%s.%d.%d", ad->name, (int)getpid(), attempt);
+}
+
+
+
+// Open the directory holding path as ad->dir_fd and keep its last component as ad->name
+// returns 0, -1 on error (already reported, atomic_close() releases what was taken)
+static int split_dest(AtomicDest *ad, const char *path)
+{
+    char *dir_copy = strdup(path);
+    char *name_copy = strdup(path);
+    if (dir_copy == NULL || name_copy == NULL)
+    {
+        perror("strdup() error");
+        free(dir_copy);
+        free(name_copy);
+        return -1;
+    }
+    ad->dir_fd = open(dirname(dir_copy), O_RDONLY | O_DIRECTORY);
+    ad->name = strdup(basename(name_copy));
+    free(dir_copy);
+    free(name_copy);
+    ad->temp_size = (ad->name != NULL ? strlen(ad->name) : 0) + 32;
+    ad->temp = malloc(ad->temp_size);
+    if (ad->dir_fd == -1 || ad->name == NULL || ad->temp == NULL)
+    {
+        perror(ad->dir_fd == -1 ? "open() error on the destination directory" : "malloc() error");
+        return -1;
+    }
+    return 0;
+}
+
+
+
+// Open an unnamed file (O_TMPFILE) in the directory of dest, or a hidden name there where the file system
+// has no O_TMPFILE; an existing dest must be a regular file, and keeps its mode in the copy that will replace it
+// a symbolic link is written through like plain cp does: the copy replaces its target, next to the target
+// returns the descriptor to write the copy to, -1 on error (already reported)
+int atomic_open(AtomicDest *ad, const char *dest)
+{
+    ad->dir_fd = -1;
+    ad->name = NULL;
+    ad->temp = NULL;
+    ad->named = 0;
+    if (split_dest(ad, dest) != 0)
+    {
+        atomic_close(ad);
+        return -1;
+    }
+
+    mode_t mode = 0644;
+    ad->replaces = fstatat(ad->dir_fd, ad->name, &ad->replaced, AT_SYMLINK_NOFOLLOW) == 0;
+    if (ad->replaces && S_ISLNK(ad->replaced.st_mode))
+    {
+        // renameat() replaces the name it is given, so it has to be the name of the target, not the link
+        char *target = realpath(dest, NULL);
+        if (target == NULL)
+        {
+            fprintf(stderr, "Error: cannot resolve the link '%s': %s\n", dest, strerror(errno));
+            atomic_close(ad);
+            return -1;
+        }
+        atomic_close(ad);
+        int split = split_dest(ad, target);
+        free(target);
+        if (split != 0)
+        {
+            atomic_close(ad);
+            return -1;
+        }
+        ad->replaces = fstatat(ad->dir_fd, ad->name, &ad->replaced, AT_SYMLINK_NOFOLLOW) == 0;
+    }
+    if (ad->replaces)
+    {
+        if (S_ISDIR(ad->replaced.st_mode))
+        {
+            fprintf(stderr, "Error: '%s' is a directory\n", dest);
+            atomic_close(ad);
+            return -1;
+        }
+        if (!S_ISREG(ad->replaced.st_mode))
+        {
+            // renameat() would put a regular file in place of the FIFO, device or socket
+            fprintf(stderr, "Error: '%s' is not a regular file, --atomic only replaces regular files\n", dest);
+            atomic_close(ad);
+            return -1;
+        }
+        mode = ad->replaced.st_mode & 07777;
+    }
+
+    int fd = openat(ad->dir_fd, ".", O_TMPFILE | O_WRONLY, mode);
+    for (int attempt = 0; fd == -1 && attempt < ATOMIC_ATTEMPTS; attempt++)
+    {
+        // EOPNOTSUPP, or EISDIR from kernels that do not know O_TMPFILE: a hidden name instead
+        if (attempt == 0 && errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+            break;
+        if (attempt > 0 && errno != EEXIST)
+            break;
+        hidden_name(ad, attempt);
+        fd = openat(ad->dir_fd, ad->temp, O_WRONLY | O_CREAT | O_EXCL, mode);
+        ad->named = fd != -1;
+    }
+    if (fd == -1)
+    {
+        perror("open() error on destination");
+        atomic_close(ad);
+        return -1;
+    }
+    if (ad->replaces && fchmod(fd, mode) == -1) // not narrowed by the umask, like the file it replaces
+    {
+        perror("fchmod() error");
+        close(fd);
+        atomic_close(ad);
+        return -1;
+    }
+    return fd;
+}
+
+
+
+// Link the unnamed file fd as name, through /proc, or by the descriptor itself without /proc
+// (that needs CAP_DAC_READ_SEARCH), returns 0 or -1 with errno set
+static int link_unnamed(AtomicDest *ad, int fd, const char *name)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    if (linkat(AT_FDCWD, path, ad->dir_fd, name, AT_SYMLINK_FOLLOW) == 0)
+        return 0;
+    if (errno != ENOENT)
+        return -1;
+    return linkat(fd, "", ad->dir_fd, name, AT_EMPTY_PATH);
+}
+
+
+
+// Give the complete copy in fd its name: an unnamed file is linked straight to the name when
+// it is free, else to a hidden name renamed over the old file, which readers see replaced in one step
+// returns 0, -1 on error (already reported, atomic_close() removes the copy)
+int atomic_publish(AtomicDest *ad, int fd)
+{
+    if (!ad->named)
+    {
+        if (link_unnamed(ad, fd, ad->name) == 0)
+            return 0;
+        int attempt = 0;
+        while (errno == EEXIST && attempt < ATOMIC_ATTEMPTS)
+        {
+            hidden_name(ad, attempt++);
+            if (link_unnamed(ad, fd, ad->temp) == 0)
+            {
+                ad->named = 1;
+                break;
+            }
+        }
+        if (!ad->named)
+        {
+            perror("linkat() error");
+            return -1;
+        }
+    }
+    if (renameat(ad->dir_fd, ad->temp, ad->dir_fd, ad->name) == -1)
+    {
+        perror("renameat() error");
+        return -1;
+    }
+    ad->named = 0; // the hidden name is gone, nothing left for atomic_close() to remove
+    return 0;
+}
+
+
+
+// Release what atomic_open() took, after atomic_publish() or instead of it (a hidden copy that was
+// never published is removed)
+void atomic_close(AtomicDest *ad)
+{
+    if (ad->named && unlinkat(ad->dir_fd, ad->temp, 0) == -1)
+        fprintf(stderr, "Warning: cannot remove the unfinished copy '%s': %s\n", ad->temp, strerror(errno));
+    ad->named = 0;
+    if (ad->dir_fd != -1)
+        close(ad->dir_fd);
+    ad->dir_fd = -1;
+    free(ad->name);
+    free(ad->temp);
+    ad->name = NULL;
+    ad->temp = NULL;
+}
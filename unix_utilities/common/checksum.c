@@ -0,0 +1,501 @@
+// Checksums for cp and mv: CRC32C and XXH3-64, with SSE4.2 and AVX2 kernels picked at run time
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "checksum.h"
+
+
+
+#define CRC32C_POLY 0x82F63B78U   // Castagnoli polynomial, bit reversed
+
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define XXH_STRIPE_LEN 64
+#define XXH_SECRET_SIZE 192
+#define XXH_SECRET_SIZE_MIN 136
+#define XXH_STRIPES_PER_BLOCK ((XXH_SECRET_SIZE - XXH_STRIPE_LEN) / 8)
+#define XXH_SECRET_LIMIT (XXH_SECRET_SIZE - XXH_STRIPE_LEN)
+#define XXH_SECRET_LASTACC_START 7
+#define XXH_SECRET_MERGEACCS_START 11
+#define XXH_MIDSIZE_STARTOFFSET 3
+#define XXH_MIDSIZE_LASTOFFSET 17
+
+// Default secret of XXH3, hashes match xxhsum -H3 and every other XXH3 implementation
+static const unsigned char xxh3_secret[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static uint32_t crc32c_table[256];
+static uint32_t (*crc32c_kernel)(uint32_t crc, const unsigned char *p, size_t len);
+static void (*xxh3_accumulate)(uint64_t *acc, const unsigned char *input, const unsigned char *secret, size_t stripes);
+
+
+
+static uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v)); // little endian, like every machine this runs on
+    return v;
+}
+
+
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+
+// Byte at a time with a table, for CPUs without SSE4.2
+static uint32_t crc32c_generic(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len--)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+
+
+#if defined(__x86_64__)
+// The crc32 instruction does the Castagnoli polynomial in hardware, 8 bytes per instruction
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64 = crc;
+    while (len >= 8)
+    {
+        crc64 = _mm_crc32_u64(crc64, read64(p));
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+
+
+// Sum stripes of 64 bytes into the 8 accumulators, each stripe with the secret 8 bytes further on
+static void xxh3_accumulate_scalar(uint64_t *acc, const unsigned char *input, const unsigned char *secret, size_t stripes)
+{
+    for (size_t s = 0; s < stripes; s++)
+    {
+        const unsigned char *in = input + s * XXH_STRIPE_LEN;
+        const unsigned char *key = secret + s * 8;
+        for (int i = 0; i < 8; i++)
+        {
+            uint64_t data = read64(in + 8 * i);
+            uint64_t keyed = data ^ read64(key + 8 * i);
+            acc[i ^ 1] += data;
+            acc[i] += (uint64_t)(uint32_t)keyed * (keyed >> 32);
+        }
+    }
+}
+
+
+
+#if defined(__x86_64__)
+// The same with the 8 accumulators in two AVX2 registers for the whole run of stripes
+__attribute__((target("avx2")))
+static void xxh3_accumulate_avx2(uint64_t *acc, const unsigned char *input, const unsigned char *secret, size_t stripes)
+{
+    __m256i acc0 = _mm256_loadu_si256((const __m256i *)acc);
+    __m256i acc1 = _mm256_loadu_si256((const __m256i *)(acc + 4));
+    for (size_t s = 0; s < stripes; s++)
+    {
+        const unsigned char *in = input + s * XXH_STRIPE_LEN;
+        const unsigned char *key = secret + s * 8;
+        __m256i data0 = _mm256_loadu_si256((const __m256i *)in);
+        __m256i data1 = _mm256_loadu_si256((const __m256i *)(in + 32));
+        __m256i keyed0 = _mm256_xor_si256(data0, _mm256_loadu_si256((const __m256i *)key));
+        __m256i keyed1 = _mm256_xor_si256(data1, _mm256_loadu_si256((const __m256i *)(key + 32)));
+        // low half times high half of every 64-bit lane, plus the data of the neighbouring lane
+        __m256i product0 = _mm256_mul_epu32(keyed0, _mm256_srli_epi64(keyed0, 32));
+        __m256i product1 = _mm256_mul_epu32(keyed1, _mm256_srli_epi64(keyed1, 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc0 = _mm256_add_epi64(acc0, product0);
+        acc1 = _mm256_add_epi64(acc1, product1);
+    }
+    _mm256_storeu_si256((__m256i *)acc, acc0);
+    _mm256_storeu_si256((__m256i *)(acc + 4), acc1);
+}
+#endif
+
+
+
+// Pick the kernels once, on the first checksum_init()
+static void checksum_setup(void)
+{
+    if (crc32c_kernel != NULL)
+        return;
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[i] = crc;
+    }
+    crc32c_kernel = crc32c_generic;
+    xxh3_accumulate = xxh3_accumulate_scalar;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_kernel = crc32c_sse42;
+    if (__builtin_cpu_supports("avx2"))
+        xxh3_accumulate = xxh3_accumulate_avx2;
+#endif
+}
+
+
+
+static void xxh3_scramble(uint64_t *acc, const unsigned char *secret)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= read64(secret + 8 * i);
+        acc[i] = a * XXH_PRIME32_1;
+    }
+}
+
+
+
+static uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+    unsigned __int128 product = (unsigned __int128)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+
+
+static uint64_t xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    return h ^ (h >> 32);
+}
+
+
+
+static uint64_t xxh3_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    return h ^ (h >> 32);
+}
+
+
+
+static uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len)
+{
+    h ^= ((h << 49) | (h >> 15)) ^ ((h << 24) | (h >> 40));
+    h *= XXH_PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= XXH_PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+
+
+static uint64_t xxh3_mix16(const unsigned char *input, const unsigned char *secret)
+{
+    return mul128_fold64(read64(input) ^ read64(secret), read64(input + 8) ^ read64(secret + 8));
+}
+
+
+
+// Whole XXH3 of an input of at most 240 bytes, these never reach the stripe loop
+static uint64_t xxh3_short(const unsigned char *input, size_t len)
+{
+    const unsigned char *secret = xxh3_secret;
+
+    if (len == 0)
+        return xxh64_avalanche(read64(secret + 56) ^ read64(secret + 64));
+    if (len <= 3)
+    {
+        uint32_t combined = ((uint32_t)input[0] << 16) | ((uint32_t)input[len >> 1] << 24) |
+                            (uint32_t)input[len - 1] | ((uint32_t)len << 8);
+        return xxh64_avalanche((uint64_t)combined ^ (read32(secret) ^ read32(secret + 4)));
+    }
+    if (len <= 8)
+    {
+        uint64_t input64 = read32(input + len - 4) + ((uint64_t)read32(input) << 32);
+        return xxh3_rrmxmx(input64 ^ (read64(secret + 8) ^ read64(secret + 16)), len);
+    }
+    if (len <= 16)
+    {
+        uint64_t lo = read64(input) ^ (read64(secret + 24) ^ read64(secret + 32));
+        uint64_t hi = read64(input + len - 8) ^ (read64(secret + 40) ^ read64(secret + 48));
+        return xxh3_avalanche(len + __builtin_bswap64(lo) + hi + mul128_fold64(lo, hi));
+    }
+
+    uint64_t acc = len * XXH_PRIME64_1;
+    if (len <= 128)
+    {
+        if (len > 32)
+        {
+            if (len > 64)
+            {
+                if (len > 96)
+                {
+                    acc += xxh3_mix16(input + 48, secret + 96);
+                    acc += xxh3_mix16(input + len - 64, secret + 112);
+                }
+                acc += xxh3_mix16(input + 32, secret + 64);
+                acc += xxh3_mix16(input + len - 48, secret + 80);
+            }
+            acc += xxh3_mix16(input + 16, secret + 32);
+            acc += xxh3_mix16(input + len - 32, secret + 48);
+        }
+        acc += xxh3_mix16(input, secret);
+        acc += xxh3_mix16(input + len - 16, secret + 16);
+        return xxh3_avalanche(acc);
+    }
+
+    for (size_t i = 0; i < 8; i++)
+        acc += xxh3_mix16(input + 16 * i, secret + 16 * i);
+    acc = xxh3_avalanche(acc);
+    for (size_t i = 8; i < len / 16; i++)
+        acc += xxh3_mix16(input + 16 * i, secret + 16 * (i - 8) + XXH_MIDSIZE_STARTOFFSET);
+    acc += xxh3_mix16(input + len - 16, secret + XXH_SECRET_SIZE_MIN - XXH_MIDSIZE_LASTOFFSET);
+    return xxh3_avalanche(acc);
+}
+
+
+
+// Accumulate whole stripes, scrambling at every block boundary they cross
+static void xxh3_consume(Xxh3State *state, uint64_t *acc, const unsigned char *input, size_t stripes)
+{
+    while (stripes > 0)
+    {
+        size_t n = XXH_STRIPES_PER_BLOCK - state->stripes_in_block;
+        if (n > stripes)
+            n = stripes;
+        xxh3_accumulate(acc, input, xxh3_secret + state->stripes_in_block * 8, n);
+        input += n * XXH_STRIPE_LEN;
+        stripes -= n;
+        state->stripes_in_block += n;
+        if (state->stripes_in_block == XXH_STRIPES_PER_BLOCK)
+        {
+            xxh3_scramble(acc, xxh3_secret + XXH_SECRET_LIMIT);
+            state->stripes_in_block = 0;
+        }
+    }
+}
+
+
+
+static void xxh3_update(Xxh3State *state, const unsigned char *input, size_t len)
+{
+    const unsigned char *end = input + len;
+    state->total_len += len;
+
+    if (state->buffered + len <= XXH3_BUFFER_SIZE)
+    {
+        memcpy(state->buffer + state->buffered, input, len);
+        state->buffered += len;
+        return;
+    }
+    if (state->buffered > 0)
+    {
+        size_t fill = XXH3_BUFFER_SIZE - state->buffered;
+        memcpy(state->buffer + state->buffered, input, fill);
+        input += fill;
+        xxh3_consume(state, state->acc, state->buffer, XXH3_BUFFER_SIZE / XXH_STRIPE_LEN);
+        state->buffered = 0;
+    }
+    if (end - input > XXH3_BUFFER_SIZE)
+    {
+        // Straight from the caller's data, the last byte always stays behind for the final stripe
+        size_t stripes = (size_t)(end - input - 1) / XXH_STRIPE_LEN;
+        xxh3_consume(state, state->acc, input, stripes);
+        input += stripes * XXH_STRIPE_LEN;
+        memcpy(state->buffer + XXH3_BUFFER_SIZE - XXH_STRIPE_LEN, input - XXH_STRIPE_LEN, XXH_STRIPE_LEN);
+    }
+    memcpy(state->buffer, input, end - input);
+    state->buffered = end - input;
+}
+
+
+
+static uint64_t xxh3_digest(const Xxh3State *state)
+{
+    if (state->total_len <= 240)
+        return xxh3_short(state->buffer, state->total_len);
+
+    // The state is left alone, the last stripes are accumulated into a copy
+    uint64_t acc[8];
+    memcpy(acc, state->acc, sizeof(acc));
+    if (state->buffered >= XXH_STRIPE_LEN)
+    {
+        Xxh3State tail = *state;
+        xxh3_consume(&tail, acc, state->buffer, (state->buffered - 1) / XXH_STRIPE_LEN);
+        xxh3_accumulate(acc, state->buffer + state->buffered - XXH_STRIPE_LEN,
+                        xxh3_secret + XXH_SECRET_LIMIT - XXH_SECRET_LASTACC_START, 1);
+    }
+    else
+    {
+        // The last stripe reaches back into the bytes kept from before the buffer was refilled
+        unsigned char last[XXH_STRIPE_LEN];
+        size_t catch_up = XXH_STRIPE_LEN - state->buffered;
+        memcpy(last, state->buffer + XXH3_BUFFER_SIZE - catch_up, catch_up);
+        memcpy(last + catch_up, state->buffer, state->buffered);
+        xxh3_accumulate(acc, last, xxh3_secret + XXH_SECRET_LIMIT - XXH_SECRET_LASTACC_START, 1);
+    }
+
+    uint64_t result = state->total_len * XXH_PRIME64_1;
+    for (int i = 0; i < 4; i++)
+    {
+        const unsigned char *secret = xxh3_secret + XXH_SECRET_MERGEACCS_START + 16 * i;
+        result += mul128_fold64(acc[2 * i] ^ read64(secret), acc[2 * i + 1] ^ read64(secret + 8));
+    }
+    return xxh3_avalanche(result);
+}
+
+
+
+// "crc32c" or "xxh3" to the type, returns 0, -1 for an unknown name
+int checksum_parse(const char *name, ChecksumType *type)
+{
+    if (strcmp(name, "crc32c") == 0)
+        *type = CHECKSUM_CRC32C;
+    else if (strcmp(name, "xxh3") == 0)
+        *type = CHECKSUM_XXH3;
+    else
+        return -1;
+    return 0;
+}
+
+
+
+const char* checksum_name(ChecksumType type)
+{
+    return type == CHECKSUM_CRC32C ? "crc32c" : type == CHECKSUM_XXH3 ? "xxh3" : "none";
+}
+
+
+
+void checksum_init(Checksum *sum, ChecksumType type)
+{
+    static const uint64_t xxh3_init[8] = {
+        XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+    };
+
+    checksum_setup();
+    sum->type = type;
+    sum->crc = 0xFFFFFFFFU;
+    if (type == CHECKSUM_XXH3)
+    {
+        memcpy(sum->xxh3.acc, xxh3_init, sizeof(xxh3_init));
+        sum->xxh3.buffered = 0;
+        sum->xxh3.stripes_in_block = 0;
+        sum->xxh3.total_len = 0;
+    }
+}
+
+
+
+void checksum_update(Checksum *sum, const void *data, size_t len)
+{
+    if (sum->type == CHECKSUM_CRC32C)
+        sum->crc = crc32c_kernel(sum->crc, data, len);
+    else if (sum->type == CHECKSUM_XXH3)
+        xxh3_update(&sum->xxh3, data, len);
+}
+
+
+
+// The digest of everything passed to checksum_update() so far, more data may follow
+uint64_t checksum_final(const Checksum *sum)
+{
+    if (sum->type == CHECKSUM_CRC32C)
+        return ~sum->crc;
+    if (sum->type == CHECKSUM_XXH3)
+        return xxh3_digest(&sum->xxh3);
+    return 0;
+}
+
+
+
+// Hex digits of a digest, 8 for crc32c and 16 for xxh3
+void checksum_format(ChecksumType type, uint64_t digest, char *out, size_t size)
+{
+    if (type == CHECKSUM_CRC32C)
+        snprintf(out, size, "%08x", (unsigned)digest);
+    else
+        snprintf(out, size, "%016llx", (unsigned long long)digest);
+}
+
+
+
+// a * b modulo the CRC polynomial, both as bit reversed polynomials
+static uint32_t crc32c_multiply(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1U << 31;
+    uint32_t product = 0;
+    while (m != 0)
+    {
+        if (a & m)
+            product ^= b;
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+
+
+// CRC32C of A followed by B from the CRCs of A and B and the length of B,
+// so ranges hashed on different threads give the checksum of the whole file
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    // x^(8 * len2) by squaring: power holds x^(2^k), starting at x^8 for one byte
+    uint32_t power = 1U << 23;
+    uint32_t shift = 1U << 31;   // x^0
+    while (len2 != 0)
+    {
+        if (len2 & 1)
+            shift = crc32c_multiply(power, shift);
+        power = crc32c_multiply(power, power);
+        len2 >>= 1;
+    }
+    return crc32c_multiply(shift, crc1) ^ crc2;
+}
@@ -0,0 +1,48 @@
+// Checksums computed on the data while cp and mv copy it
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+typedef enum
+{
+    CHECKSUM_NONE,
+    CHECKSUM_CRC32C,   // Castagnoli CRC, the crc32 instruction of SSE4.2 when the CPU has it
+    CHECKSUM_XXH3      // 64-bit XXH3 with the default secret, AVX2 when the CPU has it
+} ChecksumType;
+
+#define XXH3_BUFFER_SIZE 256
+
+// Running XXH3 state, the input is consumed in 64 byte stripes
+typedef struct
+{
+    uint64_t acc[8];
+    unsigned char buffer[XXH3_BUFFER_SIZE];
+    size_t buffered;           // bytes waiting in buffer
+    size_t stripes_in_block;   // stripes accumulated since the last scramble
+    uint64_t total_len;
+} Xxh3State;
+
+// One checksum being computed, of either type
+typedef struct
+{
+    ChecksumType type;
+    uint32_t crc;              // not inverted yet, checksum_final() does that
+    Xxh3State xxh3;
+} Checksum;
+
+
+
+int checksum_parse(const char *name, ChecksumType *type);
+const char* checksum_name(ChecksumType type);
+void checksum_init(Checksum *sum, ChecksumType type);
+void checksum_update(Checksum *sum, const void *data, size_t len);
+uint64_t checksum_final(const Checksum *sum);
+void checksum_format(ChecksumType type, uint64_t digest, char *out, size_t size);
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+#endif // CHECKSUM_H
@@ -0,0 +1,588 @@
+// Copy engine shared by cp and mv: kernel side copies, parallel ranges, inline checksums and read back verification
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "copy.h"
+
+
+
+#define VERIFY_BUFFER_SIZE (1024 * 1024)   // read back buffer, aligned for O_DIRECT
+#define DIRECT_ALIGN 4096
+
+
+
+// One file copied by several threads, each takes the next free range until none are left
+typedef struct
+{
+    int fd_in;
+    int fd_out;
+    off_t start;               // the ranges cover start to size, a resumed copy already has the part before
+    off_t size;
+    off_t chunk_size;
+    long long chunks;
+    ChecksumType checksum;
+    uint32_t *range_crc;       // CRC32C of every range, combined in order once all are done
+    atomic_llong next_chunk;   // index of the first range no thread has taken yet
+    atomic_int failed;         // set once, the other threads stop at their next range
+    int error;                 // errno of the failure, written by the thread that set failed
+    ResumeState *resume;       // checkpointed copy, NULL when it is not
+    pthread_mutex_t lock;      // guards range_done and done_prefix
+    unsigned char *range_done; // ranges finish out of order, a checkpoint needs all the ones before it
+    long long done_prefix;     // number of leading ranges all done
+} ParallelCopy;
+
+
+
+void copy_options_init(CopyOptions *opts)
+{
+    opts->jobs = 1;
+    opts->chunk_size = DEFAULT_CHUNK_SIZE;
+    opts->checksum = CHECKSUM_NONE;
+    opts->print_checksum = 0;
+    opts->verify = VERIFY_NONE;
+    opts->preserve = 0;
+    opts->resume = 0;
+    opts->sync = SYNC_NONE;
+    opts->atomic = 0;
+}
+
+
+
+// Parse a size like 4096, 512K, 64M or 2G, returns -1 when it is not one
+long long copy_parse_size(const char *text)
+{
+    char *end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+    if (errno != 0 || end == text || value <= 0)
+        return -1;
+    switch (*end)
+    {
+        case 'K': case 'k': value <<= 10; end++; break;
+        case 'M': case 'm': value <<= 20; end++; break;
+        case 'G': case 'g': value <<= 30; end++; break;
+    }
+    return *end == '\0' ? value : -1;
+}
+
+
+
+// write() or pwrite() (off >= 0) all of buffer, returns 0 or -1 with errno set
+static int write_all(int fd, const char *buffer, size_t len, off_t off)
+{
+    for (size_t done = 0; done < len; )
+    {
+        ssize_t w = off >= 0 ? pwrite(fd, buffer + done, len - done, off + done) : write(fd, buffer + done, len - done);
+        if (w == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += w;
+    }
+    return 0;
+}
+
+
+
+// Copy len bytes at offset off of fd_in to the same offset of fd_out
+// copy_file_range() keeps the data in the kernel (or lets the file system share extents),
+// *use_cfr is cleared when the file systems cannot do it and pread()/pwrite() take over
+// with sum the data has to pass through buffer anyway, so the caller starts with *use_cfr at 0
+// returns 0, or -1 with errno set (EIO when the source ended early)
+static int copy_range(int fd_in, int fd_out, off_t off, off_t len, char *buffer, int *use_cfr, Checksum *sum)
+{
+    while (len > 0 && *use_cfr)
+    {
+        loff_t in = off, out = off;
+        ssize_t n = copy_file_range(fd_in, &in, fd_out, &out, len, 0);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
+            {
+                *use_cfr = 0;
+                break;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            errno = EIO; // the source shrank while being copied
+            return -1;
+        }
+        off += n;
+        len -= n;
+    }
+    while (len > 0)
+    {
+        ssize_t n = pread(fd_in, buffer, len < COPY_BUFFER_SIZE ? len : COPY_BUFFER_SIZE, off);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n == 0)
+                errno = EIO;
+            return -1;
+        }
+        if (sum != NULL)
+            checksum_update(sum, buffer, n);
+        if (write_all(fd_out, buffer, n, off) != 0)
+            return -1;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+
+// Copy from the current position of fd_in to its end, for one thread or a source that is not a regular file
+// sum (if not NULL) is fed every byte on the way through
+static int copy_stream(int fd_in, int fd_out, Checksum *sum)
+{
+    // copy_file_range() with NULL offsets moves both file positions, so read() carries on where it stopped
+    while (sum == NULL)
+    {
+        ssize_t n = copy_file_range(fd_in, NULL, fd_out, NULL, 1 << 30, 0);
+        if (n == 0)
+            return 0;
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
+                break;
+            perror("copy_file_range() error");
+            return -1;
+        }
+    }
+
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        perror("malloc() error");
+        return -1;
+    }
+    ssize_t bytes;
+    while ((bytes = read(fd_in, buffer, COPY_BUFFER_SIZE)) != 0) // reading the source file and writing the content to the destination file
+    {
+        if (bytes == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("read() error");
+            free(buffer);
+            return -1;
+        }
+        if (sum != NULL)
+            checksum_update(sum, buffer, bytes);
+        if (write_all(fd_out, buffer, bytes, -1) != 0)
+        {
+            perror("write() error");
+            free(buffer);
+            return -1;
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+
+
+// Feed the first len bytes of fd_in to sum, the checksum of a resumed copy covers what an earlier run copied
+static int checksum_prefix(int fd_in, off_t len, Checksum *sum)
+{
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        perror("malloc() error");
+        return -1;
+    }
+    for (off_t off = 0; off < len; )
+    {
+        ssize_t n = pread(fd_in, buffer, len - off < COPY_BUFFER_SIZE ? len - off : COPY_BUFFER_SIZE, off);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n == 0)
+                errno = EIO;
+            perror("read() error");
+            free(buffer);
+            return -1;
+        }
+        checksum_update(sum, buffer, n);
+        off += n;
+    }
+    free(buffer);
+    return 0;
+}
+
+
+
+// One thread copy of a checkpointed file: start to size at the same offsets of both files,
+// in RESUME_INTERVAL steps with a checkpoint after each
+static int copy_resumable(int fd_in, int fd_out, off_t start, off_t size, Checksum *sum, ResumeState *rs)
+{
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        perror("malloc() error");
+        return -1;
+    }
+    int use_cfr = sum == NULL;
+    for (off_t off = start; off < size; )
+    {
+        off_t len = size - off < RESUME_INTERVAL ? size - off : RESUME_INTERVAL;
+        if (copy_range(fd_in, fd_out, off, len, buffer, &use_cfr, sum) != 0)
+        {
+            perror("copy error");
+            free(buffer);
+            return -1;
+        }
+        off += len;
+        if (resume_checkpoint(rs, fd_out, off) != 0)
+        {
+            perror("checkpoint error");
+            free(buffer);
+            return -1;
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+
+
+// Record the first failure, the other threads see it before taking their next range
+static void copy_failed(ParallelCopy *pc, int error)
+{
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&pc->failed, &expected, 1))
+        pc->error = error;
+}
+
+
+
+// Thread body: take ranges until there are none left or another thread failed
+static void* copy_worker(void *arg)
+{
+    ParallelCopy *pc = arg;
+    int use_cfr = pc->checksum == CHECKSUM_NONE;
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        copy_failed(pc, ENOMEM);
+        return NULL;
+    }
+
+    while (!atomic_load(&pc->failed))
+    {
+        long long chunk = atomic_fetch_add(&pc->next_chunk, 1);
+        if (chunk >= pc->chunks)
+            break;
+        off_t off = pc->start + (off_t)chunk * pc->chunk_size;
+        off_t len = pc->size - off < pc->chunk_size ? pc->size - off : pc->chunk_size;
+
+        Checksum sum;
+        if (pc->checksum != CHECKSUM_NONE)
+            checksum_init(&sum, pc->checksum);
+        if (copy_range(pc->fd_in, pc->fd_out, off, len, buffer, &use_cfr,
+                       pc->checksum != CHECKSUM_NONE ? &sum : NULL) != 0)
+        {
+            copy_failed(pc, errno);
+            break;
+        }
+        if (pc->checksum != CHECKSUM_NONE)
+            pc->range_crc[chunk] = (uint32_t)checksum_final(&sum);
+        if (pc->resume != NULL)
+        {
+            pthread_mutex_lock(&pc->lock);
+            pc->range_done[chunk] = 1;
+            while (pc->done_prefix < pc->chunks && pc->range_done[pc->done_prefix])
+                pc->done_prefix++;
+            off_t done = pc->start + (off_t)pc->done_prefix * pc->chunk_size;
+            int err = resume_checkpoint(pc->resume, pc->fd_out, done < pc->size ? done : pc->size) != 0 ? errno : 0;
+            pthread_mutex_unlock(&pc->lock);
+            if (err != 0)
+            {
+                copy_failed(pc, err);
+                break;
+            }
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+
+
+// Split a regular file from start on into chunk_size ranges and copy them on jobs threads (the calling one included)
+// the destination is preallocated first, so the ranges land in place and a full disk fails up front
+// with a checksum (only CRC32C can be combined) *digest gets the one of the whole file
+// with rs the longest run of finished ranges is checkpointed
+static int copy_parallel(int fd_in, int fd_out, off_t start, off_t size, const CopyOptions *opts, ResumeState *rs,
+                         uint64_t *digest)
+{
+    if (fallocate(fd_out, 0, 0, size) == -1)
+    {
+        if (errno != EOPNOTSUPP && errno != ENOSYS)
+        {
+            perror("fallocate() error");
+            return -1;
+        }
+        if (ftruncate(fd_out, size) == -1) // no preallocation on this file system, only set the size
+        {
+            perror("ftruncate() error");
+            return -1;
+        }
+    }
+
+    ParallelCopy pc;
+    pc.fd_in = fd_in;
+    pc.fd_out = fd_out;
+    pc.start = start;
+    pc.size = size;
+    pc.chunk_size = opts->chunk_size;
+    pc.chunks = (size - start + pc.chunk_size - 1) / pc.chunk_size;
+    pc.checksum = opts->checksum;
+    pc.range_crc = NULL;
+    atomic_init(&pc.next_chunk, 0);
+    atomic_init(&pc.failed, 0);
+    pc.error = 0;
+    pc.resume = rs;
+    pc.range_done = NULL;
+    pc.done_prefix = 0;
+
+    off_t chunks = pc.chunks;
+    if (pc.checksum != CHECKSUM_NONE)
+        pc.range_crc = calloc(chunks, sizeof(uint32_t));
+    if (rs != NULL)
+        pc.range_done = calloc(chunks, 1);
+    if ((pc.checksum != CHECKSUM_NONE && pc.range_crc == NULL) || (rs != NULL && pc.range_done == NULL))
+    {
+        perror("calloc() error");
+        free(pc.range_crc);
+        free(pc.range_done);
+        return -1;
+    }
+    pthread_mutex_init(&pc.lock, NULL);
+    int jobs = opts->jobs > chunks ? (int)chunks : opts->jobs;
+
+    pthread_t threads[MAX_JOBS];
+    int started = 0;
+    for (int i = 1; i < jobs; i++)
+    {
+        int err = pthread_create(&threads[started], NULL, copy_worker, &pc);
+        if (err != 0)
+        {
+            // fewer threads is slower, not wrong: the ranges are taken from a shared counter
+            fprintf(stderr, "pthread_create() error: %s, copying with %d threads\n", strerror(err), started + 1);
+            break;
+        }
+        started++;
+    }
+    copy_worker(&pc);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&pc.lock);
+    free(pc.range_done);
+
+    if (atomic_load(&pc.failed))
+    {
+        errno = pc.error;
+        perror("parallel copy error");
+        free(pc.range_crc);
+        return -1;
+    }
+    if (pc.range_crc != NULL)
+    {
+        uint32_t crc = pc.range_crc[0];
+        for (off_t i = 1; i < chunks; i++)
+        {
+            off_t len = i == chunks - 1 ? size - start - i * pc.chunk_size : pc.chunk_size;
+            crc = crc32c_combine(crc, pc.range_crc[i], len);
+        }
+        free(pc.range_crc);
+        if (start > 0)
+        {
+            Checksum prefix;
+            checksum_init(&prefix, CHECKSUM_CRC32C);
+            if (checksum_prefix(fd_in, start, &prefix) != 0)
+                return -1;
+            crc = crc32c_combine((uint32_t)checksum_final(&prefix), crc, size - start);
+        }
+        *digest = crc;
+    }
+    return 0;
+}
+
+
+
+// Open the destination again for reading, through /proc so the path is not looked up a second time
+int copy_reopen(int fd_out, const char *dest, int flags)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd_out);
+    int fd = open(path, flags);
+    if (fd == -1 && errno == ENOENT) // no /proc mounted
+        fd = open(dest, flags);
+    return fd;
+}
+
+
+
+// Read the destination back and compare its checksum with the one taken while copying
+static int verify_copy(int fd_out, const char *dest, const CopyOptions *opts, uint64_t expected)
+{
+    int direct = opts->verify == VERIFY_DIRECT;
+    int fd = copy_reopen(fd_out, dest, O_RDONLY | (direct ? O_DIRECT : 0));
+    if (fd == -1 && direct && errno == EINVAL)
+    {
+        fprintf(stderr, "Warning: '%s' cannot be read with O_DIRECT, verifying through the page cache\n", dest);
+        direct = 0;
+        fd = copy_reopen(fd_out, dest, O_RDONLY);
+    }
+    if (fd == -1)
+    {
+        perror("open() error on destination for verification");
+        return -1;
+    }
+
+    void *buffer;
+    int err = posix_memalign(&buffer, DIRECT_ALIGN, VERIFY_BUFFER_SIZE);
+    if (err != 0)
+    {
+        fprintf(stderr, "posix_memalign() error: %s\n", strerror(err));
+        close(fd);
+        return -1;
+    }
+
+    // O_DIRECT reads write back the dirty page cache of the range first, then go to the device
+    Checksum sum;
+    checksum_init(&sum, opts->checksum);
+    ssize_t bytes;
+    while ((bytes = read(fd, buffer, VERIFY_BUFFER_SIZE)) != 0)
+    {
+        if (bytes == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("read() error on destination for verification");
+            free(buffer);
+            close(fd);
+            return -1;
+        }
+        checksum_update(&sum, buffer, bytes);
+    }
+    free(buffer);
+    close(fd);
+
+    uint64_t actual = checksum_final(&sum);
+    if (actual != expected)
+    {
+        char want[24], got[24];
+        checksum_format(opts->checksum, expected, want, sizeof(want));
+        checksum_format(opts->checksum, actual, got, sizeof(got));
+        fprintf(stderr, "Error: verification of '%s' failed: %s is %s, the source had %s\n",
+                dest, checksum_name(opts->checksum), got, want);
+        return -1;
+    }
+    return 0;
+}
+
+
+
+// Copy what fd_in holds from start on to fd_out, the way opts asks for:
+// a large regular file in parallel ranges, anything else as one stream, with the checksum
+// computed on the data while it is copied and the destination verified against it afterwards,
+// then the attributes opts->preserve names and the sync opts->sync asks for;
+// rs (when not NULL) is checkpointed along the way
+static int copy_from(int fd_in, int fd_out, off_t start, const struct statx *st_in, const struct stat *st_out,
+                     const char *dest, const CopyOptions *opts, ResumeState *rs)
+{
+    // Parallel ranges only pay off when every thread gets at least one, below that one stream is as fast;
+    // XXH3 of a file cannot be put together from the hashes of its ranges, CRC32C can
+    off_t size = st_in->stx_size;
+    int parallel = opts->jobs > 1 && S_ISREG(st_in->stx_mode) && S_ISREG(st_out->st_mode) &&
+                   size - start >= 2 * opts->chunk_size && opts->checksum != CHECKSUM_XXH3;
+
+    uint64_t digest = 0;
+    if (parallel)
+    {
+        if (copy_parallel(fd_in, fd_out, start, size, opts, rs, &digest) != 0)
+            return -1;
+    }
+    else
+    {
+        Checksum sum;
+        Checksum *use_sum = opts->checksum != CHECKSUM_NONE ? &sum : NULL;
+        if (use_sum != NULL)
+            checksum_init(&sum, opts->checksum);
+        if (rs == NULL)
+        {
+            if (copy_stream(fd_in, fd_out, use_sum) != 0)
+                return -1;
+        }
+        else
+        {
+            if (use_sum != NULL && checksum_prefix(fd_in, start, use_sum) != 0)
+                return -1;
+            if (copy_resumable(fd_in, fd_out, start, size, use_sum, rs) != 0)
+                return -1;
+        }
+        if (use_sum != NULL)
+            digest = checksum_final(&sum);
+    }
+
+    if (opts->print_checksum)
+    {
+        char hex[24];
+        checksum_format(opts->checksum, digest, hex, sizeof(hex));
+        printf("%s  %s\n", hex, dest);
+    }
+    if (opts->verify != VERIFY_NONE)
+    {
+        if (!S_ISREG(st_out->st_mode))
+            fprintf(stderr, "Warning: '%s' is not a regular file, it cannot be read back to verify\n", dest);
+        else if (verify_copy(fd_out, dest, opts, digest) != 0)
+            return -1;
+    }
+    if (opts->preserve && copy_metadata(fd_in, fd_out, st_in, opts->preserve, dest) != 0)
+        return -1;
+    return sync_file(fd_out, opts);
+}
+
+
+
+// Copy everything fd_in holds to fd_out (already truncated, unless opts->resume decides where to start)
+// st_in comes from copy_stat() with the same opts
+// returns 0, -1 on error (already reported)
+int copy_data(int fd_in, int fd_out, const struct statx *st_in, const struct stat *st_out,
+              const char *dest, const CopyOptions *opts)
+{
+    if (!opts->resume)
+        return copy_from(fd_in, fd_out, 0, st_in, st_out, dest, opts, NULL);
+
+    ResumeState rs;
+    off_t start = resume_start(&rs, fd_in, fd_out, st_in, st_out, dest);
+    if (start == -1)
+        return -1;
+    int result = copy_from(fd_in, fd_out, start, st_in, st_out, dest, opts, rs.fd != -1 ? &rs : NULL);
+    resume_finish(&rs, result == 0);
+    return result;
+}
@@ -0,0 +1,122 @@
+// Copy engine shared by cp and mv: one file's data from an open descriptor to another
+
+#ifndef COPY_H
+#define COPY_H
+
+#include <sys/types.h>
+#include <sys/stat.h>   // struct statx, the including file defines _GNU_SOURCE
+
+#include "checksum.h"
+
+
+
+#define COPY_BUFFER_SIZE (128 * 1024)            // read()/write() buffer when copy_file_range() is not possible
+#define DEFAULT_CHUNK_SIZE (64LL * 1024 * 1024)   // bytes per range of a parallel copy
+#define CHUNK_ALIGN (1024 * 1024)                 // ranges start on 1 MiB boundaries
+#define MAX_JOBS 256
+#define SYNC_BATCH_SIZE 64                        // files --sync=batch waits for together
+#define TREE_JOBS 8                               // threads copying a directory tree unless -j says otherwise
+#define RESUME_INTERVAL (256LL * 1024 * 1024)    // bytes copied between two checkpoints of --resume
+#define RESUME_SAMPLES 16                         // blocks of the copied prefix compared before resuming
+#define RESUME_SAMPLE_SIZE (64 * 1024)
+#define RESUME_SUFFIX ".resume"                   // the checkpoint of "dest" is "dest.resume"
+
+// Attributes of the source --preserve applies to the destination
+#define PRESERVE_MODE       0x01
+#define PRESERVE_OWNERSHIP  0x02
+#define PRESERVE_TIMESTAMPS 0x04
+#define PRESERVE_XATTR      0x08   // ACLs included, they are system.posix_acl_* xattrs
+#define PRESERVE_ALL        0x0f
+#define PRESERVE_DEFAULT    (PRESERVE_MODE | PRESERVE_OWNERSHIP | PRESERVE_TIMESTAMPS)   // -p, --preserve without a list
+
+// How the destination is read back after the copy
+typedef enum
+{
+    VERIFY_NONE,
+    VERIFY_CACHED,     // through the page cache, catches short or misplaced writes
+    VERIFY_DIRECT      // with O_DIRECT, the data comes from the device
+} VerifyMode;
+
+// When the copies are made durable
+typedef enum
+{
+    SYNC_NONE,         // left to the kernel
+    SYNC_FILE,         // fsync() of every file as it is done
+    SYNC_BATCH,        // writeback started as every file is done, waited for SYNC_BATCH_SIZE files at a time
+    SYNC_FS            // one syncfs() of the destination file system at the end
+} SyncMode;
+
+// What the command line asked for, the same for every file
+typedef struct
+{
+    int jobs;                  // threads for one large regular file, 1 streams it
+    long long chunk_size;      // bytes per range when jobs > 1
+    ChecksumType checksum;     // computed on the data as it streams through, CHECKSUM_NONE for none
+    int print_checksum;        // print "<digest>  <destination>" for every file
+    VerifyMode verify;         // read the destination back and compare its checksum
+    int preserve;              // PRESERVE_ bits of the attributes copied after the data
+    int resume;                // continue an interrupted copy from its checkpoint, the destination is not truncated
+    SyncMode sync;
+    int atomic;                // write to a file no reader sees and rename it to the destination once complete
+} CopyOptions;
+
+// Destination of --atomic: written as an unnamed (or hidden) file, published under its name once complete
+typedef struct
+{
+    int dir_fd;                // the directory of the destination
+    char *name;                // of the destination in that directory
+    char *temp;                // the hidden name, when the copy has one
+    size_t temp_size;
+    int named;                 // the copy is linked under temp
+    int replaces;              // an existing destination is replaced, replaced is its stat
+    struct stat replaced;
+} AtomicDest;
+
+// Checkpoint of a resumable copy: "<size> <mtime> <inode>" of the source and the offset below which
+// the destination is known to be complete, rewritten in place every RESUME_INTERVAL bytes
+typedef struct
+{
+    int fd;                        // the checkpoint file, -1 when this copy is not checkpointed
+    char *path;
+    const struct statx *source;
+    off_t saved;                   // offset in the checkpoint file
+} ResumeState;
+
+
+
+// copy.c
+void copy_options_init(CopyOptions *opts);
+long long copy_parse_size(const char *text);
+int copy_data(int fd_in, int fd_out, const struct statx *st_in, const struct stat *st_out,
+              const char *dest, const CopyOptions *opts);
+int copy_reopen(int fd_out, const char *dest, int flags);
+
+// metadata.c
+int copy_parse_preserve(const char *list, int *preserve);
+unsigned int copy_stat_mask(const CopyOptions *opts);
+int copy_stat(int fd, const CopyOptions *opts, struct statx *stx);
+int copy_same_file(const struct statx *st_in, const struct stat *st_out);
+int copy_metadata(int fd_in, int fd_out, const struct statx *stx, int preserve, const char *dest);
+
+// resume.c
+off_t resume_start(ResumeState *rs, int fd_in, int fd_out, const struct statx *st_in, const struct stat *st_out,
+                   const char *dest);
+int resume_checkpoint(ResumeState *rs, int fd_out, off_t offset);
+void resume_finish(ResumeState *rs, int completed);
+
+// atomic.c
+int atomic_open(AtomicDest *ad, const char *dest);
+int atomic_publish(AtomicDest *ad, int fd);
+void atomic_close(AtomicDest *ad);
+
+// sync.c
+int copy_parse_sync(const char *name, SyncMode *mode);
+int sync_file(int fd, const CopyOptions *opts);
+int sync_finish(const char *dest, const CopyOptions *opts);
+
+// tree.c
+int copy_tree(const char *src, const char *dest, const CopyOptions *opts, int jobs);
+int compare_tree(const char *src, const char *dest);
+int remove_tree(const char *path);
+
+#endif // COPY_H
@@ -0,0 +1,215 @@
+// Metadata of copied files: one statx() of the source, then fd based calls on the destination
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+
+#include "copy.h"
+
+
+
+// Fields every copy needs, the others are only asked for when an option uses them
+#define STATX_COPY_BASE (STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_NLINK)
+
+
+
+// "mode,ownership,timestamps,xattr" (any of them, in any order, or "all") to PRESERVE_ bits
+// returns 0, -1 for an unknown name
+int copy_parse_preserve(const char *list, int *preserve)
+{
+    static const struct
+    {
+        const char *name;
+        int bit;
+    } names[] = {
+        { "mode", PRESERVE_MODE },
+        { "ownership", PRESERVE_OWNERSHIP },
+        { "timestamps", PRESERVE_TIMESTAMPS },
+        { "xattr", PRESERVE_XATTR },
+        { "all", PRESERVE_ALL },
+    };
+
+    const char *p = list;
+    while (*p)
+    {
+        size_t len = strcspn(p, ",");
+        size_t i;
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        {
+            if (strlen(names[i].name) == len && strncmp(p, names[i].name, len) == 0)
+                break;
+        }
+        if (i == sizeof(names) / sizeof(names[0]))
+        {
+            fprintf(stderr, "Error: unknown attribute '%.*s' (mode, ownership, timestamps, xattr or all)\n", (int)len, p);
+            return -1;
+        }
+        *preserve |= names[i].bit;
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    return 0;
+}
+
+
+
+// The statx() fields the copy, preserve and resume need, a network or FUSE file system is not asked for the rest
+unsigned int copy_stat_mask(const CopyOptions *opts)
+{
+    unsigned int mask = STATX_COPY_BASE;
+    if (opts->preserve & PRESERVE_OWNERSHIP)
+        mask |= STATX_UID | STATX_GID;
+    if (opts->preserve & PRESERVE_TIMESTAMPS)
+        mask |= STATX_ATIME | STATX_MTIME;
+    if (opts->resume)
+        mask |= STATX_MTIME; // a checkpoint only belongs to the same version of the source
+    return mask;
+}
+
+
+
+// statx() of an open source with copy_stat_mask()
+int copy_stat(int fd, const CopyOptions *opts, struct statx *stx)
+{
+    if (statx(fd, "", AT_EMPTY_PATH | AT_STATX_SYNC_AS_STAT, copy_stat_mask(opts), stx) == -1)
+        return -1;
+    if ((stx->stx_mask & STATX_COPY_BASE) != STATX_COPY_BASE)
+    {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    return 0;
+}
+
+
+
+// Copy every extended attribute (ACLs are the system.posix_acl_* ones) from fd_in to fd_out
+static int copy_xattrs(int fd_in, int fd_out, const char *dest)
+{
+    ssize_t list_len = flistxattr(fd_in, NULL, 0);
+    if (list_len == -1)
+    {
+        if (errno == ENOTSUP)
+            return 0; // the source file system has none
+        perror("flistxattr() error");
+        return -1;
+    }
+    if (list_len == 0)
+        return 0;
+
+    char *list = malloc(list_len);
+    size_t value_capacity = 256;
+    char *value = malloc(value_capacity);
+    if (list == NULL || value == NULL)
+    {
+        perror("malloc() error");
+        free(list);
+        free(value);
+        return -1;
+    }
+    list_len = flistxattr(fd_in, list, list_len); // ERANGE if one was added meanwhile, reported below
+
+    int result = list_len == -1 ? -1 : 0;
+    if (list_len == -1)
+        perror("flistxattr() error");
+    for (char *name = list; result == 0 && name < list + list_len; name += strlen(name) + 1)
+    {
+        ssize_t len = fgetxattr(fd_in, name, NULL, 0);
+        if (len > (ssize_t)value_capacity)
+        {
+            char *bigger = realloc(value, len);
+            if (bigger == NULL)
+            {
+                perror("realloc() error");
+                result = -1;
+                break;
+            }
+            value = bigger;
+            value_capacity = len;
+        }
+        if (len != -1)
+            len = fgetxattr(fd_in, name, value, value_capacity);
+        if (len == -1)
+        {
+            if (errno == ENODATA)
+                continue; // removed since the list was taken
+            fprintf(stderr, "fgetxattr() error on '%s': %s\n", name, strerror(errno));
+            result = -1;
+        }
+        else if (fsetxattr(fd_out, name, value, len, 0) == -1)
+        {
+            fprintf(stderr, "Error: cannot set '%s' on '%s': %s\n", name, dest, strerror(errno));
+            result = -1;
+        }
+    }
+    free(list);
+    free(value);
+    return result;
+}
+
+
+
+// Apply the preserved attributes of the source (stx from copy_stat()) to the destination,
+// all through the open descriptor: no path is looked up again
+// ownership first (it clears set-user-ID bits), the mode, the xattrs (a POSIX ACL holds mode bits
+// too), and the timestamps last because every other change moves the ctime and writes the mtime
+// returns 0, -1 when an attribute could not be set (already reported)
+int copy_metadata(int fd_in, int fd_out, const struct statx *stx, int preserve, const char *dest)
+{
+    int result = 0;
+    mode_t mode = stx->stx_mode & 07777;
+
+    if (preserve & PRESERVE_OWNERSHIP)
+    {
+        if (fchown(fd_out, stx->stx_uid, stx->stx_gid) == -1)
+        {
+            // Only root may give files away, like cp -p the copy then stays ours,
+            // without set-user-ID and set-group-ID bits that would now mean our ids
+            if (errno != EPERM && errno != EINVAL)
+            {
+                perror("fchown() error");
+                result = -1;
+            }
+            mode &= ~(S_ISUID | S_ISGID);
+        }
+    }
+    if ((preserve & PRESERVE_MODE) && fchmod(fd_out, mode) == -1)
+    {
+        perror("fchmod() error");
+        result = -1;
+    }
+    if ((preserve & PRESERVE_XATTR) && copy_xattrs(fd_in, fd_out, dest) != 0)
+        result = -1;
+    if (preserve & PRESERVE_TIMESTAMPS)
+    {
+        struct timespec times[2] = {
+            { stx->stx_atime.tv_sec, stx->stx_atime.tv_nsec },
+            { stx->stx_mtime.tv_sec, stx->stx_mtime.tv_nsec },
+        };
+        if (futimens(fd_out, times) == -1)
+        {
+            perror("futimens() error");
+            result = -1;
+        }
+    }
+    return result;
+}
+
+
+
+// Whether the destination opened for writing is the source itself
+int copy_same_file(const struct statx *st_in, const struct stat *st_out)
+{
+    return makedev(st_in->stx_dev_major, st_in->stx_dev_minor) == st_out->st_dev &&
+           st_in->stx_ino == st_out->st_ino;
+}
@@ -0,0 +1,227 @@
+// Checkpoints of --resume: an interrupted copy of a large file continues where it stopped
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "copy.h"
+
+
+
+// One fixed width line, so a checkpoint overwrites the previous one in place
+#define RESUME_FORMAT "cpresume %020llu %020lld %09u %020llu %020lld\n"
+#define RESUME_RECORD_SIZE 103
+
+
+
+// pread() all of len, returns 0 or -1 (errno EIO when the file ends first)
+static int read_full(int fd, char *buffer, size_t len, off_t off)
+{
+    for (size_t done = 0; done < len; )
+    {
+        ssize_t n = pread(fd, buffer + done, len - done, off + done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n == 0)
+                errno = EIO;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+
+
+// Compare RESUME_SAMPLES blocks spread over the first len bytes of both files, the last one ending at len:
+// a destination written by something else, or a prefix the crash lost, shows in one of them
+// returns 1 when all match, 0 when one differs, -1 on error
+static int prefix_matches(int fd_in, int fd_out, const char *dest, off_t len)
+{
+    int fd_check = copy_reopen(fd_out, dest, O_RDONLY); // fd_out is write only
+    if (fd_check == -1)
+    {
+        perror("open() error on destination");
+        return -1;
+    }
+    char *in = malloc(RESUME_SAMPLE_SIZE);
+    char *out = malloc(RESUME_SAMPLE_SIZE);
+    if (in == NULL || out == NULL)
+    {
+        perror("malloc() error");
+        free(in);
+        free(out);
+        close(fd_check);
+        return -1;
+    }
+
+    size_t block = len < RESUME_SAMPLE_SIZE ? (size_t)len : RESUME_SAMPLE_SIZE;
+    off_t span = len - block;
+    int result = 1;
+    for (int i = 0; i < RESUME_SAMPLES && result == 1; i++)
+    {
+        off_t off = span * i / (RESUME_SAMPLES - 1);
+        if (read_full(fd_in, in, block, off) != 0 || read_full(fd_check, out, block, off) != 0)
+        {
+            perror("read() error while checking the copied part");
+            result = -1;
+        }
+        else if (memcmp(in, out, block) != 0)
+            result = 0;
+    }
+    free(in);
+    free(out);
+    close(fd_check);
+    return result;
+}
+
+
+
+// Write the checkpoint record and make it durable, returns 0 or -1 with errno set
+static int save_checkpoint(ResumeState *rs, off_t offset)
+{
+    char record[RESUME_RECORD_SIZE + 1];
+    snprintf(record, sizeof(record), RESUME_FORMAT,
+             (unsigned long long)rs->source->stx_size, (long long)rs->source->stx_mtime.tv_sec,
+             rs->source->stx_mtime.tv_nsec, (unsigned long long)rs->source->stx_ino, (long long)offset);
+    ssize_t w = pwrite(rs->fd, record, RESUME_RECORD_SIZE, 0);
+    if (w != RESUME_RECORD_SIZE)
+    {
+        if (w >= 0)
+            errno = EIO;
+        return -1;
+    }
+    if (fdatasync(rs->fd) == -1)
+        return -1;
+    rs->saved = offset;
+    return 0;
+}
+
+
+
+// Decide where the copy of st_in to dest starts: at the offset of a checkpoint left by an earlier run
+// if it was taken of this same source and sampled blocks of the destination still match, else at 0
+// the destination is truncated to that offset, and checkpointed from there on
+// a copy that cannot be checkpointed (not regular files) starts at 0 with rs->fd at -1
+// returns the offset, -1 on error (already reported)
+off_t resume_start(ResumeState *rs, int fd_in, int fd_out, const struct statx *st_in, const struct stat *st_out,
+                   const char *dest)
+{
+    rs->fd = -1;
+    rs->path = NULL;
+    rs->source = st_in;
+    rs->saved = 0;
+
+    if (!S_ISREG(st_in->stx_mode) || !S_ISREG(st_out->st_mode))
+    {
+        fprintf(stderr, "Warning: '%s' cannot be resumed, only copies between regular files are\n", dest);
+        if (S_ISREG(st_out->st_mode) && ftruncate(fd_out, 0) == -1)
+        {
+            perror("ftruncate() error");
+            return -1;
+        }
+        return 0;
+    }
+
+    rs->path = malloc(strlen(dest) + sizeof(RESUME_SUFFIX));
+    if (rs->path == NULL)
+    {
+        perror("malloc() error");
+        return -1;
+    }
+    sprintf(rs->path, "%s%s", dest, RESUME_SUFFIX);
+    rs->fd = open(rs->path, O_RDWR | O_CREAT, 0644);
+    if (rs->fd == -1)
+    {
+        fprintf(stderr, "Error: cannot open the checkpoint '%s': %s\n", rs->path, strerror(errno));
+        free(rs->path);
+        rs->path = NULL;
+        return -1;
+    }
+
+    off_t start = 0;
+    char record[RESUME_RECORD_SIZE + 1];
+    ssize_t n = pread(rs->fd, record, RESUME_RECORD_SIZE, 0);
+    unsigned long long size, ino;
+    long long mtime, offset;
+    unsigned int mtime_nsec;
+    if (n == RESUME_RECORD_SIZE)
+    {
+        record[n] = '\0';
+        if (sscanf(record, "cpresume %llu %lld %u %llu %lld", &size, &mtime, &mtime_nsec, &ino, &offset) != 5 ||
+            size != st_in->stx_size || mtime != st_in->stx_mtime.tv_sec || mtime_nsec != st_in->stx_mtime.tv_nsec ||
+            ino != st_in->stx_ino)
+            fprintf(stderr, "Warning: the checkpoint of '%s' is of another source, copying from the start\n", dest);
+        else if (offset < 0 || offset > st_out->st_size || (unsigned long long)offset > size)
+            fprintf(stderr, "Warning: '%s' is shorter than its checkpoint, copying from the start\n", dest);
+        else
+        {
+            int match = offset > 0 ? prefix_matches(fd_in, fd_out, dest, offset) : 1;
+            if (match == -1)
+            {
+                resume_finish(rs, 0);
+                return -1;
+            }
+            if (match == 1)
+                start = offset;
+            else
+                fprintf(stderr, "Warning: '%s' differs from the source before its checkpoint, copying from the start\n", dest);
+        }
+    }
+    if (start > 0)
+        fprintf(stderr, "Resuming '%s' at byte %lld\n", dest, (long long)start);
+
+    // Drop whatever was written past the checkpoint, it was never confirmed
+    if (ftruncate(fd_out, start) == -1)
+    {
+        perror("ftruncate() error");
+        resume_finish(rs, 0);
+        return -1;
+    }
+    if (save_checkpoint(rs, start) != 0)
+    {
+        perror("checkpoint write error");
+        resume_finish(rs, 0);
+        return -1;
+    }
+    return start;
+}
+
+
+
+// Everything before offset is in the destination: once that is RESUME_INTERVAL past the last checkpoint,
+// flush the destination and record offset, so a crash loses at most one interval
+// returns 0, or -1 with errno set
+int resume_checkpoint(ResumeState *rs, int fd_out, off_t offset)
+{
+    if (rs == NULL || rs->fd == -1 || offset < rs->saved + RESUME_INTERVAL)
+        return 0;
+    if (fdatasync(fd_out) == -1)
+        return -1;
+    return save_checkpoint(rs, offset);
+}
+
+
+
+// Close the checkpoint, and remove it when the copy completed (an interrupted one keeps it for the next run)
+void resume_finish(ResumeState *rs, int completed)
+{
+    if (rs->fd != -1)
+    {
+        close(rs->fd);
+        if (completed && unlink(rs->path) == -1)
+            fprintf(stderr, "Warning: cannot remove the checkpoint '%s': %s\n", rs->path, strerror(errno));
+        rs->fd = -1;
+    }
+    free(rs->path);
+    rs->path = NULL;
+}
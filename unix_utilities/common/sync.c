@@ -0,0 +1,160 @@
+// --sync: when the copies are made durable, so a move only removes its source once they are on disk
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "copy.h"
+
+
+
+// Files whose writeback was started and whose wait is deferred, shared by every thread of the process
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static int batch_fds[SYNC_BATCH_SIZE];
+static int batch_count = 0;
+
+
+
+// "none", "file", "batch" or "fs", returns 0 or -1 for another name
+int copy_parse_sync(const char *name, SyncMode *mode)
+{
+    static const char *names[] = { "none", "file", "batch", "fs" };
+    for (int i = 0; i < 4; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *mode = (SyncMode)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+
+// fsync() that lets descriptors which cannot be synced (a pipe, /dev/null) pass
+static int sync_fd(int fd, int data_only)
+{
+    if ((data_only ? fdatasync(fd) : fsync(fd)) == -1 && errno != EINVAL && errno != EROFS)
+        return -1;
+    return 0;
+}
+
+
+
+// Wait for count deferred files, their data was already on its way since sync_file() started it
+static int batch_wait(const int *fds, int count)
+{
+    int result = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (sync_fd(fds[i], 1) != 0 && result == 0)
+        {
+            perror("fdatasync() error");
+            result = -1;
+        }
+        close(fds[i]);
+    }
+    return result;
+}
+
+
+
+// A file (or directory) of the copy is complete, opts->sync says what happens now:
+// file syncs it right away, batch starts its writeback without waiting and keeps it for sync_finish(),
+// or for the wait of a full batch, so the devices work while the next files are copied; none and fs do nothing
+// returns 0, -1 on error (already reported)
+int sync_file(int fd, const CopyOptions *opts)
+{
+    if (opts->sync == SYNC_FILE)
+    {
+        if (sync_fd(fd, 0) != 0)
+        {
+            perror("fsync() error");
+            return -1;
+        }
+        return 0;
+    }
+    if (opts->sync != SYNC_BATCH)
+        return 0;
+
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE); // only a head start, the deferred fdatasync() is the guarantee
+    int copy = dup(fd);
+    if (copy == -1)
+    {
+        // out of descriptors, this one is waited for now
+        if (sync_fd(fd, 1) != 0)
+        {
+            perror("fdatasync() error");
+            return -1;
+        }
+        return 0;
+    }
+
+    int full[SYNC_BATCH_SIZE];
+    int count = 0;
+    pthread_mutex_lock(&batch_lock);
+    batch_fds[batch_count++] = copy;
+    if (batch_count == SYNC_BATCH_SIZE)
+    {
+        memcpy(full, batch_fds, sizeof(full));
+        count = batch_count;
+        batch_count = 0;
+    }
+    pthread_mutex_unlock(&batch_lock);
+    return batch_wait(full, count);
+}
+
+
+
+// Everything of the copy to dest is written: make it durable before a source may be removed
+// the deferred files of batch are waited for, file and batch also sync the directory holding dest
+// (its new name is an entry of that directory), fs writes the whole destination file system with one syncfs()
+// returns 0, -1 on error (already reported)
+int sync_finish(const char *dest, const CopyOptions *opts)
+{
+    if (opts->sync == SYNC_NONE)
+        return 0;
+
+    int result = 0;
+    if (opts->sync == SYNC_BATCH)
+    {
+        int fds[SYNC_BATCH_SIZE];
+        pthread_mutex_lock(&batch_lock);
+        int count = batch_count;
+        memcpy(fds, batch_fds, count * sizeof(int));
+        batch_count = 0;
+        pthread_mutex_unlock(&batch_lock);
+        result = batch_wait(fds, count);
+    }
+
+    char *copy = strdup(dest);
+    if (copy == NULL)
+    {
+        perror("strdup() error");
+        return -1;
+    }
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    free(copy);
+    if (fd == -1)
+    {
+        perror("open() error on the destination directory");
+        return -1;
+    }
+    if (opts->sync == SYNC_FS ? syncfs(fd) == -1 : sync_fd(fd, 0) != 0)
+    {
+        perror(opts->sync == SYNC_FS ? "syncfs() error" : "fsync() error on the destination directory");
+        result = -1;
+    }
+    close(fd);
+    return result;
+}
@@ -0,0 +1,651 @@
+// Directory trees for mv across file systems: a parallel copy, a comparison, and a bottom-up removal
+// every entry is reached relative to an open directory (openat() and friends), never by a full path
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "copy.h"
+
+
+
+#define TREE_LINK_BUCKETS 4096   // hash of the files with several links, so they stay linked in the copy
+
+
+
+// A directory of the tree, freed once its listing and all its subdirectories are done
+typedef struct TreeDir
+{
+    struct TreeDir *parent;
+    struct TreeDir *next;      // in the queue of directories waiting to be listed
+    char *path;                // relative to both roots, "." for the roots themselves
+    atomic_int pending;        // its own listing plus every subdirectory not finished yet
+    struct statx stx;          // of the source directory, applied when everything inside is copied
+} TreeDir;
+
+// A file with several links that was already copied
+typedef struct HardLink
+{
+    struct HardLink *next;
+    dev_t dev;
+    ino_t ino;
+    char *path;                // of the copy, relative to the destination root
+} HardLink;
+
+// One tree copied by several threads, each lists the next directory of the queue
+typedef struct
+{
+    int src_root;
+    int dst_root;
+    const char *dest;          // as given, for messages and the checksum lines
+    CopyOptions opts;          // for every file: one thread per file, no resume
+    pthread_mutex_t lock;      // guards queue, done and links
+    pthread_cond_t wake;
+    TreeDir *queue;
+    int done;                  // the root directory finished, the workers can leave
+    atomic_int failed;         // set once, the other threads stop listing
+    HardLink *links[TREE_LINK_BUCKETS];
+} TreeCopy;
+
+
+
+// "dir/name", or name alone in the root
+static char* join_path(const char *dir, const char *name)
+{
+    if (strcmp(dir, ".") == 0)
+        return strdup(name);
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    if (path != NULL)
+        sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+
+
+// Stop the copy after an error that was already reported
+static void tree_stop(TreeCopy *tc)
+{
+    atomic_store(&tc->failed, 1);
+    pthread_mutex_lock(&tc->lock);
+    pthread_cond_broadcast(&tc->wake);
+    pthread_mutex_unlock(&tc->lock);
+}
+
+
+
+// Report a failed call on a destination path (relative to the destination root) and stop the copy
+static void tree_failed(TreeCopy *tc, const char *call, const char *path)
+{
+    int err = errno;
+    if (strcmp(path, ".") == 0)
+        fprintf(stderr, "%s() error on '%s': %s\n", call, tc->dest, strerror(err));
+    else
+        fprintf(stderr, "%s() error on '%s/%s': %s\n", call, tc->dest, path, strerror(err));
+    tree_stop(tc);
+}
+
+
+
+// Drop one reference of dir: the last one applies the attributes of the source directory
+// (its timestamps only hold once nothing is created inside anymore), syncs its entries as opts.sync
+// asks for, and moves on to the parent
+static void dir_release(TreeCopy *tc, TreeDir *dir)
+{
+    while (dir != NULL && atomic_fetch_sub(&dir->pending, 1) == 1)
+    {
+        if (!atomic_load(&tc->failed))
+        {
+            int src_fd = openat(tc->src_root, dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            int dst_fd = openat(tc->dst_root, dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (src_fd == -1 || dst_fd == -1)
+                tree_failed(tc, "open", dir->path);
+            else if (copy_metadata(src_fd, dst_fd, &dir->stx, tc->opts.preserve, tc->dest) != 0 ||
+                     sync_file(dst_fd, &tc->opts) != 0)
+                tree_stop(tc);
+            if (src_fd != -1)
+                close(src_fd);
+            if (dst_fd != -1)
+                close(dst_fd);
+        }
+        TreeDir *parent = dir->parent;
+        if (parent == NULL)
+        {
+            pthread_mutex_lock(&tc->lock);
+            tc->done = 1;
+            pthread_cond_broadcast(&tc->wake);
+            pthread_mutex_unlock(&tc->lock);
+        }
+        free(dir->path);
+        free(dir);
+        dir = parent;
+    }
+}
+
+
+
+// Attributes of an entry that cannot be opened (a symbolic link, a device, a FIFO), set by name
+// returns NULL, or the name of the call that failed with errno set
+static const char* metadata_by_name(int dst_fd, const char *name, const struct statx *stx, int preserve)
+{
+    mode_t mode = stx->stx_mode & 07777;
+    if ((preserve & PRESERVE_OWNERSHIP) &&
+        fchownat(dst_fd, name, stx->stx_uid, stx->stx_gid, AT_SYMLINK_NOFOLLOW) == -1)
+    {
+        if (errno != EPERM && errno != EINVAL)
+            return "fchownat";
+        mode &= ~(S_ISUID | S_ISGID);
+    }
+    if (!S_ISLNK(stx->stx_mode) && (preserve & PRESERVE_MODE) && fchmodat(dst_fd, name, mode, 0) == -1)
+        return "fchmodat"; // a link has no mode of its own
+    if (preserve & PRESERVE_TIMESTAMPS)
+    {
+        struct timespec times[2] = {
+            { stx->stx_atime.tv_sec, stx->stx_atime.tv_nsec },
+            { stx->stx_mtime.tv_sec, stx->stx_mtime.tv_nsec },
+        };
+        if (utimensat(dst_fd, name, times, AT_SYMLINK_NOFOLLOW) == -1)
+            return "utimensat";
+    }
+    return NULL;
+}
+
+
+
+// Copy the regular file name of src_fd to dst_fd, a file already copied under another name becomes a link to that copy
+static int copy_tree_file(TreeCopy *tc, int src_fd, int dst_fd, const char *name, const char *path)
+{
+    int fd_in = openat(src_fd, name, O_RDONLY | O_NOFOLLOW | O_NOCTTY);
+    if (fd_in == -1)
+    {
+        tree_failed(tc, "open", path);
+        return -1;
+    }
+    struct statx stx;
+    if (copy_stat(fd_in, &tc->opts, &stx) == -1)
+    {
+        tree_failed(tc, "statx", path);
+        close(fd_in);
+        return -1;
+    }
+
+    // The lock is held from the lookup until the first copy is created, so two threads never both create one
+    HardLink **bucket = NULL;
+    if (stx.stx_nlink > 1)
+    {
+        dev_t dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+        bucket = &tc->links[(stx.stx_ino ^ dev) % TREE_LINK_BUCKETS];
+        pthread_mutex_lock(&tc->lock);
+        for (HardLink *link = *bucket; link != NULL; link = link->next)
+        {
+            if (link->dev == dev && link->ino == stx.stx_ino)
+            {
+                int result = linkat(tc->dst_root, link->path, dst_fd, name, 0);
+                pthread_mutex_unlock(&tc->lock);
+                if (result == -1)
+                    tree_failed(tc, "linkat", path);
+                close(fd_in);
+                return result;
+            }
+        }
+    }
+    int fd_out = openat(dst_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_NOCTTY, stx.stx_mode & 0777);
+    if (bucket != NULL)
+    {
+        // Without memory for the record a later name becomes a copy of its own, not a link
+        HardLink *link = fd_out != -1 ? malloc(sizeof(HardLink)) : NULL;
+        if (link != NULL && (link->path = strdup(path)) == NULL)
+        {
+            free(link);
+            link = NULL;
+        }
+        if (link != NULL)
+        {
+            link->dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            link->ino = stx.stx_ino;
+            link->next = *bucket;
+            *bucket = link;
+        }
+        pthread_mutex_unlock(&tc->lock);
+    }
+    if (fd_out == -1)
+    {
+        tree_failed(tc, "open", path);
+        close(fd_in);
+        return -1;
+    }
+
+    struct stat st_out;
+    char *dest = join_path(tc->dest, path);
+    int result = -1;
+    if (fstat(fd_out, &st_out) == -1)
+        tree_failed(tc, "fstat", path);
+    else if (dest == NULL)
+        tree_failed(tc, "malloc", path);
+    else if (copy_data(fd_in, fd_out, &stx, &st_out, dest, &tc->opts) != 0)
+        tree_stop(tc);
+    else
+        result = 0;
+    free(dest);
+    close(fd_in);
+    if (close(fd_out) == -1 && result == 0)
+    {
+        tree_failed(tc, "close", path);
+        result = -1;
+    }
+    return result;
+}
+
+
+
+// Copy one entry of the directory dir, a subdirectory is created and queued for a thread to list
+static int copy_tree_entry(TreeCopy *tc, TreeDir *dir, int src_fd, int dst_fd, const char *name, unsigned char type)
+{
+    char *path = join_path(dir->path, name);
+    if (path == NULL)
+    {
+        tree_failed(tc, "malloc", dir->path);
+        return -1;
+    }
+    // Regular files are looked at through their descriptor, directories when they are listed
+    struct statx stx;
+    if (type != DT_DIR && type != DT_REG &&
+        statx(src_fd, name, AT_SYMLINK_NOFOLLOW, copy_stat_mask(&tc->opts), &stx) == -1)
+    {
+        tree_failed(tc, "statx", path);
+        free(path);
+        return -1;
+    }
+    if (type == DT_UNKNOWN)
+        type = S_ISDIR(stx.stx_mode) ? DT_DIR : S_ISREG(stx.stx_mode) ? DT_REG : DT_UNKNOWN;
+
+    int result = 0;
+    if (type == DT_DIR)
+    {
+        TreeDir *child = malloc(sizeof(TreeDir));
+        if (child == NULL || mkdirat(dst_fd, name, 0700) == -1)
+        {
+            tree_failed(tc, child == NULL ? "malloc" : "mkdirat", path);
+            free(child);
+            free(path);
+            return -1;
+        }
+        child->parent = dir;
+        child->path = path;
+        atomic_init(&child->pending, 1);
+        atomic_fetch_add(&dir->pending, 1);
+        pthread_mutex_lock(&tc->lock);
+        child->next = tc->queue;
+        tc->queue = child;
+        pthread_cond_signal(&tc->wake);
+        pthread_mutex_unlock(&tc->lock);
+        return 0;
+    }
+    if (type == DT_REG)
+        result = copy_tree_file(tc, src_fd, dst_fd, name, path);
+    else if (S_ISLNK(stx.stx_mode))
+    {
+        char *target = malloc(stx.stx_size + 1);
+        ssize_t len = target != NULL ? readlinkat(src_fd, name, target, stx.stx_size + 1) : -1;
+        if (len < 0 || (size_t)len > stx.stx_size)
+        {
+            if (len >= 0)
+                errno = EAGAIN; // the link changed since statx()
+            tree_failed(tc, "readlinkat", path);
+            result = -1;
+        }
+        else
+        {
+            target[len] = '\0';
+            if (symlinkat(target, dst_fd, name) == -1)
+            {
+                tree_failed(tc, "symlinkat", path);
+                result = -1;
+            }
+        }
+        free(target);
+    }
+    else if (mknodat(dst_fd, name, stx.stx_mode & (S_IFMT | 0777), makedev(stx.stx_rdev_major, stx.stx_rdev_minor)) == -1)
+    {
+        tree_failed(tc, "mknodat", path);
+        result = -1;
+    }
+    const char *call;
+    if (result == 0 && type != DT_REG && (call = metadata_by_name(dst_fd, name, &stx, tc->opts.preserve)) != NULL)
+    {
+        tree_failed(tc, call, path);
+        result = -1;
+    }
+    free(path);
+    return result;
+}
+
+
+
+// List one source directory and copy everything in it
+static void copy_tree_dir(TreeCopy *tc, TreeDir *dir)
+{
+    int src_fd = openat(tc->src_root, dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (src_fd == -1 || copy_stat(src_fd, &tc->opts, &dir->stx) == -1)
+    {
+        tree_failed(tc, src_fd == -1 ? "open" : "statx", dir->path);
+        if (src_fd != -1)
+            close(src_fd);
+        return;
+    }
+    int dst_fd = openat(tc->dst_root, dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    DIR *d = dst_fd != -1 ? fdopendir(src_fd) : NULL;
+    if (d == NULL)
+    {
+        tree_failed(tc, dst_fd == -1 ? "open" : "fdopendir", dir->path);
+        close(src_fd);
+        if (dst_fd != -1)
+            close(dst_fd);
+        return;
+    }
+
+    struct dirent *entry;
+    errno = 0;
+    while (!atomic_load(&tc->failed) && (entry = readdir(d)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            copy_tree_entry(tc, dir, src_fd, dst_fd, entry->d_name, entry->d_type);
+        errno = 0;
+    }
+    if (errno != 0)
+        tree_failed(tc, "readdir", dir->path);
+    closedir(d);
+    close(dst_fd);
+}
+
+
+
+// Thread body: list queued directories until the whole tree is done (or failed and drained)
+static void* copy_tree_worker(void *arg)
+{
+    TreeCopy *tc = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&tc->lock);
+        while (tc->queue == NULL && !tc->done)
+            pthread_cond_wait(&tc->wake, &tc->lock);
+        TreeDir *dir = tc->queue;
+        if (dir != NULL)
+            tc->queue = dir->next;
+        pthread_mutex_unlock(&tc->lock);
+        if (dir == NULL)
+            break;
+
+        if (!atomic_load(&tc->failed))
+            copy_tree_dir(tc, dir);
+        dir_release(tc, dir);
+    }
+    return NULL;
+}
+
+
+
+// Copy the directory src to dest (created, it must not exist) on jobs threads (the calling one included),
+// each file with opts and the attributes opts->preserve names (mode always), directories last
+// returns 0, -1 on error (already reported, dest holds what was copied until then)
+int copy_tree(const char *src, const char *dest, const CopyOptions *opts, int jobs)
+{
+    TreeCopy tc;
+    tc.dest = dest;
+    tc.opts = *opts;
+    tc.opts.jobs = 1;          // the threads go to the files, not to the ranges of one file
+    tc.opts.resume = 0;        // the files are all created new
+    tc.opts.preserve |= PRESERVE_MODE;
+    tc.queue = NULL;
+    tc.done = 0;
+    atomic_init(&tc.failed, 0);
+    memset(tc.links, 0, sizeof(tc.links));
+
+    tc.src_root = open(src, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (tc.src_root == -1)
+    {
+        perror("open() error on source");
+        return -1;
+    }
+    if (mkdir(dest, 0700) == -1)
+    {
+        perror("mkdir() error on destination");
+        close(tc.src_root);
+        return -1;
+    }
+    tc.dst_root = open(dest, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (tc.dst_root == -1)
+    {
+        perror("open() error on destination");
+        close(tc.src_root);
+        return -1;
+    }
+    TreeDir *root = malloc(sizeof(TreeDir));
+    char *root_path = strdup(".");
+    if (root == NULL || root_path == NULL)
+    {
+        perror("malloc() error");
+        free(root);
+        free(root_path);
+        close(tc.src_root);
+        close(tc.dst_root);
+        return -1;
+    }
+    root->parent = NULL;
+    root->next = NULL;
+    root->path = root_path;
+    atomic_init(&root->pending, 1);
+    tc.queue = root;
+    pthread_mutex_init(&tc.lock, NULL);
+    pthread_cond_init(&tc.wake, NULL);
+
+    pthread_t threads[MAX_JOBS];
+    int started = 0;
+    for (int i = 1; i < jobs && i < MAX_JOBS; i++)
+    {
+        int err = pthread_create(&threads[started], NULL, copy_tree_worker, &tc);
+        if (err != 0)
+        {
+            fprintf(stderr, "pthread_create() error: %s, copying with %d threads\n", strerror(err), started + 1);
+            break;
+        }
+        started++;
+    }
+    copy_tree_worker(&tc);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < TREE_LINK_BUCKETS; i++)
+    {
+        while (tc.links[i] != NULL)
+        {
+            HardLink *next = tc.links[i]->next;
+            free(tc.links[i]->path);
+            free(tc.links[i]);
+            tc.links[i] = next;
+        }
+    }
+    pthread_cond_destroy(&tc.wake);
+    pthread_mutex_destroy(&tc.lock);
+    close(tc.src_root);
+    close(tc.dst_root);
+    return atomic_load(&tc.failed) ? -1 : 0;
+}
+
+
+
+// Both directories hold the same names with the same types, regular files and links of the same size
+static int compare_dir(int src_fd, int dst_fd, const char *dest)
+{
+    int fd = dup(src_fd);
+    DIR *d = fd != -1 ? fdopendir(fd) : NULL;
+    if (d == NULL)
+    {
+        perror("opendir() error");
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    int result = 0;
+    struct dirent *entry;
+    errno = 0;
+    while (result == 0 && (entry = readdir(d)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            errno = 0;
+            continue;
+        }
+        struct statx in, out;
+        if (statx(src_fd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_SIZE, &in) == -1 ||
+            statx(dst_fd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_SIZE, &out) == -1)
+        {
+            fprintf(stderr, "Error: '%s/%s' cannot be compared with its source: %s\n", dest, name, strerror(errno));
+            result = -1;
+        }
+        else if ((in.stx_mode & S_IFMT) != (out.stx_mode & S_IFMT) ||
+                 ((S_ISREG(in.stx_mode) || S_ISLNK(in.stx_mode)) && in.stx_size != out.stx_size))
+        {
+            fprintf(stderr, "Error: '%s/%s' does not match its source\n", dest, name);
+            result = -1;
+        }
+        else if (S_ISDIR(in.stx_mode))
+        {
+            char *path = join_path(dest, name);
+            int sub_in = openat(src_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            int sub_out = openat(dst_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (path == NULL || sub_in == -1 || sub_out == -1)
+            {
+                fprintf(stderr, "Error: '%s/%s' cannot be compared with its source: %s\n", dest, name, strerror(errno));
+                result = -1;
+            }
+            else
+                result = compare_dir(sub_in, sub_out, path);
+            free(path);
+            if (sub_in != -1)
+                close(sub_in);
+            if (sub_out != -1)
+                close(sub_out);
+        }
+        errno = 0;
+    }
+    if (result == 0 && errno != 0)
+    {
+        perror("readdir() error");
+        result = -1;
+    }
+    closedir(d);
+    return result;
+}
+
+
+
+// Check that the copy of src in dest is complete before anything of src is removed
+// returns 0, -1 when an entry is missing or differs (already reported)
+int compare_tree(const char *src, const char *dest)
+{
+    int src_fd = open(src, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    int dst_fd = open(dest, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    int result = -1;
+    if (src_fd == -1 || dst_fd == -1)
+        perror("open() error");
+    else
+        result = compare_dir(src_fd, dst_fd, dest);
+    if (src_fd != -1)
+        close(src_fd);
+    if (dst_fd != -1)
+        close(dst_fd);
+    return result;
+}
+
+
+
+// Remove everything inside dir_fd, subdirectories emptied first (bottom-up)
+static int remove_entries(int dir_fd, const char *path)
+{
+    int fd = dup(dir_fd);
+    DIR *d = fd != -1 ? fdopendir(fd) : NULL;
+    if (d == NULL)
+    {
+        fprintf(stderr, "opendir() error on '%s': %s\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    int result = 0;
+    struct dirent *entry;
+    errno = 0;
+    while (result == 0 && (entry = readdir(d)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            errno = 0;
+            continue;
+        }
+        int is_dir = entry->d_type == DT_DIR;
+        struct stat st;
+        if (entry->d_type == DT_UNKNOWN && fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            is_dir = S_ISDIR(st.st_mode);
+        if (is_dir)
+        {
+            char *sub_path = join_path(path, name);
+            int sub_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (sub_path == NULL || sub_fd == -1)
+            {
+                fprintf(stderr, "open() error on '%s/%s': %s\n", path, name, strerror(errno));
+                result = -1;
+            }
+            else
+                result = remove_entries(sub_fd, sub_path);
+            if (sub_fd != -1)
+                close(sub_fd);
+            free(sub_path);
+        }
+        if (result == 0 && unlinkat(dir_fd, name, is_dir ? AT_REMOVEDIR : 0) == -1)
+        {
+            fprintf(stderr, "unlinkat() error on '%s/%s': %s\n", path, name, strerror(errno));
+            result = -1;
+        }
+        errno = 0;
+    }
+    if (result == 0 && errno != 0)
+    {
+        fprintf(stderr, "readdir() error on '%s': %s\n", path, strerror(errno));
+        result = -1;
+    }
+    closedir(d);
+    return result;
+}
+
+
+
+// Remove the directory path and everything in it, returns 0, -1 on error (already reported)
+int remove_tree(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (fd == -1)
+    {
+        fprintf(stderr, "open() error on '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    int result = remove_entries(fd, path);
+    close(fd);
+    if (result == 0 && rmdir(path) == -1)
+    {
+        fprintf(stderr, "rmdir() error on '%s': %s\n", path, strerror(errno));
+        result = -1;
+    }
+    return result;
+}
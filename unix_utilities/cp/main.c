@@ -1,6 +1,6 @@
 // Implementing the cp command over linux using C and systemcalls
 
-
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <unistd.h>
@@ -8,77 +8,212 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "copy.h"
+
+
+
+// Close both files after an error, an atomic copy that was not published goes with them
+static int give_up(int fd1, int fd2, AtomicDest *ad)
+{
+    close(fd1);
+    close(fd2);
+    if (ad != NULL)
+        atomic_close(ad);
+    return 1;
+}
+
+
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] <source> <destination>\n", name);
+    printf("  -j, --jobs=N              copy a large regular file as N ranges in parallel (default 1)\n");
+    printf("  -c, --chunk-size=S        bytes per range, K/M/G suffixes, rounded up to 1M (default 64M)\n");
+    printf("      --checksum=ALGO       crc32c or xxh3 (one thread) of the data as it is copied, printed with the destination\n");
+    printf("      --verify[=direct]     read the destination back (with O_DIRECT) and compare checksums\n");
+    printf("  -p, --preserve[=LIST]     keep mode, ownership, timestamps, xattr (comma separated, or all)\n");
+    printf("                            of the source, -p and no LIST mean mode,ownership,timestamps\n");
+    printf("      --sync=MODE           none (default), file (fsync), batch (deferred, asynchronous writeback)\n");
+    printf("                            or fs (one syncfs at the end)\n");
+    printf("      --atomic              write an unnamed or hidden file and rename it to the destination once complete\n");
+    printf("      --resume              continue an interrupted copy from its checkpoint <destination>%s\n", RESUME_SUFFIX);
+}
+
 
 
 int main (int argc, char *argv[])
 {
-    if (argc < 3) // checking the arguments to be atleast two arguments cuz the argc[0] is the name of the program :)
+    static const struct option long_options[] = {
+        { "jobs", required_argument, NULL, 'j' },
+        { "chunk-size", required_argument, NULL, 'c' },
+        { "checksum", required_argument, NULL, 'S' },
+        { "verify", optional_argument, NULL, 'V' },
+        { "preserve", optional_argument, NULL, 'P' },
+        { "resume", no_argument, NULL, 'R' },
+        { "sync", required_argument, NULL, 'Y' },
+        { "atomic", no_argument, NULL, 'A' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    CopyOptions opts;
+    copy_options_init(&opts);
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:c:ph", long_options, NULL)) != -1)
     {
-        printf("Usage: %s <source> <destination>\n", argv[0]);
+        switch (opt)
+        {
+            case 'j':
+                opts.jobs = atoi(optarg);
+                if (opts.jobs < 1 || opts.jobs > MAX_JOBS)
+                {
+                    fprintf(stderr, "Error: jobs must be between 1 and %d\n", MAX_JOBS);
+                    return 1;
+                }
+                break;
+            case 'c':
+                opts.chunk_size = copy_parse_size(optarg);
+                if (opts.chunk_size <= 0)
+                {
+                    fprintf(stderr, "Error: invalid chunk size '%s'\n", optarg);
+                    return 1;
+                }
+                opts.chunk_size = (opts.chunk_size + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+                break;
+            case 'S':
+                if (checksum_parse(optarg, &opts.checksum) != 0)
+                {
+                    fprintf(stderr, "Error: unknown checksum '%s' (crc32c or xxh3)\n", optarg);
+                    return 1;
+                }
+                opts.print_checksum = 1;
+                break;
+            case 'V':
+                if (optarg != NULL && strcmp(optarg, "direct") != 0)
+                {
+                    fprintf(stderr, "Error: --verify takes no value or 'direct'\n");
+                    return 1;
+                }
+                opts.verify = optarg != NULL ? VERIFY_DIRECT : VERIFY_CACHED;
+                break;
+            case 'p':
+                opts.preserve |= PRESERVE_DEFAULT;
+                break;
+            case 'P':
+                if (optarg == NULL)
+                    opts.preserve |= PRESERVE_DEFAULT;
+                else if (copy_parse_preserve(optarg, &opts.preserve) != 0)
+                    return 1;
+                break;
+            case 'R':
+                opts.resume = 1;
+                break;
+            case 'A':
+                opts.atomic = 1;
+                break;
+            case 'Y':
+                if (copy_parse_sync(optarg, &opts.sync) != 0)
+                {
+                    fprintf(stderr, "Error: unknown sync mode '%s' (none, file, batch or fs)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (opts.verify != VERIFY_NONE && opts.checksum == CHECKSUM_NONE)
+        opts.checksum = CHECKSUM_CRC32C; // the cheapest one when only verification asked for a checksum
+    if (opts.atomic && opts.resume)
+    {
+        fprintf(stderr, "Error: --atomic and --resume cannot be combined, an atomic copy always starts anew\n");
         return 1;
     }
-    int fd1 = open(argv[1], O_RDONLY); // opening the source file in read only mode
-    if (fd1 == -1)
+    if (argc - optind != 2) // checking the arguments to be exactly two files after the options
     {
-        perror("open() error");
+        usage(argv[0]);
         return 1;
     }
-    int fd2 = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644); // opening the destination file in write only mode
-    if (fd2 == -1)                                               // creating the file if it doesn't exist
+    const char *src = argv[optind];
+    const char *dest = argv[optind + 1];
+
+    int fd1 = open(src, O_RDONLY); // opening the source file in read only mode
+    if (fd1 == -1)
     {
         perror("open() error");
         return 1;
     }
-    // Check if the source and destination file descriptors are the same
-    struct stat stat_src, stat_dst;
-    if (fstat(fd1, &stat_src) == -1) {
-        perror("fstat() error on source");
+    AtomicDest ad;
+    AtomicDest *atomic = opts.atomic ? &ad : NULL;
+    int fd2;
+    if (atomic != NULL)
+        fd2 = atomic_open(&ad, dest); // a file no reader sees until it is renamed to the destination
+    else
+        fd2 = open(dest, O_WRONLY | O_CREAT, 0644); // opening the destination file in write only mode
+    if (fd2 == -1)                                  // creating the file if it doesn't exist
+    {
+        if (atomic == NULL)
+            perror("open() error");
         close(fd1);
-        close(fd2);
         return 1;
     }
-    
-
-     else if (stat_src.st_dev == stat_dst.st_dev && 
-               stat_src.st_ino == stat_dst.st_ino) {
-        fprintf(stderr, "Error: '%s' and '%s' are the same file\n", argv[1], argv[2]);
-        close(fd1);
-        close(fd2);
-        return 1;
+    // Check if the source and destination file descriptors are the same
+    struct statx stat_src;
+    struct stat stat_dst;
+    if (copy_stat(fd1, &opts, &stat_src) == -1) {
+        perror("statx() error on source");
+        return give_up(fd1, fd2, atomic);
     }
-    char buffer[1024];
-    ssize_t bytes;
-    while ((bytes = read(fd1, buffer, sizeof(buffer))) > 0) // reading the source file and writing the content to the destination file
-    {
-        if (write(fd2, buffer, bytes) != bytes)
-        {
-            perror("write() error");
-            return 1;
-        }
+    if (fstat(fd2, &stat_dst) == -1) {
+        perror("fstat() error on destination");
+        return give_up(fd1, fd2, atomic);
+    }
+    else if (copy_same_file(&stat_src, atomic != NULL && ad.replaces ? &ad.replaced : &stat_dst)) {
+        fprintf(stderr, "Error: '%s' and '%s' are the same file\n", src, dest);
+        return give_up(fd1, fd2, atomic);
     }
-    if (bytes == -1)
+    // Truncate only now, opening with O_TRUNC would have emptied the source when both are the same file
+    // (a resumed copy keeps what its checkpoint vouches for, an atomic one starts empty, a device or FIFO cannot be)
+    if (!opts.resume && atomic == NULL && S_ISREG(stat_dst.st_mode) && ftruncate(fd2, 0) == -1)
     {
-        perror("read() error");
-        return 1;
+        perror("ftruncate() error");
+        return give_up(fd1, fd2, atomic);
     }
+
+    if (copy_data(fd1, fd2, &stat_src, &stat_dst, dest, &opts) != 0)
+        return give_up(fd1, fd2, atomic);
+    if (atomic != NULL && atomic_publish(&ad, fd2) != 0)
+        return give_up(fd1, fd2, atomic);
     if (close(fd1) == -1) // closing the source file
     {
         perror("close() error");
+        close(fd2);
+        if (atomic != NULL)
+            atomic_close(&ad);
         return 1;
     }
-    if (close(fd2) == -1) // closing the destination file
+    int closed = close(fd2); // closing the destination file
+    if (atomic != NULL)
+        atomic_close(&ad);
+    if (closed == -1)
     {
         perror("close() error");
         return 1;
     }
+    if (sync_finish(dest, &opts) != 0)
+        return 1;
     return 0;
 }
 
 
 // Compile the code using the following command
-// gcc main.c -o cp
+// gcc -I../common main.c ../common/copy.c ../common/checksum.c ../common/metadata.c ../common/resume.c ../common/sync.c ../common/atomic.c -o cp -pthread
 // Run the code using the following command
-// ./cp <source> <destination>
+// ./cp [-j jobs] [--verify] [-p] [--resume | --atomic] <source> <destination>
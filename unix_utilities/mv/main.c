@@ -1,13 +1,28 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
-int move_file(const char *src, const char *dest) {
+#include "copy.h"
+
+int move_file(const char *src, const char *dest, const CopyOptions *opts) {
+
+    // On the same file system a move is a rename, only another file system needs the copy
+    if (rename(src, dest) == 0) {
+        return 0;
+    }
+    if (errno != EXDEV) {
+        perror("rename() error");
+        return 1;
+    }
     
     // Open the source file 
     int fd1 = open(src, O_RDONLY);
@@ -17,15 +32,15 @@ int move_file(const char *src, const char *dest) {
     }
 
     
-    struct stat stat_src; // Get the source file's metadata to preserve permissions
-    if (fstat(fd1, &stat_src) == -1) {
-        perror("fstat() error on source");
+    struct statx stat_src; // Get the source file's metadata to preserve permissions
+    if (copy_stat(fd1, opts, &stat_src) == -1) {
+        perror("statx() error on source");
         close(fd1);
         return 1;
     }
 
     
-    int fd2 = open(dest, O_WRONLY | O_CREAT | O_TRUNC, stat_src.st_mode & 0777); // Open the destination file 
+    int fd2 = open(dest, O_WRONLY | O_CREAT, stat_src.stx_mode & 0777); // Open the destination file 
     if (fd2 == -1) { 
         perror("open() error on destination");
         close(fd1);
@@ -34,38 +49,49 @@ int move_file(const char *src, const char *dest) {
 
     // Check if source and destination are the same file
     struct stat stat_dst;
-    if (fstat(fd2, &stat_dst) != -1) {
-        if (stat_src.st_dev == stat_dst.st_dev && stat_src.st_ino == stat_dst.st_ino) {
-            fprintf(stderr, "Error: '%s' and '%s' are the same file\n", src, dest);
-            close(fd1);
-            close(fd2);
-            return 1;
-        }
+    if (fstat(fd2, &stat_dst) == -1) {
+        perror("fstat() error on destination");
+        close(fd1);
+        close(fd2);
+        return 1;
+    }
+    if (copy_same_file(&stat_src, &stat_dst)) {
+        fprintf(stderr, "Error: '%s' and '%s' are the same file\n", src, dest);
+        close(fd1);
+        close(fd2);
+        return 1;
     }
 
-
-    // Copying
-    char buffer[1024];
-    ssize_t bytes;
-    while ((bytes = read(fd1, buffer, sizeof(buffer))) > 0) {
-        if (write(fd2, buffer, bytes) != bytes) {
-            perror("write() error");
-            close(fd1);
-            close(fd2);
-            return 1;
-        }
+    // Truncate only now, O_TRUNC would have emptied the source when both are the same file
+    // (a resumed move keeps what its checkpoint vouches for, a device or FIFO cannot be truncated)
+    if (!opts->resume && S_ISREG(stat_dst.st_mode) && ftruncate(fd2, 0) == -1) {
+        perror("ftruncate() error");
+        close(fd1);
+        close(fd2);
+        return 1;
     }
 
-    if (bytes == -1) {
-        perror("read() error");
+
+    // Copying, with verification the source is only removed once the destination reads back the same
+    if (copy_data(fd1, fd2, &stat_src, &stat_dst, dest, opts) != 0) {
+        fprintf(stderr, "Error: '%s' is kept, it was not moved completely\n", src);
         close(fd1);
         close(fd2);
         return 1;
     }
 
-    // Close the files
+    // Close the files, a failing close() can be the first report of a failed write
     close(fd1);
-    close(fd2);
+    if (close(fd2) == -1) {
+        perror("close() error on destination");
+        return 1;
+    }
+
+    // The copy has to be on disk before the only other one is removed
+    if (sync_finish(dest, opts) != 0) {
+        fprintf(stderr, "Error: '%s' is kept, its copy could not be synced\n", src);
+        return 1;
+    }
 
 
     
@@ -82,35 +108,180 @@ int move_file(const char *src, const char *dest) {
 
 
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s <source> <destination>\n", argv[0]);
+int move_link(const char *src, const char *dest) {
+
+    if (rename(src, dest) == 0) {
+        return 0;
+    }
+    if (errno != EXDEV) {
+        perror("rename() error");
         return 1;
     }
 
-    const char *src = argv[1];
-    const char *dest = argv[2];
+    // Another file system: the same link is created there, pointing where the source points
+    char target[PATH_MAX];
+    ssize_t len = readlink(src, target, sizeof(target) - 1);
+    if (len == -1) {
+        perror("readlink() error");
+        return 1;
+    }
+    target[len] = '\0';
+    if (symlink(target, dest) == -1 && (errno != EEXIST || unlink(dest) == -1 || symlink(target, dest) == -1)) {
+        perror("symlink() error");
+        return 1;
+    }
+    if (unlink(src) == -1) {
+        perror("unlink() error");
+        return 1;
+    }
+    return 0;
+}
 
-    // Check if source exists
-    struct stat stat_buf;
-    if (stat(src, &stat_buf) == -1) {
-        perror("stat() error on source");
+
+
+
+
+
+int move_directory(const char *src, const char *dest, const CopyOptions *opts, int jobs) {
+
+    // Same file system: one atomic rename of the whole tree, never over an existing destination
+    if (renameat2(AT_FDCWD, src, AT_FDCWD, dest, RENAME_NOREPLACE) == 0) {
+        return 0;
+    }
+    // No RENAME_NOREPLACE here: main() only turned away a destination that is a directory, and rename()
+    // itself refuses to put a directory over anything else (ENOTDIR), so nothing can be replaced
+    if (errno == EINVAL || errno == ENOSYS) {
+        if (rename(src, dest) == 0) {
+            return 0;
+        }
+    }
+    if (errno != EXDEV) {
+        perror("rename() error");
         return 1;
     }
 
+    // Another file system: copy the tree, sync it, check it is complete, only then remove the source
+    if (copy_tree(src, dest, opts, jobs) != 0 || sync_finish(dest, opts) != 0 || compare_tree(src, dest) != 0) {
+        fprintf(stderr, "Error: '%s' is kept, it was not moved completely\n", src);
+        return 1;
+    }
+    if (remove_tree(src) != 0) {
+        fprintf(stderr, "Error: '%s' was copied to '%s' but not completely removed\n", src, dest);
+        return 1;
+    }
+    return 0;
+}
+
 
-    if (S_ISDIR(stat_buf.st_mode)) {
-        fprintf(stderr, "Error: '%s' is a directory (directory moves not supported in this implementation)\n", src);
+
+
+
+
+static void usage(const char *name) {
+    printf("Usage: %s [options] <source> <destination>\n", name);
+    printf("A file or directory is renamed, the options are for a move to another file system, which copies:\n");
+    printf("  -j, --jobs=N        threads copying a directory (default %d) or the ranges of one large file (default 1)\n", TREE_JOBS);
+    printf("  --checksum=ALGO     crc32c or xxh3 of the data as it is copied, printed with the destination\n");
+    printf("  --verify[=direct]   read the destination back (with O_DIRECT) before the source is removed\n");
+    printf("  --preserve[=LIST]   keep xattr too (xattr or all), mode, ownership and timestamps always are\n");
+    printf("  --sync=MODE         batch (default: deferred, asynchronous writeback), file (fsync), fs (one syncfs)\n");
+    printf("                      or none, the source is only removed once the copy is synced\n");
+    printf("  --resume            continue an interrupted move from its checkpoint <destination>%s\n", RESUME_SUFFIX);
+}
+
+
+
+
+
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        { "jobs", required_argument, NULL, 'j' },
+        { "checksum", required_argument, NULL, 'S' },
+        { "verify", optional_argument, NULL, 'V' },
+        { "preserve", optional_argument, NULL, 'P' },
+        { "resume", no_argument, NULL, 'R' },
+        { "sync", required_argument, NULL, 'Y' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    CopyOptions opts;
+    copy_options_init(&opts);
+    opts.preserve = PRESERVE_DEFAULT; // a copied file keeps what a renamed one would, existing destination or not
+    opts.sync = SYNC_BATCH;           // and is on disk before its source is gone
+    int jobs = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:h", long_options, NULL)) != -1) {
+        if (opt == 'j') {
+            jobs = atoi(optarg);
+            if (jobs < 1 || jobs > MAX_JOBS) {
+                fprintf(stderr, "Error: jobs must be between 1 and %d\n", MAX_JOBS);
+                return 1;
+            }
+            opts.jobs = jobs;
+        } else if (opt == 'S') {
+            if (checksum_parse(optarg, &opts.checksum) != 0) {
+                fprintf(stderr, "Error: unknown checksum '%s' (crc32c or xxh3)\n", optarg);
+                return 1;
+            }
+            opts.print_checksum = 1;
+        } else if (opt == 'V') {
+            if (optarg != NULL && strcmp(optarg, "direct") != 0) {
+                fprintf(stderr, "Error: --verify takes no value or 'direct'\n");
+                return 1;
+            }
+            opts.verify = optarg != NULL ? VERIFY_DIRECT : VERIFY_CACHED;
+        } else if (opt == 'P') {
+            if (optarg != NULL && copy_parse_preserve(optarg, &opts.preserve) != 0) {
+                return 1;
+            }
+        } else if (opt == 'R') {
+            opts.resume = 1;
+        } else if (opt == 'Y') {
+            if (copy_parse_sync(optarg, &opts.sync) != 0) {
+                fprintf(stderr, "Error: unknown sync mode '%s' (none, file, batch or fs)\n", optarg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.verify != VERIFY_NONE && opts.checksum == CHECKSUM_NONE) {
+        opts.checksum = CHECKSUM_CRC32C;
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
         return 1;
     }
 
+    const char *src = argv[optind];
+    const char *dest = argv[optind + 1];
+
+    // Check if source exists, a symbolic link is moved as the link itself
+    struct stat stat_buf;
+    if (lstat(src, &stat_buf) == -1) {
+        perror("stat() error on source");
+        return 1;
+    }
+    int is_dir = S_ISDIR(stat_buf.st_mode);
+    int is_link = S_ISLNK(stat_buf.st_mode);
+
     if (stat(dest, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode)) {
         fprintf(stderr, "Error: '%s' is a directory\n", dest);
         return 1;
     }
 
     // Perform the move
-    if (move_file(src, dest) != 0) {
+    if (is_dir) {
+        if (move_directory(src, dest, &opts, jobs > 0 ? jobs : TREE_JOBS) != 0) {
+            return 1;
+        }
+    } else if (is_link) {
+        if (move_link(src, dest) != 0) {
+            return 1;
+        }
+    } else if (move_file(src, dest, &opts) != 0) {
         return 1;
     }
 
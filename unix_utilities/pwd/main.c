@@ -10,7 +10,7 @@
 
 
 
-int main(int argc, char *argv[])
+int main(void)
 {
     char cwd[1024];
     if (getcwd(cwd, sizeof(cwd)) != NULL)  // getcwd() retruns a string containing the absolute path of the current working directory